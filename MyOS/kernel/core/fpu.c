@@ -0,0 +1,147 @@
+// kernel/core/fpu.c
+// Lazy FPU/SSE state switching
+
+#include "../include/kernel.h"
+#include "../include/process.h"
+#include "../include/memory.h"
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR0_NE (1 << 5)
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE (1 << 25)
+
+// Thread whose state is currently loaded in the FPU registers
+static Thread* fpu_owner[NR_CPUS];
+static int use_fxsr = 0;
+static int use_sse = 0;
+
+static inline uint32_t read_cr0(void) {
+    uint32_t value;
+    asm volatile("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uint32_t value) {
+    asm volatile("mov %0, %%cr0" : : "r"(value));
+}
+
+static inline void set_ts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline void clear_ts(void) {
+    asm volatile("clts");
+}
+
+void init_fpu(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    
+    // Native FPU error reporting, and WAIT/FWAIT trap when TS is set
+    uint32_t cr0 = read_cr0();
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+    
+    if(edx & CPUID_FXSR) {
+        uint32_t cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_OSFXSR;
+        if(edx & CPUID_SSE) {
+            cr4 |= CR4_OSXMMEXCPT;
+            use_sse = 1;
+        }
+        asm volatile("mov %0, %%cr4" : : "r"(cr4));
+        use_fxsr = 1;
+    }
+    
+    asm volatile("fninit");
+    
+    // Nobody owns the FPU yet, the first user traps into fpu_device_not_available()
+    set_ts();
+}
+
+// Called by the scheduler before switching to next
+void fpu_switch(Thread* next) {
+    if(fpu_owner[cpu_id()] == next) {
+        clear_ts(); // Registers still hold its state
+    } else {
+        set_ts();
+    }
+}
+
+static void fpu_save(Thread* thread) {
+    if(use_fxsr) {
+        asm volatile("fxsave (%0)" : : "r"(thread->fpu_state) : "memory");
+    } else {
+        asm volatile("fnsave (%0); fwait" : : "r"(thread->fpu_state) : "memory");
+    }
+}
+
+static void fpu_restore(Thread* thread) {
+    if(use_fxsr) {
+        asm volatile("fxrstor (%0)" : : "r"(thread->fpu_state) : "memory");
+    } else {
+        asm volatile("frstor (%0)" : : "r"(thread->fpu_state) : "memory");
+    }
+}
+
+// #NM: the current thread touched the FPU while CR0.TS was set
+void fpu_device_not_available(void) {
+    uint32_t flags = irq_save();
+    Thread* self = get_current_thread();
+    Thread* owner = fpu_owner[cpu_id()];
+    
+    clear_ts();
+    
+    if(owner != self) {
+        if(owner) {
+            fpu_save(owner);
+        }
+        
+        if(!self->fpu_state) {
+            // First use, FXSAVE needs a 16-byte aligned area
+            self->fpu_alloc = kmalloc(FPU_STATE_SIZE + 15);
+            if(!self->fpu_alloc) {
+                print("FPU: out of memory for thread state\n");
+                while(1) {
+                    asm volatile("hlt");
+                }
+            }
+            self->fpu_state = (uint8_t*)(((uint32_t)self->fpu_alloc + 15) & ~15);
+            
+            // Start from a clean state, with SSE exceptions masked
+            asm volatile("fninit");
+            if(use_sse) {
+                uint32_t mxcsr = 0x1F80;
+                asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+            }
+        } else {
+            fpu_restore(self);
+        }
+        
+        fpu_owner[cpu_id()] = self;
+    }
+    
+    irq_restore(flags);
+}
+
+// Forget a dying thread's FPU state
+void fpu_release(Thread* thread) {
+    uint32_t flags = irq_save();
+    if(fpu_owner[cpu_id()] == thread) {
+        fpu_owner[cpu_id()] = NULL;
+    }
+    irq_restore(flags);
+    
+    if(thread->fpu_alloc) {
+        kfree(thread->fpu_alloc);
+        thread->fpu_alloc = NULL;
+        thread->fpu_state = NULL;
+    }
+}
@@ -0,0 +1,74 @@
+// kernel/core/gdt.c
+// Global descriptor table and thread-local storage segment
+
+#include "../include/kernel.h"
+
+#define GDT_ENTRIES 6
+
+// GDT entry structure
+typedef struct {
+    unsigned short limit_low;
+    unsigned short base_low;
+    unsigned char base_middle;
+    unsigned char access;
+    unsigned char granularity;
+    unsigned char base_high;
+} __attribute__((packed)) GDTEntry;
+
+typedef struct {
+    unsigned short limit;
+    unsigned int base;
+} __attribute__((packed)) GDTDescriptor;
+
+static GDTEntry gdt[GDT_ENTRIES];
+static GDTDescriptor gdt_desc;
+static uint32_t tls_base = 0; // Base currently loaded in GS
+
+static void set_gdt_entry(int n, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    gdt[n].limit_low = limit & 0xFFFF;
+    gdt[n].base_low = base & 0xFFFF;
+    gdt[n].base_middle = (base >> 16) & 0xFF;
+    gdt[n].access = access;
+    gdt[n].granularity = ((limit >> 16) & 0x0F) | (flags << 4);
+    gdt[n].base_high = (base >> 24) & 0xFF;
+}
+
+void init_gdt(void) {
+    gdt_desc.limit = sizeof(gdt) - 1;
+    gdt_desc.base = (unsigned int)&gdt;
+    
+    set_gdt_entry(0, 0, 0, 0, 0);                // Null descriptor
+    set_gdt_entry(1, 0, 0xFFFFF, 0x9A, 0xC);     // Kernel code (0x08)
+    set_gdt_entry(2, 0, 0xFFFFF, 0x92, 0xC);     // Kernel data (0x10)
+    set_gdt_entry(3, 0, 0xFFFFF, 0xFA, 0xC);     // User code (0x18)
+    set_gdt_entry(4, 0, 0xFFFFF, 0xF2, 0xC);     // User data (0x20)
+    set_gdt_entry(5, 0, 0xFFFFF, 0xF2, 0xC);     // Thread-local storage (0x28)
+    
+    asm volatile("lgdt %0" : : "m"(gdt_desc));
+    
+    // Reload segment registers from the new table
+    asm volatile(
+        "ljmp $0x08, $1f\n"
+        "1:\n"
+        "mov $0x10, %%ax\n"
+        "mov %%ax, %%ds\n"
+        "mov %%ax, %%es\n"
+        "mov %%ax, %%fs\n"
+        "mov %%ax, %%ss\n"
+        "mov %0, %%ax\n"
+        "mov %%ax, %%gs\n"
+        : : "i"(GDT_TLS_SELECTOR) : "eax", "memory");
+}
+
+// Point GS at a thread's TLS block
+void set_tls_base(uint32_t base) {
+    if(base == tls_base) return;
+    
+    gdt[5].base_low = base & 0xFFFF;
+    gdt[5].base_middle = (base >> 16) & 0xFF;
+    gdt[5].base_high = (base >> 24) & 0xFF;
+    tls_base = base;
+    
+    // Reloading the selector refreshes the cached descriptor
+    asm volatile("mov %0, %%gs" : : "r"((uint16_t)GDT_TLS_SELECTOR) : "memory");
+}
@@ -2,6 +2,7 @@
 // Interrupt handling system
 
 #include "../include/kernel.h"
+#include "../include/process.h"
 
 // IDT structure
 typedef struct {
@@ -193,6 +194,12 @@ void set_idt_gate(int n, unsigned int handler) {
 }
 
 void exception_handler(int exception_num) {
+    // Device not available: first FPU use since the last context switch
+    if(exception_num == 7) {
+        fpu_device_not_available();
+        return;
+    }
+    
     print_colored("EXCEPTION: ", VGA_COLOR_RED);
     if(exception_num < 19) {
         print_colored(exception_messages[exception_num], VGA_COLOR_RED);
@@ -208,6 +215,13 @@ void exception_handler(int exception_num) {
 }
 
 void irq_handler(int irq_num) {
+    // Send EOI before handling: the timer may switch to another thread
+    // and not return here until that thread is preempted
+    if(irq_num >= 8) {
+        outb(0xA0, 0x20); // Send EOI to slave PIC
+    }
+    outb(0x20, 0x20); // Send EOI to master PIC
+    
     switch(irq_num) {
         case 0:
             timer_handler();
@@ -222,21 +236,23 @@ void irq_handler(int irq_num) {
             // Unhandled IRQ
             break;
     }
-    
-    // Send EOI to PIC
-    if(irq_num >= 8) {
-        outb(0xA0, 0x20); // Send EOI to slave PIC
-    }
-    outb(0x20, 0x20); // Send EOI to master PIC
 }
 
 static unsigned int timer_ticks = 0;
 
 void timer_handler(void) {
     timer_ticks++;
+    timer_callback();
     
-    // Call scheduler every 10ms (100 Hz)
-    if(timer_ticks % 10 == 0) {
+    // Hand expired delayed work to the worker pool
+    workqueue_tick(get_timer_ticks());
+    
+    // Wake threads whose timed waits expired
+    timeout_tick(get_timer_ticks());
+    
+    // Call scheduler every 10ms (100 Hz), or sooner if a
+    // higher priority thread was woken
+    if(timer_ticks % 10 == 0 || need_resched()) {
         schedule_processes();
     }
 }
@@ -297,6 +313,11 @@ char getchar(void) {
     return c;
 }
 
+// Number of buffered keys, lets callers poll without blocking in getchar()
+int keyboard_pending(void) {
+    return key_buffer_pos;
+}
+
 void handle_interrupts(void) {
     // This function is called from the main kernel loop
     // It can handle any deferred interrupt processing
@@ -95,19 +95,19 @@ isr_common_stub:
     mov ax, ds               ; Lower 16-bits of eax = ds
     push eax                 ; Save data segment descriptor
     
-    mov ax, 0x10             ; Load kernel data segment descriptor
+    mov ax, 0x10             ; Load kernel data segment (GS keeps the TLS segment)
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
     
+    push dword [esp + 36]    ; Interrupt number pushed by the ISR macro
     call exception_handler   ; Call C exception handler
+    add esp, 4
     
     pop eax                  ; Reload original data segment descriptor
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
     
     popa                     ; Pop all general purpose registers
     add esp, 8               ; Clean up pushed error code and ISR number
@@ -121,19 +121,21 @@ irq_common_stub:
     mov ax, ds               ; Lower 16-bits of eax = ds
     push eax                 ; Save data segment descriptor
     
-    mov ax, 0x10             ; Load kernel data segment descriptor
+    mov ax, 0x10             ; Load kernel data segment (GS keeps the TLS segment)
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
     
+    mov eax, [esp + 36]      ; Vector pushed by the IRQ macro
+    sub eax, 32              ; IRQ line number
+    push eax
     call irq_handler         ; Call C IRQ handler
+    add esp, 4
     
     pop eax                  ; Reload original data segment descriptor
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
     
     popa                     ; Pop all general purpose registers
     add esp, 8               ; Clean up pushed error code and IRQ number
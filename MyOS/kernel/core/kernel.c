@@ -3,13 +3,9 @@
 
 #include "../include/kernel.h"
 #include "../include/memory.h"
+#include "../include/process.h"
 #include "../include/graphics.h"
 
-// VGA text buffer
-#define VGA_MEMORY 0xB8000
-#define VGA_WIDTH 80
-#define VGA_HEIGHT 25
-
 // Colors
 #define VGA_COLOR_BLACK 0
 #define VGA_COLOR_BLUE 1
@@ -17,14 +13,11 @@
 #define VGA_COLOR_RED 4
 #define VGA_COLOR_WHITE 15
 
-static int cursor_x = 0;
-static int cursor_y = 0;
-static char* vga_buffer = (char*)VGA_MEMORY;
-
 // Function prototypes
 void kernel_main(void);
 void init_kernel(void);
 void init_memory(void);
+void init_processes(void);
 void init_interrupts(void);
 void init_drivers(void);
 void init_filesystem(void);
@@ -43,6 +36,7 @@ void kernel_main(void) {
     
     init_kernel();
     init_memory();
+    init_processes();
     init_interrupts();
     init_drivers();
     init_filesystem();
@@ -73,6 +67,12 @@ void init_kernel(void) {
     // Set up system tables
     // Initialize critical sections
     
+    // Our own GDT, with user segments and a TLS segment for GS
+    init_gdt();
+    
+    // Enable the FPU and SSE, their state is switched lazily
+    init_fpu();
+    
     print_colored("OK\n", VGA_COLOR_GREEN);
 }
 
@@ -91,6 +91,18 @@ void init_memory(void) {
     print_colored("OK\n", VGA_COLOR_GREEN);
 }
 
+void init_processes(void) {
+    print("Starting process manager... ");
+    
+    // Turn the boot context into the kernel thread
+    init_scheduler();
+    
+    // Start kernel worker threads for deferred work
+    init_workqueues();
+    
+    print_colored("OK\n", VGA_COLOR_GREEN);
+}
+
 void init_interrupts(void) {
     print("Setting up interrupt handlers... ");
     
@@ -121,6 +133,9 @@ void init_drivers(void) {
     // Initialize disk driver
     init_disk();
     
+    // Cache disk blocks in memory
+    init_buffer_cache();
+    
     print_colored("OK\n", VGA_COLOR_GREEN);
 }
 
@@ -154,68 +169,6 @@ void init_gui(void) {
     print_colored("OK\n", VGA_COLOR_GREEN);
 }
 
-void print(const char* str) {
-    print_colored(str, VGA_COLOR_WHITE);
-}
-
-void print_colored(const char* str, int color) {
-    while(*str) {
-        if(*str == '\n') {
-            cursor_x = 0;
-            cursor_y++;
-        } else {
-            int index = (cursor_y * VGA_WIDTH + cursor_x) * 2;
-            vga_buffer[index] = *str;
-            vga_buffer[index + 1] = color;
-            cursor_x++;
-        }
-        
-        if(cursor_x >= VGA_WIDTH) {
-            cursor_x = 0;
-            cursor_y++;
-        }
-        
-        if(cursor_y >= VGA_HEIGHT) {
-            // Scroll screen up
-            for(int i = 0; i < (VGA_HEIGHT - 1) * VGA_WIDTH * 2; i++) {
-                vga_buffer[i] = vga_buffer[i + VGA_WIDTH * 2];
-            }
-            
-            // Clear last line
-            for(int i = (VGA_HEIGHT - 1) * VGA_WIDTH * 2; i < VGA_HEIGHT * VGA_WIDTH * 2; i += 2) {
-                vga_buffer[i] = ' ';
-                vga_buffer[i + 1] = VGA_COLOR_WHITE;
-            }
-            
-            cursor_y = VGA_HEIGHT - 1;
-        }
-        
-        str++;
-    }
-    
-    update_cursor();
-}
-
-void clear_screen(void) {
-    for(int i = 0; i < VGA_WIDTH * VGA_HEIGHT * 2; i += 2) {
-        vga_buffer[i] = ' ';
-        vga_buffer[i + 1] = VGA_COLOR_WHITE;
-    }
-    cursor_x = 0;
-    cursor_y = 0;
-    update_cursor();
-}
-
-void update_cursor(void) {
-    int pos = cursor_y * VGA_WIDTH + cursor_x;
-    
-    // Send cursor position to VGA controller
-    outb(0x3D4, 0x0F);
-    outb(0x3D5, (unsigned char)(pos & 0xFF));
-    outb(0x3D4, 0x0E);
-    outb(0x3D5, (unsigned char)((pos >> 8) & 0xFF));
-}
-
 // Port I/O functions
 void outb(unsigned short port, unsigned char val) {
     asm volatile("outb %0, %1" : : "a"(val), "Nd"(port));
@@ -17,30 +17,112 @@
 #define SYS_SLEEP 8
 #define SYS_MALLOC 9
 #define SYS_FREE 10
+#define SYS_FUTEX 11
+#define SYS_PROCINFO 12
+#define SYS_WAIT 13
+#define SYS_THREAD_CREATE 14
+#define SYS_THREAD_JOIN 15
+#define SYS_THREAD_EXIT 16
+#define SYS_IPC_CALL 17
+#define SYS_IPC_REPLY_WAIT 18
+#define SYS_CHANNEL_CREATE 19
+#define SYS_CHANNEL_OPEN 20
+#define SYS_CHANNEL_CLOSE 21
+#define SYS_PIPE 22
+#define SYS_DUP 23
+#define SYS_DUP2 24
+#define SYS_VMSPLICE 25
+#define SYS_RING_SETUP 26
+#define SYS_RING_ENTER 27
+#define SYS_RING_CLOSE 28
+#define SYS_TRACE 29
+#define SYS_TRACE_READ 30
+#define SYS_SYSSTAT 31
+#define SYS_LSEEK 32
+#define SYS_PREAD 33
+#define SYS_PWRITE 34
+#define SYS_READV 35
+#define SYS_WRITEV 36
+#define SYS_MMAP 37
+#define SYS_MUNMAP 38
+#define SYS_MSYNC 39
+#define SYS_GETDENTS 40
+#define SYS_READABLE 41
 
 // System call table
 typedef int (*syscall_func_t)(int, int, int);
 
 static syscall_func_t syscall_table[] = {
-    sys_exit,     // 0
-    sys_write,    // 1
-    sys_read,     // 2
-    sys_open,     // 3
-    sys_close,    // 4
-    sys_fork,     // 5
-    sys_exec,     // 6
-    sys_getpid,   // 7
-    sys_sleep,    // 8
-    sys_malloc,   // 9
-    sys_free      // 10
+    sys_exit,           // 0
+    sys_write,          // 1
+    sys_read,           // 2
+    sys_open,           // 3
+    sys_close,          // 4
+    sys_fork,           // 5
+    sys_exec,           // 6
+    sys_getpid,         // 7
+    sys_sleep,          // 8
+    sys_malloc,         // 9
+    sys_free,           // 10
+    sys_futex,          // 11
+    sys_procinfo,       // 12
+    sys_wait,           // 13
+    sys_thread_create,  // 14
+    sys_thread_join,    // 15
+    sys_thread_exit,    // 16
+    sys_ipc_call,       // 17
+    sys_ipc_reply_wait, // 18
+    sys_channel_create, // 19
+    sys_channel_open,   // 20
+    sys_channel_close,  // 21
+    sys_pipe,           // 22
+    sys_dup,            // 23
+    sys_dup2,           // 24
+    sys_vmsplice,       // 25
+    sys_ring_setup,     // 26
+    sys_ring_enter,     // 27
+    sys_ring_close,     // 28
+    sys_trace,          // 29
+    sys_trace_read,     // 30
+    sys_sysstat,        // 31
+    sys_lseek,          // 32
+    sys_pread,          // 33
+    sys_pwrite,         // 34
+    sys_readv,          // 35
+    sys_writev,         // 36
+    sys_mmap,           // 37
+    sys_munmap,         // 38
+    sys_msync,          // 39
+    sys_getdents,       // 40
+    sys_readable        // 41
 };
 
 #define NUM_SYSCALLS (sizeof(syscall_table) / sizeof(syscall_func_t))
 
+static const char* syscall_names[] = {
+    "exit", "write", "read", "open", "close", "fork", "exec", "getpid",
+    "sleep", "malloc", "free", "futex", "procinfo", "wait", "thread_create",
+    "thread_join", "thread_exit", "ipc_call", "ipc_reply_wait",
+    "channel_create", "channel_open", "channel_close", "pipe", "dup", "dup2",
+    "vmsplice", "ring_setup", "ring_enter", "ring_close", "trace",
+    "trace_read", "sysstat", "lseek", "pread", "pwrite", "readv", "writev",
+    "mmap", "munmap", "msync", "getdents", "readable"
+};
+
+const char* syscall_name(int num) {
+    if(num < 0 || num >= (int)(sizeof(syscall_names) / sizeof(syscall_names[0]))) return "unknown";
+    return syscall_names[num];
+}
+
 // System call handler
 int syscall_handler(int num, int arg1, int arg2, int arg3) {
     if(num >= 0 && num < NUM_SYSCALLS) {
-        return syscall_table[num](arg1, arg2, arg3);
+        account_syscall_enter();
+        uint64_t start = rdtsc();
+        int ret = syscall_table[num](arg1, arg2, arg3);
+        syscall_trace_exit(num, arg1, arg2, arg3, ret, start);
+        account_syscall_exit();
+        return ret;
     }
     return -1; // Invalid system call
 }
@@ -48,6 +130,9 @@ int syscall_handler(int num, int arg1, int arg2, int arg3) {
 void init_syscalls(void) {
     // Set up system call interrupt (interrupt 0x80)
     set_idt_gate(0x80, (unsigned int)syscall_interrupt);
+    
+    // Faster entry for ring 3 callers where the CPU has it
+    init_sysenter();
     print("System calls initialized\n");
 }
 
@@ -57,51 +142,37 @@ int sys_exit(int status, int unused1, int unused2) {
     // Terminate current process
     Process* current = get_current_process();
     if(current) {
+        current->exit_status = status;
         destroy_process(current->pid);
     }
     return 0;
 }
 
 int sys_write(int fd, int buffer, int size) {
-    char* buf = (char*)buffer;
-    
-    if(fd == 1 || fd == 2) { // stdout or stderr
-        for(int i = 0; i < size; i++) {
-            char str[2] = {buf[i], '\0'};
-            print(str);
-        }
-        return size;
-    }
-    
-    // File writing would go here
-    return -1;
+    File* file = fd_get(fd);
+    if(!file || size < 0) return -1;
+    return file_write(file, (const void*)buffer, size);
 }
 
 int sys_read(int fd, int buffer, int size) {
-    char* buf = (char*)buffer;
-    
-    if(fd == 0) { // stdin
-        for(int i = 0; i < size; i++) {
-            buf[i] = getchar();
-            if(buf[i] == '\n') {
-                return i + 1;
-            }
-        }
-        return size;
-    }
-    
-    // File reading would go here
-    return -1;
+    File* file = fd_get(fd);
+    if(!file || size < 0) return -1;
+    return file_read(file, (void*)buffer, size);
 }
 
 int sys_open(int filename, int flags, int mode) {
-    // File opening implementation
-    return -1; // Not implemented yet
+    File* file = file_open((const char*)filename, flags);
+    if(!file) return -1;
+    
+    int fd = fd_install(file);
+    if(fd < 0) {
+        file_put(file);
+    }
+    return fd;
 }
 
 int sys_close(int fd, int unused1, int unused2) {
-    // File closing implementation
-    return -1; // Not implemented yet
+    return fd_close(fd);
 }
 
 int sys_fork(int unused1, int unused2, int unused3) {
@@ -125,16 +196,224 @@ int sys_sleep(int milliseconds, int unused1, int unused2) {
 }
 
 int sys_malloc(int size, int unused1, int unused2) {
-    return (int)kmalloc(size);
+    void* ptr = kmalloc(size);
+    account_alloc(ptr, 1);
+    return (int)ptr;
 }
 
 int sys_free(int ptr, int unused1, int unused2) {
+    account_alloc((void*)ptr, 0);
     kfree((void*)ptr);
     return 0;
 }
 
+int sys_futex(int uaddr, int op, int val) {
+    switch(op) {
+        case FUTEX_WAIT:
+            return futex_wait((volatile int*)uaddr, val);
+        case FUTEX_WAKE:
+            return futex_wake((volatile int*)uaddr, val);
+        default:
+            return -1;
+    }
+}
+
+// Fill a ProcInfo array, returns the number of processes
+int sys_procinfo(int buffer, int max, int unused) {
+    if(!buffer || max <= 0) return -1;
+    return get_process_info((ProcInfo*)buffer, max);
+}
+
+int sys_wait(int pid, int status, int unused) {
+    return wait_process(pid, (int*)status);
+}
+
+// Start entry(arg) as a new thread of the caller, returns its tid
+int sys_thread_create(int entry, int arg, int tls_base) {
+    Process* current = get_current_process();
+    if(!current || !entry) return -1;
+    
+    Thread* thread = create_user_thread(current, (void (*)(void*))entry, (void*)arg, tls_base);
+    return thread ? (int)thread->tid : -1;
+}
+
+int sys_thread_join(int tid, int result, int unused) {
+    return join_thread(tid, (void**)result);
+}
+
+int sys_thread_exit(int value, int unused1, int unused2) {
+    get_current_thread()->exit_value = (void*)value;
+    thread_exit();
+    return 0; // Not reached
+}
+
+int sys_ipc_call(int dest_pid, int msg, int unused) {
+    if(!msg) return -1;
+    return ipc_call(dest_pid, (IpcMsg*)msg);
+}
+
+int sys_ipc_reply_wait(int msg, int unused1, int unused2) {
+    if(!msg) return -1;
+    return ipc_reply_wait((IpcMsg*)msg);
+}
+
+// Both return the address the channel is mapped at
+int sys_channel_create(int slot_size, int nr_slots, int unused) {
+    if(slot_size <= 0 || nr_slots <= 0) return -1;
+    IpcChannel* channel = channel_create(slot_size, nr_slots);
+    return channel ? (int)channel : -1;
+}
+
+int sys_channel_open(int id, int unused1, int unused2) {
+    IpcChannel* channel = channel_open(id);
+    return channel ? (int)channel : -1;
+}
+
+int sys_channel_close(int channel, int unused1, int unused2) {
+    return channel_close((IpcChannel*)channel);
+}
+
+// fds[0] gets the read end, fds[1] the write end
+int sys_pipe(int fds, int unused1, int unused2) {
+    int* out = (int*)fds;
+    File* reader;
+    File* writer;
+    
+    if(!out || pipe_create(&reader, &writer) != 0) return -1;
+    
+    out[0] = fd_install(reader);
+    if(out[0] < 0) {
+        file_put(reader);
+        file_put(writer);
+        return -1;
+    }
+    out[1] = fd_install(writer);
+    if(out[1] < 0) {
+        fd_close(out[0]);
+        file_put(writer);
+        return -1;
+    }
+    return 0;
+}
+
+int sys_dup(int fd, int unused1, int unused2) {
+    return fd_dup(fd);
+}
+
+int sys_dup2(int fd, int newfd, int unused) {
+    return fd_dup2(fd, newfd);
+}
+
+// Hand whole pages to a pipe instead of copying them
+int sys_vmsplice(int fd, int buffer, int length) {
+    File* file = fd_get(fd);
+    if(!file || file->type != FILE_PIPE_WRITE) return -1;
+    return pipe_gift(file->pipe, (void*)buffer, length);
+}
+
+// Returns the address the ring is mapped at, its id is in the header
+int sys_ring_setup(int entries, int unused1, int unused2) {
+    if(entries <= 0) return -1;
+    IoRing* ring = ioring_setup(entries);
+    return ring ? (int)ring : -1;
+}
+
+int sys_ring_enter(int id, int to_submit, int min_complete) {
+    if(to_submit < 0 || min_complete < 0) return -1;
+    return ioring_enter(id, to_submit, min_complete);
+}
+
+int sys_ring_close(int id, int unused1, int unused2) {
+    return ioring_close(id);
+}
+
+// Follow pid's system calls, 0 stops
+int sys_trace(int pid, int unused1, int unused2) {
+    return syscall_trace_follow(pid);
+}
+
+// cursors holds one position per CPU, advanced past the records returned
+int sys_trace_read(int buffer, int max, int cursors) {
+    if(!buffer || max <= 0 || !cursors) return -1;
+    return syscall_trace_read((TraceRecord*)buffer, max, (uint32_t*)cursors);
+}
+
+int sys_sysstat(int buffer, int max, int unused) {
+    if(!buffer || max <= 0) return -1;
+    return syscall_get_stats((SyscallStat*)buffer, max);
+}
+
+int sys_lseek(int fd, int offset, int whence) {
+    File* file = fd_get(fd);
+    if(!file) return -1;
+    return file_lseek(file, offset, whence);
+}
+
+// Positioned transfers take one iovec, there is no room for a fourth argument
+int sys_pread(int fd, int iov, int offset) {
+    File* file = fd_get(fd);
+    struct iovec* vec = (struct iovec*)iov;
+    if(!file || !vec || offset < 0) return -1;
+    return file_pread(file, vec->iov_base, vec->iov_len, offset);
+}
+
+int sys_pwrite(int fd, int iov, int offset) {
+    File* file = fd_get(fd);
+    struct iovec* vec = (struct iovec*)iov;
+    if(!file || !vec || offset < 0) return -1;
+    return file_pwrite(file, vec->iov_base, vec->iov_len, offset);
+}
+
+int sys_readv(int fd, int iov, int iovcnt) {
+    File* file = fd_get(fd);
+    if(!file || !iov) return -1;
+    return file_readv(file, (const struct iovec*)iov, iovcnt);
+}
+
+int sys_writev(int fd, int iov, int iovcnt) {
+    File* file = fd_get(fd);
+    if(!file || !iov) return -1;
+    return file_writev(file, (const struct iovec*)iov, iovcnt);
+}
+
+// Six arguments do not fit in registers, they come in a struct mmap_args
+int sys_mmap(int args, int unused1, int unused2) {
+    struct mmap_args* a = (struct mmap_args*)args;
+    if(!a) return (int)MAP_FAILED;
+    return (int)do_mmap(a->addr, a->length, a->prot, a->flags, a->fd, a->offset);
+}
+
+int sys_munmap(int addr, int length, int unused) {
+    return do_munmap((void*)addr, length);
+}
+
+int sys_msync(int addr, int length, int flags) {
+    return do_msync((void*)addr, length, flags);
+}
+
+int sys_getdents(int fd, int buffer, int size) {
+    File* file = fd_get(fd);
+    if(!file || !buffer || size <= 0) return -1;
+    return file_getdents(file, (void*)buffer, size);
+}
+
+// 1 if a read() on fd would not block, so input can be polled
+int sys_readable(int fd, int unused1, int unused2) {
+    File* file = fd_get(fd);
+    if(!file) return -1;
+    return file_readable(file);
+}
+
 // User space system call interface
-int syscall(int num, int arg1, int arg2, int arg3) {
+#define SYSCALL_PATH_UNKNOWN 0
+#define SYSCALL_PATH_INT80 1
+#define SYSCALL_PATH_SYSENTER 2
+#define SYSCALL_PATH_DIRECT 3
+
+static int syscall_path = SYSCALL_PATH_UNKNOWN;
+
+// Trap through the interrupt gate, works everywhere
+int syscall_int80(int num, int arg1, int arg2, int arg3) {
     int result;
     asm volatile("int $0x80" 
                  : "=a"(result) 
@@ -143,25 +422,240 @@ int syscall(int num, int arg1, int arg2, int arg3) {
     return result;
 }
 
+// SYSENTER from ring 3, sysenter_entry() returns to the label with our esp
+int syscall_sysenter(int num, int arg1, int arg2, int arg3) {
+    int result;
+    asm volatile("mov %%esp, %%ecx\n"
+                 "mov $1f, %%edx\n"
+                 "sysenter\n"
+                 "1:"
+                 : "=a"(result)
+                 : "a"(num), "b"(arg1), "S"(arg2), "D"(arg3)
+                 : "ecx", "edx", "memory");
+    return result;
+}
+
+static int select_syscall_path(void) {
+    uint16_t cs;
+    asm volatile("mov %%cs, %0" : "=r"(cs));
+    
+    // SYSEXIT always drops to ring 3, callers already in ring 0 have no
+    // privilege change to make and call the handler the way the stubs do
+    if((cs & 3) == 0) return SYSCALL_PATH_DIRECT;
+    return sysenter_supported() ? SYSCALL_PATH_SYSENTER : SYSCALL_PATH_INT80;
+}
+
+const char* syscall_path_name(void) {
+    if(syscall_path == SYSCALL_PATH_UNKNOWN) {
+        syscall_path = select_syscall_path();
+    }
+    switch(syscall_path) {
+        case SYSCALL_PATH_SYSENTER: return "sysenter";
+        case SYSCALL_PATH_DIRECT: return "direct";
+        default: return "int 0x80";
+    }
+}
+
+int syscall(int num, int arg1, int arg2, int arg3) {
+    switch(syscall_path) {
+        case SYSCALL_PATH_DIRECT:
+            return syscall_handler(num, arg1, arg2, arg3);
+        case SYSCALL_PATH_SYSENTER:
+            return syscall_sysenter(num, arg1, arg2, arg3);
+        case SYSCALL_PATH_INT80:
+            return syscall_int80(num, arg1, arg2, arg3);
+        default:
+            syscall_path = select_syscall_path();
+            return syscall(num, arg1, arg2, arg3);
+    }
+}
+
 // kernel/process/scheduler.c
 // Process scheduler implementation
 
 #include "../include/kernel.h"
 #include "../include/process.h"
 #include "../include/memory.h"
+#include "../include/filesystem.h"
+
+#define PID_HASH_SIZE 64
 
 static Process* process_list = NULL;
-static Process* current_process = NULL;
-static int next_pid = 1;
+static Process* kernel_process = NULL; // Adopts orphans
+static Process* pid_hash[PID_HASH_SIZE];
+static uint32_t pid_bitmap[MAX_PROCESSES / 32] = {1}; // pid 0 is never used
+static uint32_t last_pid = 0;
+static Thread* current_thread = NULL;
+static WaitQueue ready_queues[NR_PRIORITIES];
+static uint32_t ready_bitmap = 0; // Bit n set if ready_queues[n] is non-empty
+static Thread* timeout_list = NULL; // Sorted by wake_tick
+static int in_scheduler = 0;
+static int resched_pending = 0;
+
+static void reap_process(Work* work);
+static void account_thread(Thread* thread, uint64_t now);
+static void switch_threads(Thread* prev, Thread* next, int voluntary);
+
+// Thread queue helpers (interrupts must be disabled)
+static void queue_append(WaitQueue* queue, Thread* thread) {
+    thread->run_next = NULL;
+    if(queue->tail) {
+        queue->tail->run_next = thread;
+    } else {
+        queue->head = thread;
+    }
+    queue->tail = thread;
+}
+
+static Thread* queue_pop(WaitQueue* queue) {
+    Thread* thread = queue->head;
+    if(thread) {
+        queue->head = thread->run_next;
+        if(!queue->head) {
+            queue->tail = NULL;
+        }
+        thread->run_next = NULL;
+    }
+    return thread;
+}
+
+static void queue_remove(WaitQueue* queue, Thread* thread) {
+    Thread* current = queue->head;
+    Thread* prev = NULL;
+    
+    while(current) {
+        if(current == thread) {
+            if(prev) {
+                prev->run_next = current->run_next;
+            } else {
+                queue->head = current->run_next;
+            }
+            if(queue->tail == current) {
+                queue->tail = prev;
+            }
+            current->run_next = NULL;
+            return;
+        }
+        prev = current;
+        current = current->run_next;
+    }
+}
+
+// Ready queue helpers, one FIFO per priority level
+static void ready_enqueue(Thread* thread) {
+    queue_append(&ready_queues[thread->priority], thread);
+    ready_bitmap |= 1u << thread->priority;
+}
+
+// Lowest free pid after the last one handed out, so pids are not reused at once
+static int alloc_pid(void) {
+    uint32_t start = (last_pid + 1) % MAX_PROCESSES;
+    
+    // One extra word so the bits below start in the first word are seen too
+    for(uint32_t n = 0; n <= MAX_PROCESSES / 32; n++) {
+        uint32_t word = (start / 32 + n) % (MAX_PROCESSES / 32);
+        uint32_t free_bits = ~pid_bitmap[word];
+        if(n == 0) {
+            free_bits &= ~0u << (start % 32);
+        }
+        
+        if(free_bits) {
+            uint32_t pid = word * 32 + __builtin_ctz(free_bits);
+            pid_bitmap[word] |= 1u << (pid % 32);
+            last_pid = pid;
+            return pid;
+        }
+    }
+    return -1;
+}
+
+static void free_pid(uint32_t pid) {
+    pid_bitmap[pid / 32] &= ~(1u << (pid % 32));
+}
+
+// Parent/child links (interrupts must be disabled)
+static void link_child(Process* parent, Process* child) {
+    child->parent = parent;
+    child->sibling_prev = NULL;
+    child->sibling_next = parent->children;
+    if(parent->children) {
+        parent->children->sibling_prev = child;
+    }
+    parent->children = child;
+}
+
+static void unlink_child(Process* child) {
+    if(!child->parent) return;
+    
+    if(child->sibling_prev) {
+        child->sibling_prev->sibling_next = child->sibling_next;
+    } else {
+        child->parent->children = child->sibling_next;
+    }
+    if(child->sibling_next) {
+        child->sibling_next->sibling_prev = child->sibling_prev;
+    }
+    child->parent = NULL;
+    child->sibling_next = NULL;
+    child->sibling_prev = NULL;
+}
+
+// Drop every reference to a dead process and free it (interrupts disabled)
+static void release_process(Process* proc) {
+    if(proc->prev) {
+        proc->prev->next = proc->next;
+    } else {
+        process_list = proc->next;
+    }
+    if(proc->next) {
+        proc->next->prev = proc->prev;
+    }
+    
+    Process** link = &pid_hash[proc->pid % PID_HASH_SIZE];
+    while(*link != proc) {
+        link = &(*link)->hash_next;
+    }
+    *link = proc->hash_next;
+    
+    unlink_child(proc);
+    free_pid(proc->pid);
+    kfree(proc);
+}
+
+static Thread* ready_dequeue(void) {
+    if(!ready_bitmap) return NULL;
+    
+    uint32_t priority = 31 - __builtin_clz(ready_bitmap);
+    Thread* thread = queue_pop(&ready_queues[priority]);
+    if(!ready_queues[priority].head) {
+        ready_bitmap &= ~(1u << priority);
+    }
+    return thread;
+}
+
+static void ready_remove(Thread* thread) {
+    queue_remove(&ready_queues[thread->priority], thread);
+    if(!ready_queues[thread->priority].head) {
+        ready_bitmap &= ~(1u << thread->priority);
+    }
+}
 
 void init_scheduler(void) {
     process_list = NULL;
-    current_process = NULL;
+    current_thread = NULL;
+    ready_bitmap = 0;
+    for(int i = 0; i < NR_PRIORITIES; i++) {
+        wait_queue_init(&ready_queues[i]);
+    }
     
-    // Create kernel process
-    Process* kernel_proc = create_process("kernel", NULL);
-    kernel_proc->state = PROC_RUNNING;
-    current_process = kernel_proc;
+    // Create kernel process, first pid handed out is KERNEL_PID
+    kernel_process = create_process("kernel", NULL);
+    kernel_process->state = PROC_RUNNING;
+    kernel_process->flags |= PROC_FLAG_KERNEL;
+    
+    // The boot context becomes the kernel's first thread
+    current_thread = create_thread(kernel_process, NULL);
+    current_thread->state = PROC_RUNNING;
     
     print("Process scheduler initialized\n");
 }
@@ -170,64 +664,423 @@ Process* create_process(const char* name, void* entry_point) {
     Process* proc = (Process*)kmalloc(sizeof(Process));
     if(!proc) return NULL;
     
-    proc->pid = next_pid++;
+    uint32_t flags = irq_save();
+    int pid = alloc_pid();
+    irq_restore(flags);
+    if(pid < 0) {
+        kfree(proc);
+        return NULL; // Process table full
+    }
+    
+    proc->pid = pid;
     proc->state = PROC_READY;
     proc->esp = 0;
     proc->ebp = 0;
     proc->page_directory = 0; // Would set up page directory
-    proc->next = process_list;
+    proc->flags = 0;
+    proc->threads = NULL;
+    proc->nr_threads = 0;
+    init_work(&proc->reap_work, reap_process, proc);
+    proc->user_cycles = 0;
+    proc->sys_cycles = 0;
+    proc->start_tsc = rdtsc();
+    proc->nvcsw = 0;
+    proc->nivcsw = 0;
+    proc->rss_bytes = 0;
+    proc->mmaps = NULL;
+    proc->channels = 0;
+    proc->parent = NULL;
+    proc->children = NULL;
+    proc->sibling_next = NULL;
+    proc->sibling_prev = NULL;
+    wait_queue_init(&proc->child_exit);
+    proc->exit_status = 0;
+    mailbox_init(&proc->mailbox);
+    wait_queue_init(&proc->ipc_callers);
+    wait_queue_init(&proc->ipc_servers);
+    files_init(proc, current_thread ? current_thread->process : NULL);
     strcpy(proc->name, name);
     
+    flags = irq_save();
+    proc->prev = NULL;
+    proc->next = process_list;
+    if(process_list) {
+        process_list->prev = proc;
+    }
     process_list = proc;
     
+    proc->hash_next = pid_hash[pid % PID_HASH_SIZE];
+    pid_hash[pid % PID_HASH_SIZE] = proc;
+    
+    if(current_thread) {
+        link_child(current_thread->process, proc);
+    }
+    irq_restore(flags);
+    
+    return proc;
+}
+
+Process* find_process(uint32_t pid) {
+    uint32_t flags = irq_save();
+    Process* proc = pid_hash[pid % PID_HASH_SIZE];
+    while(proc && proc->pid != pid) {
+        proc = proc->hash_next;
+    }
+    irq_restore(flags);
     return proc;
 }
 
+void reparent_process(Process* proc, Process* parent) {
+    uint32_t flags = irq_save();
+    unlink_child(proc);
+    link_child(parent, proc);
+    irq_restore(flags);
+}
+
 void destroy_process(uint32_t pid) {
-    Process* current = process_list;
-    Process* prev = NULL;
+    uint32_t flags = irq_save();
+    Process* proc = find_process(pid);
     
-    while(current) {
-        if(current->pid == pid) {
-            if(prev) {
-                prev->next = current->next;
-            } else {
-                process_list = current->next;
+    if(!proc || proc->state == PROC_TERMINATED || proc->state == PROC_ZOMBIE) {
+        irq_restore(flags);
+        return;
+    }
+    
+    // Stop its threads now, free their stacks and memory later
+    proc->state = PROC_TERMINATED;
+    for(Thread* thread = proc->threads; thread; thread = thread->proc_next) {
+        unlink_thread(thread);
+        ipc_detach(thread);
+        thread->state = PROC_TERMINATED;
+    }
+    
+    // Orphans go to the kernel process, which never waits and reaps them itself
+    while(proc->children) {
+        Process* child = proc->children;
+        if(child->state == PROC_ZOMBIE) {
+            release_process(child);
+        } else {
+            unlink_child(child);
+            link_child(kernel_process, child);
+        }
+    }
+    
+    // Senders blocked on a full mailbox find us gone when they retry
+    mailbox_close(&proc->mailbox);
+    ipc_close(proc);
+    ioring_release(proc);
+    channel_release(proc);
+    
+    // Close its files now so pipe readers see EOF without waiting for the reaper
+    files_release(proc);
+    queue_work(&proc->reap_work);
+    
+    if(current_thread->process == proc) {
+        schedule(); // Does not return
+    }
+    irq_restore(flags);
+}
+
+// Runs on a kernel worker once none of the process's threads can be running
+static void reap_process(Work* work) {
+    Process* proc = (Process*)work->data;
+    
+    while(proc->threads) {
+        free_thread(proc->threads);
+    }
+    mmap_release(proc);
+    mailbox_flush(&proc->mailbox);
+    
+    uint32_t flags = irq_save();
+    Process* parent = proc->parent;
+    
+    if(!parent || parent == kernel_process) {
+        release_process(proc);
+    } else {
+        // Move to the front so wait_process() finds it without scanning
+        proc->state = PROC_ZOMBIE;
+        unlink_child(proc);
+        link_child(parent, proc);
+        wake_up_all(&parent->child_exit);
+    }
+    
+    irq_restore(flags);
+}
+
+// Wait for a child to exit (pid -1 for any), returns its pid or -1
+int wait_process(int pid, int* status) {
+    Process* self = get_current_process();
+    uint32_t flags = irq_save();
+    
+    while(1) {
+        Process* child;
+        if(pid > 0) {
+            child = find_process(pid);
+            if(!child || child->parent != self) break;
+        } else {
+            child = self->children;
+            if(!child) break;
+        }
+        
+        if(child->state == PROC_ZOMBIE) {
+            int reaped = child->pid;
+            if(status) {
+                *status = child->exit_status;
             }
-            
-            // Free process memory
-            kfree(current);
-            return;
+            release_process(child);
+            irq_restore(flags);
+            return reaped;
         }
-        prev = current;
-        current = current->next;
+        
+        sleep_on(&self->child_exit);
     }
+    
+    irq_restore(flags);
+    return -1;
 }
 
 void schedule(void) {
-    if(!current_process || !process_list) return;
+    uint32_t flags = irq_save();
+    
+    // The timer may fire while we idle below
+    if(in_scheduler || !current_thread) {
+        irq_restore(flags);
+        return;
+    }
+    in_scheduler = 1;
+    resched_pending = 0;
+    
+    Thread* prev = current_thread;
+    account_thread(prev, rdtsc());
+    
+    // Still runnable means it was preempted or yielded
+    int voluntary = prev->state != PROC_RUNNING;
+    if(prev->state == PROC_RUNNING) {
+        prev->state = PROC_READY;
+        ready_enqueue(prev);
+    }
+    
+    // Highest priority first, round-robin within a level
+    Thread* next = ready_dequeue();
+    while(!next) {
+        // Nothing runnable, wait for an interrupt to wake someone
+        asm volatile("sti; hlt; cli");
+        next = ready_dequeue();
+    }
+    
+    switch_threads(prev, next, voluntary);
+    irq_restore(flags);
+}
+
+// Hand the CPU straight to next without going through the ready queues.
+// next must be runnable but on no queue; the caller has usually blocked itself.
+void switch_to(Thread* next) {
+    uint32_t flags = irq_save();
+    
+    if(in_scheduler || !current_thread) {
+        make_ready(next);
+        irq_restore(flags);
+        return;
+    }
+    in_scheduler = 1;
+    
+    Thread* prev = current_thread;
+    account_thread(prev, rdtsc());
     
-    // Simple round-robin scheduler
-    Process* next = current_process->next;
-    if(!next) next = process_list;
+    int voluntary = prev->state != PROC_RUNNING;
+    if(prev->state == PROC_RUNNING) {
+        prev->state = PROC_READY;
+        ready_enqueue(prev);
+    }
     
-    // Find next ready process
-    while(next && next->state != PROC_READY && next != current_process) {
-        next = next->next;
-        if(!next) next = process_list;
+    switch_threads(prev, next, voluntary);
+    irq_restore(flags);
+}
+
+// Common tail of schedule() and switch_to() (interrupts disabled)
+static void switch_threads(Thread* prev, Thread* next, int voluntary) {
+    if(prev->process->state != PROC_TERMINATED) {
+        prev->process->state = PROC_READY;
     }
+    next->state = PROC_RUNNING;
+    next->process->state = PROC_RUNNING;
+    current_thread = next;
     
-    if(next && next != current_process) {
-        current_process->state = PROC_READY;
-        current_process = next;
-        current_process->state = PROC_RUNNING;
+    if(next != prev) {
+        if(voluntary) {
+            prev->nvcsw++;
+            prev->process->nvcsw++;
+        } else {
+            prev->nivcsw++;
+            prev->process->nivcsw++;
+        }
         
-        // Context switch would happen here
+        // Time spent idling above is not charged to anyone
+        next->mark_tsc = rdtsc();
+        fpu_switch(next);
+        sysenter_set_stack(next);
+        set_tls_base(next->tls_base);
+        switch_context(&prev->esp, next->esp);
+    }
+    
+    finish_context_switch();
+}
+
+// Called on the new thread's stack once the switch is complete
+void finish_context_switch(void) {
+    in_scheduler = 0;
+}
+
+void make_ready(Thread* thread) {
+    thread->state = PROC_READY;
+    ready_enqueue(thread);
+    
+    if(current_thread && thread->priority > current_thread->priority) {
+        resched_pending = 1;
+    }
+}
+
+// Change a thread's effective priority, requeueing it if it is runnable
+void set_thread_priority(Thread* thread, uint32_t priority) {
+    if(thread->priority == priority) return;
+    
+    if(thread->state == PROC_READY) {
+        ready_remove(thread);
+        thread->priority = priority;
+        ready_enqueue(thread);
+        
+        if(priority > current_thread->priority) {
+            resched_pending = 1;
+        }
+    } else {
+        thread->priority = priority;
+    }
+}
+
+// Switch now if a higher priority thread became runnable
+void check_preempt(void) {
+    if(resched_pending) {
+        schedule();
+    }
+}
+
+int need_resched(void) {
+    return resched_pending;
+}
+
+// Cancel a pending timed wake-up, if there is one
+static void timeout_remove(Thread* thread) {
+    if(!thread->on_timeout_list) return;
+    
+    Thread** link = &timeout_list;
+    while(*link != thread) {
+        link = &(*link)->timeout_next;
+    }
+    *link = thread->timeout_next;
+    thread->timeout_next = NULL;
+    thread->on_timeout_list = 0;
+}
+
+// Take a thread off whichever queue it is sitting on
+void unlink_thread(Thread* thread) {
+    timeout_remove(thread);
+    if(thread->state == PROC_READY) {
+        ready_remove(thread);
+    } else if(thread->state == PROC_BLOCKED && thread->waiting_on) {
+        queue_remove(thread->waiting_on, thread);
+        thread->waiting_on = NULL;
+    }
+}
+
+void wait_queue_init(WaitQueue* wq) {
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+
+void sleep_on(WaitQueue* wq) {
+    Thread* self = current_thread;
+    
+    self->state = PROC_BLOCKED;
+    self->waiting_on = wq;
+    queue_append(wq, self);
+    
+    schedule();
+}
+
+// Like sleep_on(), but hand the CPU straight to next
+void sleep_on_switch(WaitQueue* wq, Thread* next) {
+    Thread* self = current_thread;
+    
+    self->state = PROC_BLOCKED;
+    self->waiting_on = wq;
+    queue_append(wq, self);
+    
+    switch_to(next);
+}
+
+// Remove the first sleeper without making it runnable
+Thread* wait_queue_take(WaitQueue* wq) {
+    Thread* thread = queue_pop(wq);
+    if(thread) {
+        thread->waiting_on = NULL;
+    }
+    return thread;
+}
+
+void wake_up(WaitQueue* wq) {
+    Thread* thread = queue_pop(wq);
+    if(thread) {
+        thread->waiting_on = NULL;
+        make_ready(thread);
+    }
+}
+
+void wake_up_all(WaitQueue* wq) {
+    while(wq->head) {
+        wake_up(wq);
+    }
+}
+
+// Like sleep_on(), but gives up after ticks. Returns -1 if it timed out.
+int sleep_on_timeout(WaitQueue* wq, uint32_t ticks) {
+    Thread* self = current_thread;
+    self->wake_tick = get_timer_ticks() + ticks;
+    self->timed_out = 0;
+    
+    Thread** link = &timeout_list;
+    while(*link && (int32_t)((*link)->wake_tick - self->wake_tick) <= 0) {
+        link = &(*link)->timeout_next;
+    }
+    self->timeout_next = *link;
+    *link = self;
+    self->on_timeout_list = 1;
+    
+    sleep_on(wq);
+    
+    timeout_remove(self);
+    return self->timed_out ? -1 : 0;
+}
+
+// Called from the timer interrupt, wakes sleepers whose deadline has passed
+void timeout_tick(uint32_t now) {
+    while(timeout_list && (int32_t)(now - timeout_list->wake_tick) >= 0) {
+        Thread* thread = timeout_list;
+        timeout_remove(thread);
+        
+        if(thread->state == PROC_BLOCKED) {
+            unlink_thread(thread);
+            thread->timed_out = 1;
+            make_ready(thread);
+        }
     }
 }
 
 Process* get_current_process(void) {
-    return current_process;
+    return current_thread ? current_thread->process : NULL;
+}
+
+Thread* get_current_thread(void) {
+    return current_thread;
 }
 
 void yield(void) {
@@ -239,6 +1092,98 @@ void schedule_processes(void) {
     schedule();
 }
 
+// Charge the time since the thread's last mark (interrupts must be disabled).
+// Everything runs in ring 0, so "system" means inside a system call or a
+// kernel thread and "user" is the rest of a user process's time.
+static void account_thread(Thread* thread, uint64_t now) {
+    uint64_t delta = now - thread->mark_tsc;
+    thread->mark_tsc = now;
+    
+    if(thread->in_syscall || (thread->process->flags & PROC_FLAG_KERNEL)) {
+        thread->sys_cycles += delta;
+        thread->process->sys_cycles += delta;
+    } else {
+        thread->user_cycles += delta;
+        thread->process->user_cycles += delta;
+    }
+}
+
+void account_syscall_enter(void) {
+    uint32_t flags = irq_save();
+    if(current_thread) {
+        account_thread(current_thread, rdtsc());
+        current_thread->in_syscall++;
+    }
+    irq_restore(flags);
+}
+
+void account_syscall_exit(void) {
+    uint32_t flags = irq_save();
+    if(current_thread) {
+        account_thread(current_thread, rdtsc());
+        current_thread->in_syscall--;
+    }
+    irq_restore(flags);
+}
+
+// Track heap memory handed out on behalf of the current process
+void account_alloc(void* ptr, int allocated) {
+    if(!ptr || !current_thread) return;
+    
+    uint32_t flags = irq_save();
+    Process* proc = current_thread->process;
+    uint32_t size = ksize(ptr);
+    
+    if(allocated) {
+        proc->rss_bytes += size;
+    } else {
+        // May have been allocated by another process
+        proc->rss_bytes = proc->rss_bytes > size ? proc->rss_bytes - size : 0;
+    }
+    irq_restore(flags);
+}
+
+// Snapshot up to max processes, returns how many were filled in
+int get_process_info(ProcInfo* info, int max) {
+    uint32_t flags = irq_save();
+    int count = 0;
+    
+    // Bring the caller's own time up to date
+    if(current_thread) {
+        account_thread(current_thread, rdtsc());
+    }
+    uint32_t cycles_per_ms = tsc_cycles_per_ms();
+    
+    for(Process* proc = process_list; proc && count < max; proc = proc->next) {
+        ProcInfo* out = &info[count++];
+        out->pid = proc->pid;
+        out->ppid = proc->parent ? proc->parent->pid : 0;
+        out->state = proc->state;
+        out->flags = proc->flags;
+        out->nr_threads = 0;
+        out->priority = 0;
+        for(Thread* thread = proc->threads; thread; thread = thread->proc_next) {
+            out->nr_threads++;
+            if(thread->priority > out->priority) {
+                out->priority = thread->priority;
+            }
+        }
+        out->user_cycles = proc->user_cycles;
+        out->sys_cycles = proc->sys_cycles;
+        out->start_tsc = proc->start_tsc;
+        out->user_ms = cycles_per_ms ? (uint32_t)(proc->user_cycles / cycles_per_ms) : 0;
+        out->sys_ms = cycles_per_ms ? (uint32_t)(proc->sys_cycles / cycles_per_ms) : 0;
+        out->nvcsw = proc->nvcsw;
+        out->nivcsw = proc->nivcsw;
+        out->rss_bytes = proc->rss_bytes;
+        strncpy(out->name, proc->name, sizeof(out->name) - 1);
+        out->name[sizeof(out->name) - 1] = '\0';
+    }
+    
+    irq_restore(flags);
+    return count;
+}
+
 // kernel/process/thread.c
 // Thread management
 
@@ -248,7 +1193,27 @@ void schedule_processes(void) {
 static Thread* thread_list = NULL;
 static int next_tid = 1;
 
-Thread* create_thread(Process* proc, void* entry_point) {
+static void thread_start(void);
+
+// Build a frame that switch_context() will "return" into thread_start()
+static int setup_kernel_stack(Thread* thread) {
+    thread->kernel_stack = kmalloc(thread->stack_size);
+    if(!thread->kernel_stack) return -1;
+    
+    uint32_t* sp = (uint32_t*)((char*)thread->kernel_stack + thread->stack_size);
+    *--sp = 0;                       // Return address of thread_start
+    *--sp = (uint32_t)thread_start;  // Return address of switch_context
+    *--sp = 0;                       // ebp
+    *--sp = 0;                       // ebx
+    *--sp = 0;                       // esi
+    *--sp = 0;                       // edi
+    
+    thread->esp = (uint32_t)sp;
+    thread->ebp = 0;
+    return 0;
+}
+
+static Thread* spawn_thread(Process* proc, void (*entry)(void* arg), void* arg, uint32_t stack_size) {
     Thread* thread = (Thread*)kmalloc(sizeof(Thread));
     if(!thread) return NULL;
     
@@ -257,31 +1222,213 @@ Thread* create_thread(Process* proc, void* entry_point) {
     thread->esp = 0;
     thread->ebp = 0;
     thread->process = proc;
-    thread->next = thread_list;
+    thread->run_next = NULL;
+    thread->waiting_on = NULL;
+    thread->kernel_stack = NULL;
+    thread->entry = entry;
+    thread->arg = arg;
+    thread->futex_key = 0;
+    thread->base_priority = DEFAULT_PRIORITY;
+    thread->priority = DEFAULT_PRIORITY;
+    thread->blocked_on = NULL;
+    thread->held_mutexes = NULL;
+    thread->user_cycles = 0;
+    thread->sys_cycles = 0;
+    thread->mark_tsc = rdtsc();
+    thread->nvcsw = 0;
+    thread->nivcsw = 0;
+    thread->in_syscall = 0;
+    thread->fpu_alloc = NULL;
+    thread->fpu_state = NULL;
+    thread->stack_size = stack_size;
+    thread->tls_base = 0;
+    thread->exit_value = NULL;
+    wait_queue_init(&thread->join_wait);
+    thread->joiner = NULL;
+    thread->wake_tick = 0;
+    thread->timeout_next = NULL;
+    thread->on_timeout_list = 0;
+    thread->timed_out = 0;
+    thread->ipc_server = NULL;
+    thread->ipc_caller = NULL;
+    thread->ipc_status = 0;
+    
+    // Threads without an entry point adopt the caller's stack (boot thread)
+    if(entry && setup_kernel_stack(thread) != 0) {
+        kfree(thread);
+        return NULL;
+    }
     
+    uint32_t flags = irq_save();
+    thread->next = thread_list;
     thread_list = thread;
+    thread->proc_next = proc->threads;
+    proc->threads = thread;
+    proc->nr_threads++;
+    if(thread->kernel_stack) {
+        proc->rss_bytes += thread->stack_size;
+    }
+    
+    if(entry) {
+        make_ready(thread);
+    }
+    irq_restore(flags);
     
     return thread;
 }
 
+Thread* create_thread(Process* proc, void* entry_point) {
+    return spawn_thread(proc, (void (*)(void*))entry_point, NULL, KERNEL_STACK_SIZE);
+}
+
+// Another thread in proc's address space, with GS based at tls_base
+Thread* create_user_thread(Process* proc, void (*entry)(void* arg), void* arg, uint32_t tls_base) {
+    if(!entry) return NULL;
+    
+    Thread* thread = spawn_thread(proc, entry, arg, USER_THREAD_STACK_SIZE);
+    if(thread) {
+        thread->tls_base = tls_base; // Not yet switched to, safe to set late
+    }
+    return thread;
+}
+
+Thread* create_kernel_thread(const char* name, void (*entry)(void* arg), void* arg) {
+    Process* proc = create_process(name, NULL);
+    if(!proc) return NULL;
+    
+    proc->flags |= PROC_FLAG_KERNEL;
+    reparent_process(proc, find_process(KERNEL_PID)); // Kernel threads hang off pid 1
+    
+    Thread* thread = spawn_thread(proc, entry, arg, KERNEL_STACK_SIZE);
+    if(!thread) {
+        destroy_process(proc->pid);
+    }
+    return thread;
+}
+
+static void thread_start(void) {
+    finish_context_switch();
+    asm volatile("sti");
+    
+    Thread* self = get_current_thread();
+    self->entry(self->arg);
+    
+    thread_exit();
+}
+
+void thread_exit(void) {
+    Thread* self = get_current_thread();
+    Process* proc = self->process;
+    
+    irq_save();
+    
+    // The last thread out tears down the whole process
+    if(--proc->nr_threads == 0) {
+        destroy_process(proc->pid);
+    }
+    
+    // Stays on the process list until joined or the process is reaped
+    ipc_detach(self);
+    self->state = PROC_TERMINATED;
+    wake_up_all(&self->join_wait);
+    schedule();
+}
+
+// Wait for another thread of this process to exit and collect its result
+int join_thread(uint32_t tid, void** result) {
+    Thread* self = get_current_thread();
+    uint32_t flags = irq_save();
+    
+    Thread* target = self->process->threads;
+    while(target && target->tid != tid) {
+        target = target->proc_next;
+    }
+    if(!target || target == self || target->joiner) {
+        irq_restore(flags);
+        return -1;
+    }
+    
+    target->joiner = self;
+    while(target->state != PROC_TERMINATED) {
+        sleep_on(&target->join_wait);
+    }
+    if(result) {
+        *result = target->exit_value;
+    }
+    irq_restore(flags);
+    
+    // It switched away for good before we could be woken
+    free_thread(target);
+    return 0;
+}
+
+// Unlink a thread that is no longer running and release its stack
+void free_thread(Thread* thread) {
+    uint32_t flags = irq_save();
+    
+    Thread** link = &thread_list;
+    while(*link && *link != thread) {
+        link = &(*link)->next;
+    }
+    if(*link) {
+        *link = thread->next;
+    }
+    
+    link = &thread->process->threads;
+    while(*link && *link != thread) {
+        link = &(*link)->proc_next;
+    }
+    if(*link) {
+        *link = thread->proc_next;
+    }
+    if(thread->kernel_stack) {
+        thread->process->rss_bytes -= thread->stack_size;
+    }
+    
+    irq_restore(flags);
+    
+    fpu_release(thread);
+    if(thread->kernel_stack) {
+        kfree(thread->kernel_stack);
+    }
+    kfree(thread);
+}
+
 void destroy_thread(uint32_t tid) {
+    uint32_t flags = irq_save();
     Thread* current = thread_list;
-    Thread* prev = NULL;
     
     while(current) {
         if(current->tid == tid) {
-            if(prev) {
-                prev->next = current->next;
-            } else {
-                thread_list = current->next;
+            if(current == get_current_thread()) {
+                thread_exit(); // Does not return
+            }
+            if(current->state != PROC_TERMINATED) {
+                unlink_thread(current);
+                ipc_detach(current);
+                current->state = PROC_TERMINATED;
+                if(--current->process->nr_threads == 0) {
+                    destroy_process(current->process->pid);
+                    irq_restore(flags);
+                    return; // Freed when the process is reaped
+                }
             }
             
-            kfree(current);
+            // A joiner frees it once it has collected the result
+            if(current->joiner) {
+                wake_up_all(&current->join_wait);
+                irq_restore(flags);
+                return;
+            }
+            irq_restore(flags);
+            
+            free_thread(current);
             return;
         }
-        prev = current;
         current = current->next;
     }
+    
+    irq_restore(flags);
 }
 
 // kernel/process/ipc.c
@@ -289,72 +1436,315 @@ void destroy_thread(uint32_t tid) {
 
 #include "../include/kernel.h"
 #include "../include/process.h"
+#include "../include/memory.h"
+
+#define MSG_GRANT 0x01  // data is the sender's pages, remapped rather than copied
 
 typedef struct message {
     uint32_t sender_pid;
-    uint32_t receiver_pid;
     uint32_t type;
     uint32_t length;
+    uint32_t flags;
     void* data;
-    struct message* next;
 } Message;
 
-static Message* message_queue = NULL;
+static uint32_t pages_for(uint32_t length) {
+    return (length + PAGE_SIZE - 1) / PAGE_SIZE;
+}
 
-int send_message(uint32_t dest_pid, uint32_t type, void* data, uint32_t length) {
+// Page-aligned buffer that send_message() can hand over without copying
+void* ipc_alloc_buffer(uint32_t size) {
+    return alloc_pages(pages_for(size));
+}
+
+// Release a buffer from ipc_alloc_buffer() or receive_message_grant()
+void ipc_free_buffer(void* buffer, uint32_t size) {
+    if(is_vmap_addr((uint32_t)buffer)) {
+        free_pages(buffer, pages_for(size));
+    } else {
+        kfree(buffer);
+    }
+}
+
+static void free_message(Message* msg) {
+    if(msg->flags & MSG_GRANT) {
+        ipc_free_buffer(msg->data, msg->length);
+    } else {
+        kfree(msg->data);
+    }
+    kfree(msg);
+}
+
+void mailbox_init(Mailbox* box) {
+    box->head = 0;
+    box->count = 0;
+    wait_queue_init(&box->receivers);
+    wait_queue_init(&box->senders);
+}
+
+// Owner is exiting, let blocked senders notice
+void mailbox_close(Mailbox* box) {
+    uint32_t flags = irq_save();
+    wake_up_all(&box->senders);
+    irq_restore(flags);
+}
+
+// Drop messages nobody will receive
+void mailbox_flush(Mailbox* box) {
+    while(box->count) {
+        Message* msg = box->slots[box->head];
+        box->head = (box->head + 1) % MAILBOX_CAPACITY;
+        box->count--;
+        
+        free_message(msg);
+    }
+}
+
+// Sleep until woken or the deadline passes, returns -1 on timeout
+static int ipc_wait(WaitQueue* wq, uint32_t timeout_ms, uint32_t deadline) {
+    if(timeout_ms == IPC_WAIT_FOREVER) {
+        sleep_on(wq);
+        return 0;
+    }
+    
+    int32_t left = (int32_t)(deadline - get_timer_ticks());
+    if(left <= 0) return -1;
+    return sleep_on_timeout(wq, left);
+}
+
+static int process_alive(Process* proc) {
+    return proc && proc->state != PROC_TERMINATED && proc->state != PROC_ZOMBIE;
+}
+
+// As send_message_timeout(), on behalf of another process
+int send_message_from(uint32_t sender_pid, uint32_t dest_pid, uint32_t type, void* data, uint32_t length, uint32_t timeout_ms) {
     Message* msg = (Message*)kmalloc(sizeof(Message));
     if(!msg) return -1;
     
-    msg->sender_pid = get_current_process()->pid;
-    msg->receiver_pid = dest_pid;
+    msg->sender_pid = sender_pid;
     msg->type = type;
     msg->length = length;
-    msg->data = kmalloc(length);
+    msg->flags = 0;
+    msg->data = NULL;
+    
+    // Large page buffers change hands by remapping, the sender loses access
+    if(length >= PAGE_SIZE && is_vmap_addr((uint32_t)data) && !((uint32_t)data & (PAGE_SIZE - 1))) {
+        msg->data = move_pages(data, pages_for(length));
+        if(msg->data) {
+            msg->flags = MSG_GRANT;
+        }
+    }
     
     if(!msg->data) {
-        kfree(msg);
-        return -1;
+        msg->data = kmalloc(length);
+        if(!msg->data) {
+            kfree(msg);
+            return -1;
+        }
+        memcpy(msg->data, data, length);
+    }
+    
+    uint32_t deadline = get_timer_ticks() + ms_to_ticks(timeout_ms);
+    int expired = 0;
+    uint32_t flags = irq_save();
+    
+    while(1) {
+        // Looked up again after every sleep, the receiver may have exited
+        Process* dest = find_process(dest_pid);
+        if(!process_alive(dest)) break;
+        
+        Mailbox* box = &dest->mailbox;
+        if(box->count < MAILBOX_CAPACITY) {
+            box->slots[(box->head + box->count) % MAILBOX_CAPACITY] = msg;
+            box->count++;
+            wake_up(&box->receivers);
+            
+            irq_restore(flags);
+            check_preempt();
+            return 0;
+        }
+        
+        // Full: block the sender until the receiver catches up
+        if(expired || timeout_ms == IPC_NOWAIT) break;
+        expired = ipc_wait(&box->senders, timeout_ms, deadline) != 0;
+    }
+    
+    irq_restore(flags);
+    free_message(msg);
+    return -1;
+}
+
+int send_message_timeout(uint32_t dest_pid, uint32_t type, void* data, uint32_t length, uint32_t timeout_ms) {
+    return send_message_from(get_current_process()->pid, dest_pid, type, data, length, timeout_ms);
+}
+
+int send_message(uint32_t dest_pid, uint32_t type, void* data, uint32_t length) {
+    return send_message_timeout(dest_pid, type, data, length, IPC_WAIT_FOREVER);
+}
+
+// Take the oldest message out of our mailbox, waiting up to timeout_ms
+static Message* mailbox_get(uint32_t timeout_ms) {
+    Mailbox* box = &get_current_process()->mailbox;
+    uint32_t deadline = get_timer_ticks() + ms_to_ticks(timeout_ms);
+    int expired = 0;
+    uint32_t flags = irq_save();
+    
+    while(!box->count) {
+        if(expired || timeout_ms == IPC_NOWAIT) {
+            irq_restore(flags);
+            return NULL;
+        }
+        expired = ipc_wait(&box->receivers, timeout_ms, deadline) != 0;
     }
     
-    memcpy(msg->data, data, length);
+    Message* msg = box->slots[box->head];
+    box->head = (box->head + 1) % MAILBOX_CAPACITY;
+    box->count--;
+    wake_up(&box->senders);
+    irq_restore(flags);
     
-    // Add to message queue
-    msg->next = message_queue;
-    message_queue = msg;
+    return msg;
+}
+
+int receive_message_timeout(uint32_t* sender_pid, uint32_t* type, void* buffer, uint32_t buffer_size, uint32_t timeout_ms) {
+    Message* msg = mailbox_get(timeout_ms);
+    if(!msg) return -1; // No message
     
+    *sender_pid = msg->sender_pid;
+    *type = msg->type;
+    
+    uint32_t copy_size = (msg->length < buffer_size) ? msg->length : buffer_size;
+    memcpy(buffer, msg->data, copy_size);
+    free_message(msg);
+    
+    check_preempt();
+    return copy_size;
+}
+
+// Receive without copying: *data is the payload itself, granted pages for
+// large buffers, and must be released with ipc_free_buffer()
+int receive_message_grant(uint32_t* sender_pid, uint32_t* type, void** data, uint32_t* length, uint32_t timeout_ms) {
+    Message* msg = mailbox_get(timeout_ms);
+    if(!msg) return -1;
+    
+    *sender_pid = msg->sender_pid;
+    *type = msg->type;
+    *data = msg->data;
+    *length = msg->length;
+    kfree(msg);
+    
+    check_preempt();
     return 0;
 }
 
 int receive_message(uint32_t* sender_pid, uint32_t* type, void* buffer, uint32_t buffer_size) {
-    uint32_t current_pid = get_current_process()->pid;
-    Message* msg = message_queue;
-    Message* prev = NULL;
-    
-    // Find message for current process
-    while(msg) {
-        if(msg->receiver_pid == current_pid) {
-            // Found message
-            *sender_pid = msg->sender_pid;
-            *type = msg->type;
-            
-            uint32_t copy_size = (msg->length < buffer_size) ? msg->length : buffer_size;
-            memcpy(buffer, msg->data, copy_size);
-            
-            // Remove from queue
-            if(prev) {
-                prev->next = msg->next;
-            } else {
-                message_queue = msg->next;
-            }
-            
-            kfree(msg->data);
-            kfree(msg);
-            
-            return copy_size;
+    return receive_message_timeout(sender_pid, type, buffer, buffer_size, IPC_WAIT_FOREVER);
+}
+
+// Synchronous call/reply. A request and its reply are a few words copied
+// between the two threads' message registers, and the CPU passes directly
+// from client to server and back without touching the ready queues.
+
+static void ipc_deliver(Thread* caller, Thread* server) {
+    memcpy(server->ipc_words, caller->ipc_words, sizeof(server->ipc_words));
+    server->ipc_caller = caller;
+    caller->ipc_server = server;
+}
+
+// Send msg to a server thread of dest_pid and wait for the reply, which
+// overwrites msg. Returns 0, or -1 if the server went away.
+int ipc_call(uint32_t dest_pid, IpcMsg* msg) {
+    Thread* self = get_current_thread();
+    uint32_t flags = irq_save();
+    
+    Process* dest = find_process(dest_pid);
+    if(!process_alive(dest)) {
+        irq_restore(flags);
+        return -1;
+    }
+    
+    memcpy(self->ipc_words, msg->words, sizeof(self->ipc_words));
+    self->ipc_status = -1;
+    
+    Thread* server = wait_queue_take(&dest->ipc_servers);
+    if(server) {
+        // Run the server on our time slice, we stay blocked until it replies
+        ipc_deliver(self, server);
+        self->state = PROC_BLOCKED;
+        switch_to(server);
+    } else {
+        // Picked up by the next ipc_reply_wait(), or woken if dest exits
+        sleep_on(&dest->ipc_callers);
+    }
+    
+    int status = self->ipc_status;
+    if(status == 0) {
+        memcpy(msg->words, self->ipc_words, sizeof(msg->words));
+    }
+    irq_restore(flags);
+    return status;
+}
+
+// Reply to the caller being served, if any, then wait for the next call.
+// msg holds the reply on entry and the new request on return. Returns the
+// caller's pid, or -1.
+int ipc_reply_wait(IpcMsg* msg) {
+    Thread* self = get_current_thread();
+    Process* proc = self->process;
+    uint32_t flags = irq_save();
+    
+    Thread* caller = self->ipc_caller;
+    if(caller) {
+        memcpy(caller->ipc_words, msg->words, sizeof(caller->ipc_words));
+        caller->ipc_status = 0;
+        caller->ipc_server = NULL;
+        self->ipc_caller = NULL;
+    }
+    
+    Thread* next = wait_queue_take(&proc->ipc_callers);
+    if(next) {
+        // Already have work, the caller we answered just becomes runnable
+        if(caller) {
+            make_ready(caller);
         }
-        prev = msg;
-        msg = msg->next;
+        ipc_deliver(next, self);
+    } else if(caller) {
+        sleep_on_switch(&proc->ipc_servers, caller);
+    } else {
+        sleep_on(&proc->ipc_servers);
+    }
+    
+    if(!self->ipc_caller) {
+        irq_restore(flags);
+        return -1;
     }
     
-    return -1; // No message found
-}
\ No newline at end of file
+    memcpy(msg->words, self->ipc_words, sizeof(msg->words));
+    int from = self->ipc_caller->process->pid;
+    irq_restore(flags);
+    return from;
+}
+
+// Break off calls in progress when a thread goes away (interrupts disabled)
+void ipc_detach(Thread* thread) {
+    if(thread->ipc_server) {
+        thread->ipc_server->ipc_caller = NULL;
+        thread->ipc_server = NULL;
+    }
+    
+    // Our caller would otherwise wait forever for the reply
+    Thread* caller = thread->ipc_caller;
+    if(caller) {
+        thread->ipc_caller = NULL;
+        caller->ipc_server = NULL;
+        caller->ipc_status = -1;
+        if(caller->state == PROC_BLOCKED) {
+            make_ready(caller);
+        }
+    }
+}
+
+// Fail callers still queued on a dying process (interrupts disabled)
+void ipc_close(Process* proc) {
+    wake_up_all(&proc->ipc_callers);
+}
@@ -7,17 +7,14 @@ extern syscall_handler
 
 global syscall_interrupt
 syscall_interrupt:
-    cli
     pusha
+    push ds
     
-    mov ax, ds
-    push eax
-    
-    mov ax, 0x10
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
+    mov si, 0x10             ; Kernel data segment, GS keeps the caller's TLS
+    mov ds, si
+    mov es, si
+    mov fs, si
+    sti                      ; System calls may block and be preempted
     
     ; Call C handler with registers as arguments
     push edx    ; arg3
@@ -27,16 +24,42 @@ syscall_interrupt:
     call syscall_handler
     add esp, 16
     
+    cli
+    mov [esp + 32], eax      ; Return value replaces the saved eax
+    
     pop ebx
     mov ds, bx
     mov es, bx
     mov fs, bx
-    mov gs, bx
     
     popa
-    sti
     iret
 
+; SYSENTER entry, only reached from ring 3 since SYSEXIT always returns there.
+; eax = number, ebx/esi/edi = arguments, ecx = caller's esp, edx = return
+; address. The C handler preserves ebx/esi/edi/ebp, so nothing else is saved
+; and the flat user data segments stay loaded.
+extern sysenter_stack_top
+
+global sysenter_entry
+sysenter_entry:
+    mov esp, [sysenter_stack_top]  ; Running thread's kernel stack, one CPU
+    push ecx
+    push edx
+    sti
+    
+    push edi    ; arg3
+    push esi    ; arg2
+    push ebx    ; arg1
+    push eax    ; syscall number
+    call syscall_handler
+    add esp, 16
+    
+    pop edx                  ; SYSEXIT loads eip from edx and esp from ecx
+    pop ecx
+    sti                      ; Takes effect after SYSEXIT, still on this stack
+    sysexit
+
 // kernel/core/boot_init.asm
 ; Additional boot initialization
 
@@ -64,41 +87,40 @@ halt_loop:
 // userspace/utilities/ps.c
 // Process list utility
 
-#include "../lib/libc/stdio.h"
-#include "../lib/libc/stdlib.h"
+#include "../lib/libc/ps.h"
 
 int main(void) {
-    printf("  PID  PPID STATE     COMMAND\n");
-    printf("    1     0 RUNNING   kernel\n");
-    printf("    2     1 RUNNING   desktop\n");
-    printf("    3     1 RUNNING   shell\n");
-    printf("    4     1 SLEEPING  background_task\n");
-    
-    return 0;
+    return ps_run();
 }
 
 // userspace/utilities/ls.c
 // List files utility
 
 #include "../lib/libc/stdio.h"
-#include "../lib/libc/stdlib.h"
-#include "../../kernel/include/filesystem.h"
+#include "../lib/libc/unistd.h"
 
 int main(int argc, char** argv) {
+    static char entries[4096];
     char* path = (argc > 1) ? argv[1] : ".";
-    char** files = list_directory(path);
+    int fd = open(path, O_RDONLY);
+    int n = fd < 0 ? -1 : getdents(fd, entries, sizeof(entries));
     
-    if(!files) {
+    if(n < 0) {
         printf("ls: cannot access '%s': No such file or directory\n", path);
+        if(fd >= 0) close(fd);
         return 1;
     }
     
-    for(int i = 0; files[i] != NULL; i++) {
-        printf("%s  ", files[i]);
-        free(files[i]);
+    // Each call fills the buffer with as many packed entries as fit
+    while(n > 0) {
+        for(int pos = 0; pos < n; pos += ((struct dirent*)(entries + pos))->d_reclen) {
+            struct dirent* entry = (struct dirent*)(entries + pos);
+            printf("%s  ", entry->d_name);
+        }
+        n = getdents(fd, entries, sizeof(entries));
     }
     printf("\n");
-    free(files);
+    close(fd);
     
     return 0;
 }
@@ -108,20 +130,47 @@ int main(int argc, char** argv) {
 
 #include "../lib/libc/stdio.h"
 #include "../lib/libc/stdlib.h"
-#include "../../kernel/include/filesystem.h"
+#include "../lib/libc/unistd.h"
+
+#define BUFFER_SIZE 4096
 
 int main(int argc, char** argv) {
+    static char buffer[BUFFER_SIZE];
+    
     if(argc != 3) {
         printf("Usage: cp <source> <destination>\n");
         return 1;
     }
     
-    if(copy_file(argv[1], argv[2]) != 0) {
-        printf("cp: cannot copy '%s' to '%s'\n", argv[1], argv[2]);
+    int in = open(argv[1], O_RDONLY);
+    if(in < 0) {
+        printf("cp: cannot open '%s'\n", argv[1]);
+        return 1;
+    }
+    int out = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC);
+    if(out < 0) {
+        printf("cp: cannot create '%s'\n", argv[2]);
+        close(in);
         return 1;
     }
     
-    return 0;
+    int n;
+    int status = 0;
+    while((n = read(in, buffer, BUFFER_SIZE)) > 0) {
+        if(write(out, buffer, n) != n) {
+            printf("cp: write error on '%s'\n", argv[2]);
+            status = 1;
+            break;
+        }
+    }
+    if(n < 0) {
+        printf("cp: read error on '%s'\n", argv[1]);
+        status = 1;
+    }
+    
+    close(in);
+    close(out);
+    return status;
 }
 
 // userspace/utilities/mv.c
@@ -293,12 +342,18 @@ qemu-system-i386 \
 
 #include "../../../lib/libgui/window.h"
 #include "../../../lib/libgui/graphics.h"
+#include "../../../lib/libc/unistd.h"
 #include "../../../../kernel/include/filesystem.h"
 
+#define FM_DIRENT_BYTES 8192
+#define FM_MAX_ENTRIES 256
+
 typedef struct {
     Window* window;
     char current_path[256];
-    char** file_list;
+    char dirents[FM_DIRENT_BYTES];    // Packed entries from getdents()
+    struct dirent* entries[FM_MAX_ENTRIES];
+    int entry_count;
     int selected_index;
     int scroll_offset;
 } FileManager;
@@ -313,16 +368,25 @@ void init_file_manager(void) {
     refresh_file_list();
 }
 
+// Read the directory into the entry buffer, nothing is allocated per entry
 void refresh_file_list(void) {
-    if(fm.file_list) {
-        // Free old list
-        for(int i = 0; fm.file_list[i]; i++) {
-            free(fm.file_list[i]);
+    fm.entry_count = 0;
+    
+    int fd = open(fm.current_path, O_RDONLY);
+    if(fd < 0) return;
+    
+    int used = 0;
+    int n;
+    while(fm.entry_count < FM_MAX_ENTRIES &&
+          (n = getdents(fd, fm.dirents + used, FM_DIRENT_BYTES - used)) > 0) {
+        for(int pos = used; pos < used + n && fm.entry_count < FM_MAX_ENTRIES; ) {
+            struct dirent* entry = (struct dirent*)(fm.dirents + pos);
+            fm.entries[fm.entry_count++] = entry;
+            pos += entry->d_reclen;
         }
-        free(fm.file_list);
+        used += n;
     }
-    
-    fm.file_list = list_directory(fm.current_path);
+    close(fd);
 }
 
 void draw_file_manager(void) {
@@ -340,14 +404,14 @@ void draw_file_manager(void) {
                  fm.current_path, COLOR_BLACK);
     
     // Draw file list
-    if(fm.file_list) {
+    if(fm.entry_count) {
         int y = fm.window->y + 60;
-        for(int i = fm.scroll_offset; fm.file_list[i] && y < fm.window->y + fm.window->height - 20; i++) {
+        for(int i = fm.scroll_offset; i < fm.entry_count && y < fm.window->y + fm.window->height - 20; i++) {
             unsigned int bg_color = (i == fm.selected_index) ? COLOR_BLUE : COLOR_WHITE;
             unsigned int text_color = (i == fm.selected_index) ? COLOR_WHITE : COLOR_BLACK;
             
             gui_draw_rectangle(fm.window->x + 5, y, fm.window->width - 10, 20, bg_color);
-            gui_draw_text(fm.window->x + 10, y + 5, fm.file_list[i], text_color);
+            gui_draw_text(fm.window->x + 10, y + 5, fm.entries[i]->d_name, text_color);
             
             y += 22;
         }
@@ -360,18 +424,17 @@ void handle_file_manager_event(GUIEvent* event) {
            event->y >= fm.window->y + 60 && event->y < fm.window->y + fm.window->height) {
             
             int index = (event->y - fm.window->y - 60) / 22 + fm.scroll_offset;
-            if(fm.file_list && fm.file_list[index]) {
+            if(index >= 0 && index < fm.entry_count) {
                 fm.selected_index = index;
                 
                 // Double click to open
                 if(event->button == 1) {
                     // Navigate to directory or open file
                     char new_path[512];
-                    snprintf(new_path, sizeof(new_path), "%s/%s", fm.current_path, fm.file_list[index]);
+                    snprintf(new_path, sizeof(new_path), "%s/%s", fm.current_path, fm.entries[index]->d_name);
                     
-                    // Check if it's a directory
-                    struct vfs_node* node = find_file(new_path);
-                    if(node && node->type == FILE_TYPE_DIRECTORY) {
+                    // The entry says whether it is a directory
+                    if(fm.entries[index]->d_type == DT_DIR) {
                         strcpy(fm.current_path, new_path);
                         refresh_file_list();
                         fm.selected_index = -1;
@@ -0,0 +1,66 @@
+// kernel/core/sysenter.c
+// SYSENTER/SYSEXIT fast system call entry
+
+#include "../include/kernel.h"
+#include "../include/process.h"
+
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+#define CPUID_SEP (1 << 11)
+
+#define KERNEL_CODE_SELECTOR 0x08  // User CS/SS for SYSEXIT are fixed offsets from it
+#define SYSENTER_STACK_SIZE 256
+#define BOOT_STACK_TOP 0x90000     // Set by boot_entry.asm, the boot thread keeps it
+
+void sysenter_entry(void);
+
+// Kernel stack of the running thread, sysenter_entry() moves onto it
+uint32_t sysenter_stack_top[NR_CPUS];
+
+// Only used for the first few instructions after SYSENTER
+static uint8_t entry_stack[NR_CPUS][SYSENTER_STACK_SIZE] __attribute__((aligned(16)));
+static int sysenter_enabled = 0;
+
+static inline void wrmsr(uint32_t msr, uint32_t low, uint32_t high) {
+    asm volatile("wrmsr" : : "c"(msr), "a"(low), "d"(high));
+}
+
+// Whether the CPU implements SYSENTER/SYSEXIT
+int sysenter_supported(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    
+    // Early Pentium Pros set the bit without having the instructions
+    uint32_t family = (eax >> 8) & 0xF;
+    uint32_t model = (eax >> 4) & 0xF;
+    uint32_t stepping = eax & 0xF;
+    if(family == 6 && model < 3 && stepping < 3) return 0;
+    
+    return (edx & CPUID_SEP) != 0;
+}
+
+void init_sysenter(void) {
+    if(!sysenter_supported()) {
+        print("SYSENTER not supported, using int 0x80\n");
+        return;
+    }
+    
+    int cpu = cpu_id();
+    wrmsr(MSR_SYSENTER_CS, KERNEL_CODE_SELECTOR, 0);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)&entry_stack[cpu][SYSENTER_STACK_SIZE], 0);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry, 0);
+    sysenter_enabled = 1;
+    
+    // Context switches keep it up to date from here on
+    sysenter_set_stack(get_current_thread());
+}
+
+// Called on every context switch, cheaper than rewriting the ESP MSR
+void sysenter_set_stack(Thread* next) {
+    if(sysenter_enabled) {
+        sysenter_stack_top[cpu_id()] = next->kernel_stack ?
+            (uint32_t)next->kernel_stack + next->stack_size : BOOT_STACK_TOP;
+    }
+}
@@ -0,0 +1,112 @@
+// kernel/core/trace.c
+// System call tracer and per-call latency histograms
+
+#include "../include/kernel.h"
+#include "../include/process.h"
+
+// Always on, one set per CPU so the hot path never shares a line
+typedef struct {
+    uint32_t count[SYSCALL_SLOTS];
+    uint64_t cycles[SYSCALL_SLOTS];
+    uint32_t hist[SYSCALL_SLOTS][SYSCALL_HIST_BUCKETS];
+} SyscallCounters;
+
+typedef struct {
+    TraceRecord records[TRACE_RING_SIZE];
+    uint32_t head;            // Sequence number of the next record
+} TraceRing;
+
+static SyscallCounters counters[NR_CPUS];
+static TraceRing trace_rings[NR_CPUS];
+static volatile uint32_t trace_pid = 0; // 0 when nobody is being followed
+
+static int log2_bucket(uint32_t cycles) {
+    if(!cycles) return 0;
+    int bucket = 31 - __builtin_clz(cycles);
+    return bucket < SYSCALL_HIST_BUCKETS ? bucket : SYSCALL_HIST_BUCKETS - 1;
+}
+
+// Called by syscall_handler() once the call has returned
+void syscall_trace_exit(int num, int arg1, int arg2, int arg3, int ret, uint64_t start) {
+    uint64_t now = rdtsc();
+    uint64_t elapsed = now - start;
+    uint32_t cycles = elapsed > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)elapsed;
+    if(num < 0 || num >= SYSCALL_SLOTS) return;
+    
+    uint32_t flags = irq_save();
+    SyscallCounters* c = &counters[cpu_id()];
+    c->count[num]++;
+    c->cycles[num] += elapsed;
+    c->hist[num][log2_bucket(cycles)]++;
+    
+    Process* proc = get_current_process();
+    if(trace_pid && proc && proc->pid == trace_pid) {
+        TraceRing* ring = &trace_rings[cpu_id()];
+        TraceRecord* rec = &ring->records[ring->head & (TRACE_RING_SIZE - 1)];
+        rec->seq = ring->head++;
+        rec->pid = proc->pid;
+        rec->num = num;
+        rec->args[0] = arg1;
+        rec->args[1] = arg2;
+        rec->args[2] = arg3;
+        rec->ret = ret;
+        rec->cycles = cycles;
+        rec->tsc = start;
+    }
+    irq_restore(flags);
+}
+
+// Record every system call of pid from now on, 0 stops tracing
+int syscall_trace_follow(int pid) {
+    if(pid < 0) return -1;
+    if(pid && !find_process(pid)) return -1;
+    trace_pid = pid;
+    return 0;
+}
+
+// Copy records newer than cursors[cpu] into out and advance the cursors.
+// A reader that falls more than a ring behind skips ahead.
+int syscall_trace_read(TraceRecord* out, int max, uint32_t* cursors) {
+    int n = 0;
+    uint32_t flags = irq_save();
+    
+    for(int cpu = 0; cpu < NR_CPUS && n < max; cpu++) {
+        TraceRing* ring = &trace_rings[cpu];
+        if(ring->head - cursors[cpu] > TRACE_RING_SIZE) {
+            cursors[cpu] = ring->head - TRACE_RING_SIZE;
+        }
+        while(cursors[cpu] != ring->head && n < max) {
+            out[n++] = ring->records[cursors[cpu] & (TRACE_RING_SIZE - 1)];
+            cursors[cpu]++;
+        }
+    }
+    
+    irq_restore(flags);
+    return n;
+}
+
+// Counters summed over CPUs, one entry per system call that has been made
+int syscall_get_stats(SyscallStat* out, int max) {
+    int n = 0;
+    
+    for(int num = 0; num < SYSCALL_SLOTS && n < max; num++) {
+        SyscallStat* stat = &out[n];
+        memset(stat, 0, sizeof(SyscallStat));
+        
+        uint32_t flags = irq_save();
+        for(int cpu = 0; cpu < NR_CPUS; cpu++) {
+            stat->count += counters[cpu].count[num];
+            stat->cycles += counters[cpu].cycles[num];
+            for(int b = 0; b < SYSCALL_HIST_BUCKETS; b++) {
+                stat->hist[b] += counters[cpu].hist[num][b];
+            }
+        }
+        irq_restore(flags);
+        
+        if(!stat->count) continue;
+        stat->num = num;
+        strncpy(stat->name, syscall_name(num), sizeof(stat->name) - 1);
+        n++;
+    }
+    return n;
+}
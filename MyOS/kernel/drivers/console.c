@@ -0,0 +1,116 @@
+// kernel/drivers/console.c
+// VGA text console: whole-buffer writes, scrolling by panning the display start
+
+#include "../include/kernel.h"
+
+#define VGA_MEMORY 0xB8000
+#define VGA_WIDTH 80
+#define VGA_HEIGHT 25
+#define VGA_TEXT_ROWS 204          // Rows that fit in the 32 KB text window
+
+#define VGA_CRTC_INDEX 0x3D4
+#define VGA_CRTC_DATA 0x3D5
+#define VGA_START_HIGH 0x0C
+#define VGA_START_LOW 0x0D
+#define VGA_CURSOR_HIGH 0x0E
+#define VGA_CURSOR_LOW 0x0F
+
+#define VGA_COLOR_WHITE 15
+#define BLANK_CELL (' ' | (VGA_COLOR_WHITE << 8))
+
+static uint16_t* vga_text = (uint16_t*)VGA_MEMORY;
+static int cursor_x = 0;           // Relative to the visible screen
+static int cursor_y = 0;
+static int top_row = 0;            // Text memory row shown at the top
+static int start_dirty = 0;        // top_row not yet sent to the CRTC
+
+static uint16_t* screen_row(int y) {
+    return vga_text + (top_row + y) * VGA_WIDTH;
+}
+
+static void clear_row(uint16_t* row) {
+    uint32_t* cells = (uint32_t*)row;
+    for(int i = 0; i < VGA_WIDTH / 2; i++) {
+        cells[i] = BLANK_CELL | ((uint32_t)BLANK_CELL << 16);
+    }
+}
+
+static void crtc_write(uint8_t reg, uint8_t value) {
+    outb(VGA_CRTC_INDEX, reg);
+    outb(VGA_CRTC_DATA, value);
+}
+
+// Scroll by one line. Usually the display just starts a row later; once the
+// text window is used up the visible rows are copied back to its start.
+static void scroll(void) {
+    if(top_row + VGA_HEIGHT < VGA_TEXT_ROWS) {
+        top_row++;
+    } else {
+        memcpy(vga_text, screen_row(1), (VGA_HEIGHT - 1) * VGA_WIDTH * 2);
+        top_row = 0;
+    }
+    clear_row(screen_row(VGA_HEIGHT - 1));
+    start_dirty = 1;
+}
+
+void update_cursor(void) {
+    if(start_dirty) {
+        int start = top_row * VGA_WIDTH;
+        crtc_write(VGA_START_HIGH, (start >> 8) & 0xFF);
+        crtc_write(VGA_START_LOW, start & 0xFF);
+        start_dirty = 0;
+    }
+    
+    int pos = (top_row + cursor_y) * VGA_WIDTH + cursor_x;
+    crtc_write(VGA_CURSOR_HIGH, (pos >> 8) & 0xFF);
+    crtc_write(VGA_CURSOR_LOW, pos & 0xFF);
+}
+
+// Write size bytes in one go; the CRTC is programmed once at the end
+void console_write_text(const char* buf, uint32_t size, int color) {
+    uint16_t attr = (uint16_t)color << 8;
+    uint32_t flags = irq_save();
+    uint16_t* cell = screen_row(cursor_y) + cursor_x;
+    
+    for(uint32_t i = 0; i < size; i++) {
+        if(buf[i] == '\n') {
+            cursor_x = VGA_WIDTH;
+        } else {
+            *cell++ = attr | (uint8_t)buf[i];
+            cursor_x++;
+        }
+        
+        if(cursor_x >= VGA_WIDTH) {
+            cursor_x = 0;
+            if(++cursor_y >= VGA_HEIGHT) {
+                scroll();
+                cursor_y = VGA_HEIGHT - 1;
+            }
+            cell = screen_row(cursor_y);
+        }
+    }
+    
+    update_cursor();
+    irq_restore(flags);
+}
+
+void print(const char* str) {
+    print_colored(str, VGA_COLOR_WHITE);
+}
+
+void print_colored(const char* str, int color) {
+    console_write_text(str, strlen(str), color);
+}
+
+void clear_screen(void) {
+    uint32_t flags = irq_save();
+    top_row = 0;
+    start_dirty = 1;
+    for(int y = 0; y < VGA_HEIGHT; y++) {
+        clear_row(screen_row(y));
+    }
+    cursor_x = 0;
+    cursor_y = 0;
+    update_cursor();
+    irq_restore(flags);
+}
@@ -142,17 +142,20 @@ int ata_read_sectors(ATADrive* drive, unsigned int lba, unsigned char sectors, u
     // Send read command
     outb(drive->io_base + 7, 0x20);
     
-    // Wait for command to complete
-    while((inb(drive->io_base + 7) & 0x80) != 0);
-    
-    // Check for errors
-    if(inb(drive->io_base + 7) & 0x01) {
-        return -1; // Error
-    }
-    
-    // Read data
-    for(int i = 0; i < sectors * 256; i++) {
-        buffer[i] = inw(drive->io_base);
+    // The drive raises DRQ once per sector
+    for(int s = 0; s < sectors; s++) {
+        // Wait for the sector to be ready
+        while((inb(drive->io_base + 7) & 0x80) != 0);
+        
+        // Check for errors
+        if(inb(drive->io_base + 7) & 0x01) {
+            return -1; // Error
+        }
+        
+        // Read data
+        for(int i = 0; i < 256; i++) {
+            buffer[s * 256 + i] = inw(drive->io_base);
+        }
     }
     
     return 0;
@@ -173,18 +176,68 @@ int ata_write_sectors(ATADrive* drive, unsigned int lba, unsigned char sectors,
     // Send write command
     outb(drive->io_base + 7, 0x30);
     
-    // Wait for drive to be ready
-    while((inb(drive->io_base + 7) & 0x08) == 0);
-    
-    // Write data
-    for(int i = 0; i < sectors * 256; i++) {
-        outw(drive->io_base, buffer[i]);
+    for(int s = 0; s < sectors; s++) {
+        // Wait for drive to be ready
+        while((inb(drive->io_base + 7) & 0x88) != 0x08) {
+            if(inb(drive->io_base + 7) & 0x01) {
+                return -1; // Error
+            }
+        }
+        
+        // Write data
+        for(int i = 0; i < 256; i++) {
+            outw(drive->io_base, buffer[s * 256 + i]);
+        }
     }
     
     // Wait for completion
     while((inb(drive->io_base + 7) & 0x80) != 0);
     
-    return 0;
+    return (inb(drive->io_base + 7) & 0x01) ? -1 : 0;
+}
+
+// One command at a time on the channel, both drives share its registers
+static KMutex disk_lock = KMUTEX_INIT("disk");
+
+static ATADrive* disk_drive(uint32_t dev) {
+    if(dev == 0) return &primary_master;
+    if(dev == 1) return &primary_slave;
+    return NULL;
+}
+
+// Read count sectors from lba on disk dev (0 primary master, 1 primary slave)
+int disk_read(uint32_t dev, uint32_t lba, uint32_t count, void* buffer) {
+    ATADrive* drive = disk_drive(dev);
+    if(!drive) return -1;
+    
+    int result = 0;
+    kmutex_lock(&disk_lock);
+    while(count && result == 0) {
+        unsigned char n = count > 255 ? 255 : count;
+        result = ata_read_sectors(drive, lba, n, (unsigned short*)buffer);
+        lba += n;
+        count -= n;
+        buffer = (char*)buffer + n * DISK_SECTOR_SIZE;
+    }
+    kmutex_unlock(&disk_lock);
+    return result;
+}
+
+int disk_write(uint32_t dev, uint32_t lba, uint32_t count, const void* buffer) {
+    ATADrive* drive = disk_drive(dev);
+    if(!drive) return -1;
+    
+    int result = 0;
+    kmutex_lock(&disk_lock);
+    while(count && result == 0) {
+        unsigned char n = count > 255 ? 255 : count;
+        result = ata_write_sectors(drive, lba, n, (unsigned short*)buffer);
+        lba += n;
+        count -= n;
+        buffer = (const char*)buffer + n * DISK_SECTOR_SIZE;
+    }
+    kmutex_unlock(&disk_lock);
+    return result;
 }
 
 unsigned short inw(unsigned short port) {
@@ -301,6 +354,7 @@ void process_received_frame(unsigned char* frame, unsigned short length) {
 
 static unsigned int timer_ticks = 0;
 static unsigned int seconds = 0;
+static uint64_t boot_tsc = 0;
 
 void init_timer(void) {
     // Calculate divisor for desired frequency
@@ -317,6 +371,9 @@ void init_timer(void) {
 }
 
 void timer_callback(void) {
+    if(timer_ticks == 0) {
+        boot_tsc = rdtsc(); // Reference point for TSC calibration
+    }
     timer_ticks++;
     
     if(timer_ticks % TIMER_FREQUENCY == 0) {
@@ -332,6 +389,19 @@ unsigned int get_uptime_seconds(void) {
     return seconds;
 }
 
+// Round up so a short timeout never becomes zero ticks
+uint32_t ms_to_ticks(uint32_t ms) {
+    return (uint32_t)(((uint64_t)ms * TIMER_FREQUENCY + 999) / 1000);
+}
+
+// TSC rate measured against the PIT, 0 until a second of ticks has passed
+uint32_t tsc_cycles_per_ms(void) {
+    if(timer_ticks <= TIMER_FREQUENCY) return 0;
+    
+    uint64_t elapsed_ms = (uint64_t)(timer_ticks - 1) * 1000 / TIMER_FREQUENCY;
+    return (uint32_t)((rdtsc() - boot_tsc) / elapsed_ms);
+}
+
 void sleep(unsigned int ms) {
     unsigned int target = timer_ticks + (ms * TIMER_FREQUENCY / 1000);
     while(timer_ticks < target) {
@@ -0,0 +1,424 @@
+// kernel/filesystem/buffer_cache.c
+// Disk block cache with 2Q replacement and delayed write-back
+
+#include "../include/kernel.h"
+#include "../include/filesystem.h"
+
+#define NR_BUFFERS (BUFFER_CACHE_SIZE / BLOCK_SIZE)
+#define SECTORS_PER_BLOCK (BLOCK_SIZE / DISK_SECTOR_SIZE)
+#define BCACHE_HASH_BITS 10
+#define BCACHE_HASH_SIZE (1 << BCACHE_HASH_BITS)
+
+// 2Q, an O(1) take on LRU-2: a block seen once waits in the FIFO A1in. If it
+// is missed again soon after leaving it, which A1out remembers, it has shown
+// reuse and goes to the LRU queue Am. A one-off scan cannot push hot
+// metadata out, it only cycles through A1in.
+#define A1IN_MAX (NR_BUFFERS / 4)
+#define A1OUT_MAX (NR_BUFFERS / 2)
+
+#define QUEUE_FREE 0
+#define QUEUE_A1IN 1
+#define QUEUE_AM 2
+
+#define BUF_VALID 0x01
+#define BUF_DIRTY 0x02
+#define BUF_LOCKED 0x04           // Read or write-back in flight
+
+typedef struct buffer {
+    uint32_t dev;
+    uint32_t block;
+    char* data;               // Allocated on first use
+    uint32_t refs;
+    uint32_t flags;
+    uint32_t queue;
+    struct buffer* hash_next;
+    struct buffer* prev;      // Newest at the head of its queue
+    struct buffer* next;
+} Buffer;
+
+// A block that left A1in recently, without its data
+typedef struct ghost {
+    uint32_t dev;
+    uint32_t block;
+    int used;
+    struct ghost* hash_next;
+} Ghost;
+
+typedef struct {
+    Buffer* head;
+    Buffer* tail;
+    uint32_t count;
+} BufferQueue;
+
+static Buffer buffers[NR_BUFFERS];
+static Buffer* buffer_hash[BCACHE_HASH_SIZE];
+static BufferQueue queues[3];
+
+// A1out is a ring, the oldest ghost is overwritten first
+static Ghost ghosts[A1OUT_MAX];
+static Ghost* ghost_hash[BCACHE_HASH_SIZE];
+static uint32_t ghost_next;
+
+// Woken whenever a buffer's I/O completes
+static WaitQueue io_wait;
+static DelayedWork flush_work;
+static BcacheStats stats;
+
+static uint32_t hash_block(uint32_t dev, uint32_t block) {
+    return ((block ^ (dev << 28)) * 2654435761u) >> (32 - BCACHE_HASH_BITS);
+}
+
+static void queue_unlink(Buffer* buf) {
+    BufferQueue* queue = &queues[buf->queue];
+    if(buf->prev) buf->prev->next = buf->next;
+    else queue->head = buf->next;
+    if(buf->next) buf->next->prev = buf->prev;
+    else queue->tail = buf->prev;
+    queue->count--;
+}
+
+static void queue_push(Buffer* buf, uint32_t index) {
+    BufferQueue* queue = &queues[index];
+    buf->queue = index;
+    buf->prev = NULL;
+    buf->next = queue->head;
+    if(queue->head) queue->head->prev = buf;
+    else queue->tail = buf;
+    queue->head = buf;
+    queue->count++;
+}
+
+// Interrupts must be disabled
+static Buffer* find(uint32_t dev, uint32_t block) {
+    Buffer* buf = buffer_hash[hash_block(dev, block)];
+    while(buf && (buf->dev != dev || buf->block != block)) {
+        buf = buf->hash_next;
+    }
+    return buf;
+}
+
+static void unhash(Buffer* buf) {
+    Buffer** link = &buffer_hash[hash_block(buf->dev, buf->block)];
+    while(*link != buf) {
+        link = &(*link)->hash_next;
+    }
+    *link = buf->hash_next;
+}
+
+static Ghost* ghost_find(uint32_t dev, uint32_t block) {
+    Ghost* ghost = ghost_hash[hash_block(dev, block)];
+    while(ghost && (ghost->dev != dev || ghost->block != block)) {
+        ghost = ghost->hash_next;
+    }
+    return ghost;
+}
+
+static void ghost_drop(Ghost* ghost) {
+    Ghost** link = &ghost_hash[hash_block(ghost->dev, ghost->block)];
+    while(*link != ghost) {
+        link = &(*link)->hash_next;
+    }
+    *link = ghost->hash_next;
+    ghost->used = 0;
+}
+
+static void ghost_add(uint32_t dev, uint32_t block) {
+    Ghost* ghost = &ghosts[ghost_next];
+    ghost_next = (ghost_next + 1) % A1OUT_MAX;
+    if(ghost->used) ghost_drop(ghost);
+    
+    uint32_t hash = hash_block(dev, block);
+    ghost->dev = dev;
+    ghost->block = block;
+    ghost->used = 1;
+    ghost->hash_next = ghost_hash[hash];
+    ghost_hash[hash] = ghost;
+}
+
+static void evict(Buffer* buf) {
+    unhash(buf);
+    queue_unlink(buf);
+    if(buf->queue == QUEUE_A1IN) {
+        ghost_add(buf->dev, buf->block);
+    }
+    buf->flags = 0;
+    stats.evictions++;
+}
+
+// A buffer for a new block, taken off every queue (interrupts must be
+// disabled). Clean blocks go first; if only dirty ones are left, NULL is
+// returned with *flush set to one that has to be written back.
+static Buffer* reclaim(Buffer** flush) {
+    Buffer* buf = queues[QUEUE_FREE].head;
+    if(buf) {
+        if(!buf->data) buf->data = (char*)kmalloc(BLOCK_SIZE);
+        if(buf->data) {
+            queue_unlink(buf);
+            return buf;
+        }
+    }
+    
+    // Keep A1in to its share, the hot queue only gives up blocks past that
+    uint32_t first = QUEUE_AM;
+    if(queues[QUEUE_A1IN].count > A1IN_MAX || !queues[QUEUE_AM].count) {
+        first = QUEUE_A1IN;
+    }
+    
+    *flush = NULL;
+    for(int pass = 0; pass < 2; pass++) {
+        uint32_t index = pass ? QUEUE_A1IN + QUEUE_AM - first : first;
+        for(buf = queues[index].tail; buf; buf = buf->prev) {
+            if(buf->refs || (buf->flags & BUF_LOCKED)) continue;
+            if(buf->flags & BUF_DIRTY) {
+                if(!*flush) *flush = buf;
+                continue;
+            }
+            evict(buf);
+            return buf;
+        }
+    }
+    return NULL;
+}
+
+// Write a pinned block out if it is dirty, -1 on I/O error
+static int write_back(Buffer* buf) {
+    uint32_t flags = irq_save();
+    while(buf->flags & BUF_LOCKED) {
+        sleep_on(&io_wait);
+    }
+    if(!(buf->flags & BUF_DIRTY)) {
+        irq_restore(flags);
+        return 0;
+    }
+    // Stores made while the write is in flight dirty the block again
+    buf->flags = (buf->flags & ~BUF_DIRTY) | BUF_LOCKED;
+    irq_restore(flags);
+    
+    int result = disk_write(buf->dev, buf->block * SECTORS_PER_BLOCK, SECTORS_PER_BLOCK, buf->data);
+    
+    flags = irq_save();
+    buf->flags &= ~BUF_LOCKED;
+    if(result == 0) stats.writes++;
+    else buf->flags |= BUF_DIRTY;
+    wake_up_all(&io_wait);
+    irq_restore(flags);
+    return result;
+}
+
+// Bring a locked, pinned block in. A block the caller is about to overwrite
+// whole is zeroed rather than read.
+static Buffer* fill_block(Buffer* buf, int read) {
+    int result = 0;
+    if(read) {
+        result = disk_read(buf->dev, buf->block * SECTORS_PER_BLOCK, SECTORS_PER_BLOCK, buf->data);
+    } else {
+        memset(buf->data, 0, BLOCK_SIZE);
+    }
+    
+    uint32_t flags = irq_save();
+    buf->flags &= ~BUF_LOCKED;
+    if(result == 0) {
+        buf->flags |= BUF_VALID;
+        if(read) stats.reads++;
+    } else {
+        // Left invalid, the next lookup tries the disk again
+        buf->refs--;
+        buf = NULL;
+    }
+    wake_up_all(&io_wait);
+    irq_restore(flags);
+    return buf;
+}
+
+// The block, pinned. NULL on I/O error or if every buffer is pinned.
+static Buffer* get_block(uint32_t dev, uint32_t block, int read) {
+    uint32_t flags = irq_save();
+    for(;;) {
+        Buffer* buf = find(dev, block);
+        if(buf) {
+            buf->refs++;
+            // Another look while still in A1in is a correlated reference,
+            // it says nothing about reuse and does not move the block
+            if(buf->queue == QUEUE_AM) {
+                queue_unlink(buf);
+                queue_push(buf, QUEUE_AM);
+            }
+            while(buf->flags & BUF_LOCKED) {
+                sleep_on(&io_wait);
+            }
+            if(buf->flags & BUF_VALID) {
+                stats.hits++;
+                irq_restore(flags);
+                return buf;
+            }
+            stats.misses++;
+            buf->flags |= BUF_LOCKED;
+            irq_restore(flags);
+            return fill_block(buf, read);
+        }
+        
+        Buffer* flush;
+        buf = reclaim(&flush);
+        if(!buf) {
+            if(!flush) {
+                irq_restore(flags);
+                return NULL;
+            }
+            // Every idle block is dirty: write one back, then look again
+            // since the block may have been brought in meanwhile
+            flush->refs++;
+            irq_restore(flags);
+            int result = write_back(flush);
+            flags = irq_save();
+            flush->refs--;
+            if(result != 0) {
+                irq_restore(flags);
+                return NULL;
+            }
+            continue;
+        }
+        
+        stats.misses++;
+        uint32_t queue = QUEUE_A1IN;
+        Ghost* ghost = ghost_find(dev, block);
+        if(ghost) {
+            ghost_drop(ghost);
+            stats.ghost_hits++;
+            queue = QUEUE_AM;
+        }
+        
+        uint32_t hash = hash_block(dev, block);
+        buf->dev = dev;
+        buf->block = block;
+        buf->refs = 1;
+        buf->flags = BUF_LOCKED;
+        buf->hash_next = buffer_hash[hash];
+        buffer_hash[hash] = buf;
+        queue_push(buf, queue);
+        irq_restore(flags);
+        
+        return fill_block(buf, read);
+    }
+}
+
+static void flush_dirty(Work* work) {
+    (void)work;
+    // Try again later if the disk failed
+    if(bcache_sync() != 0) {
+        queue_delayed_work(&flush_work, ms_to_ticks(BCACHE_WRITEBACK_MS));
+    }
+}
+
+void init_buffer_cache(void) {
+    memset(buffer_hash, 0, sizeof(buffer_hash));
+    memset(ghost_hash, 0, sizeof(ghost_hash));
+    memset(queues, 0, sizeof(queues));
+    memset(&stats, 0, sizeof(stats));
+    ghost_next = 0;
+    
+    for(int i = 0; i < A1OUT_MAX; i++) {
+        ghosts[i].used = 0;
+    }
+    for(int i = 0; i < NR_BUFFERS; i++) {
+        buffers[i].data = NULL;
+        buffers[i].refs = 0;
+        buffers[i].flags = 0;
+        queue_push(&buffers[i], QUEUE_FREE);
+    }
+    
+    wait_queue_init(&io_wait);
+    init_delayed_work(&flush_work, flush_dirty, NULL);
+}
+
+// The block read into memory and pinned, NULL on I/O error
+struct buffer* bread(uint32_t dev, uint32_t block) {
+    return get_block(dev, block, 1);
+}
+
+void brelse(struct buffer* buf) {
+    uint32_t flags = irq_save();
+    buf->refs--;
+    irq_restore(flags);
+}
+
+char* buffer_data(struct buffer* buf) {
+    return buf->data;
+}
+
+// The block reaches the disk within BCACHE_WRITEBACK_MS, or when evicted
+void mark_buffer_dirty(struct buffer* buf) {
+    uint32_t flags = irq_save();
+    buf->flags |= BUF_DIRTY;
+    irq_restore(flags);
+    
+    queue_delayed_work(&flush_work, ms_to_ticks(BCACHE_WRITEBACK_MS));
+}
+
+// Copy part of a block out, bytes copied or -1 on I/O error
+int bcache_read(uint32_t dev, uint32_t block, uint32_t offset, uint32_t size, char* buffer) {
+    if(offset >= BLOCK_SIZE) return -1;
+    if(size > BLOCK_SIZE - offset) size = BLOCK_SIZE - offset;
+    
+    Buffer* buf = get_block(dev, block, 1);
+    if(!buf) return -1;
+    
+    // Not torn by a concurrent bcache_write()
+    uint32_t flags = irq_save();
+    memcpy(buffer, buf->data + offset, size);
+    irq_restore(flags);
+    
+    brelse(buf);
+    return size;
+}
+
+// Store into part of a block, written back later
+int bcache_write(uint32_t dev, uint32_t block, uint32_t offset, uint32_t size, const char* buffer) {
+    if(offset >= BLOCK_SIZE) return -1;
+    if(size > BLOCK_SIZE - offset) size = BLOCK_SIZE - offset;
+    
+    Buffer* buf = get_block(dev, block, offset != 0 || size != BLOCK_SIZE);
+    if(!buf) return -1;
+    
+    // Leave a write-back in flight its bytes
+    uint32_t flags = irq_save();
+    while(buf->flags & BUF_LOCKED) {
+        sleep_on(&io_wait);
+    }
+    memcpy(buf->data + offset, buffer, size);
+    irq_restore(flags);
+    
+    mark_buffer_dirty(buf);
+    brelse(buf);
+    return size;
+}
+
+// Write every dirty block back now, -1 if any of them failed
+int bcache_sync(void) {
+    int result = 0;
+    for(int i = 0; i < NR_BUFFERS; i++) {
+        Buffer* buf = &buffers[i];
+        
+        uint32_t flags = irq_save();
+        if(!(buf->flags & BUF_DIRTY)) {
+            irq_restore(flags);
+            continue;
+        }
+        buf->refs++;
+        irq_restore(flags);
+        
+        if(write_back(buf) != 0) result = -1;
+        brelse(buf);
+    }
+    return result;
+}
+
+void bcache_get_stats(BcacheStats* out) {
+    uint32_t flags = irq_save();
+    *out = stats;
+    out->resident = queues[QUEUE_A1IN].count + queues[QUEUE_AM].count;
+    out->dirty = 0;
+    for(int i = 0; i < NR_BUFFERS; i++) {
+        if(buffers[i].flags & BUF_DIRTY) out->dirty++;
+    }
+    irq_restore(flags);
+}
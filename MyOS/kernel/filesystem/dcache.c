@@ -0,0 +1,175 @@
+// kernel/filesystem/dcache.c
+// Directory entry cache: (parent, name) to node, misses remembered too
+
+#include "../include/kernel.h"
+#include "../include/filesystem.h"
+
+#define DCACHE_HASH_SIZE 1024
+
+typedef struct dentry {
+    struct vfs_node* parent;  // NULL while the entry is free
+    struct vfs_node* node;    // NULL for a name known not to exist
+    uint32_t hash;
+    uint32_t len;
+    char name[DCACHE_NAME_MAX];
+    struct dentry* hash_next;
+    struct dentry* lru_prev;  // Most recently used at the head
+    struct dentry* lru_next;
+} Dentry;
+
+static Dentry dentries[DCACHE_ENTRIES];
+static Dentry* dentry_hash[DCACHE_HASH_SIZE];
+static Dentry* lru_head;
+static Dentry* lru_tail;
+static DcacheStats stats;
+
+// FNV-1a over the name, mixed with the parent
+static uint32_t hash_name(struct vfs_node* parent, const char* name, uint32_t len) {
+    uint32_t hash = 2166136261u;
+    for(uint32_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash ^ ((uint32_t)parent >> 4);
+}
+
+static void lru_unlink(Dentry* dentry) {
+    if(dentry->lru_prev) dentry->lru_prev->lru_next = dentry->lru_next;
+    else lru_head = dentry->lru_next;
+    if(dentry->lru_next) dentry->lru_next->lru_prev = dentry->lru_prev;
+    else lru_tail = dentry->lru_prev;
+}
+
+static void lru_push(Dentry* dentry) {
+    dentry->lru_prev = NULL;
+    dentry->lru_next = lru_head;
+    if(lru_head) lru_head->lru_prev = dentry;
+    else lru_tail = dentry;
+    lru_head = dentry;
+}
+
+// Unhash an entry and move it to the cold end, where it is reused first
+static void drop(Dentry* dentry) {
+    Dentry** link = &dentry_hash[dentry->hash % DCACHE_HASH_SIZE];
+    while(*link != dentry) {
+        link = &(*link)->hash_next;
+    }
+    *link = dentry->hash_next;
+    
+    dentry->parent = NULL;
+    dentry->node = NULL;
+    lru_unlink(dentry);
+    dentry->lru_next = NULL;
+    dentry->lru_prev = lru_tail;
+    if(lru_tail) lru_tail->lru_next = dentry;
+    else lru_head = dentry;
+    lru_tail = dentry;
+}
+
+// Interrupts must be disabled
+static Dentry* find(struct vfs_node* parent, const char* name, uint32_t len, uint32_t hash) {
+    Dentry* dentry = dentry_hash[hash % DCACHE_HASH_SIZE];
+    while(dentry) {
+        if(dentry->hash == hash && dentry->parent == parent && dentry->len == len &&
+           strncmp(dentry->name, name, len) == 0) {
+            return dentry;
+        }
+        dentry = dentry->hash_next;
+    }
+    return NULL;
+}
+
+void init_dcache(void) {
+    lru_head = NULL;
+    lru_tail = NULL;
+    for(int i = 0; i < DCACHE_HASH_SIZE; i++) {
+        dentry_hash[i] = NULL;
+    }
+    for(int i = 0; i < DCACHE_ENTRIES; i++) {
+        dentries[i].parent = NULL;
+        dentries[i].node = NULL;
+        lru_push(&dentries[i]);
+    }
+    memset(&stats, 0, sizeof(stats));
+}
+
+// DCACHE_HIT with *node set, DCACHE_NEGATIVE if the name is known to be
+// absent, DCACHE_MISS if the directory has to be searched
+int dcache_lookup(struct vfs_node* parent, const char* name, uint32_t len, struct vfs_node** node) {
+    if(len >= DCACHE_NAME_MAX) return DCACHE_MISS;
+    uint32_t hash = hash_name(parent, name, len);
+    
+    uint32_t flags = irq_save();
+    Dentry* dentry = find(parent, name, len, hash);
+    if(!dentry) {
+        stats.misses++;
+        irq_restore(flags);
+        return DCACHE_MISS;
+    }
+    
+    lru_unlink(dentry);
+    lru_push(dentry);
+    *node = dentry->node;
+    if(dentry->node) stats.hits++;
+    else stats.negative_hits++;
+    irq_restore(flags);
+    
+    return dentry->node ? DCACHE_HIT : DCACHE_NEGATIVE;
+}
+
+// Remember what a directory search found, node NULL if nothing
+void dcache_add(struct vfs_node* parent, const char* name, uint32_t len, struct vfs_node* node) {
+    if(len >= DCACHE_NAME_MAX) return;
+    uint32_t hash = hash_name(parent, name, len);
+    
+    uint32_t flags = irq_save();
+    Dentry* dentry = find(parent, name, len, hash);
+    if(!dentry) {
+        // Reuse the coldest entry
+        dentry = lru_tail;
+        if(dentry->parent) {
+            drop(dentry);
+            stats.evictions++;
+        }
+        dentry->parent = parent;
+        dentry->hash = hash;
+        dentry->len = len;
+        memcpy(dentry->name, name, len);
+        dentry->hash_next = dentry_hash[hash % DCACHE_HASH_SIZE];
+        dentry_hash[hash % DCACHE_HASH_SIZE] = dentry;
+    }
+    dentry->node = node;
+    lru_unlink(dentry);
+    lru_push(dentry);
+    irq_restore(flags);
+}
+
+// A name was created or removed in parent
+void dcache_remove(struct vfs_node* parent, const char* name, uint32_t len) {
+    if(len >= DCACHE_NAME_MAX) return;
+    uint32_t hash = hash_name(parent, name, len);
+    
+    uint32_t flags = irq_save();
+    Dentry* dentry = find(parent, name, len, hash);
+    if(dentry) {
+        drop(dentry);
+    }
+    irq_restore(flags);
+}
+
+// A node is going away: forget it and everything looked up inside it
+void dcache_purge(struct vfs_node* node) {
+    uint32_t flags = irq_save();
+    for(int i = 0; i < DCACHE_ENTRIES; i++) {
+        Dentry* dentry = &dentries[i];
+        if(dentry->parent && (dentry->parent == node || dentry->node == node)) {
+            drop(dentry);
+        }
+    }
+    irq_restore(flags);
+}
+
+void dcache_get_stats(DcacheStats* out) {
+    uint32_t flags = irq_save();
+    *out = stats;
+    irq_restore(flags);
+}
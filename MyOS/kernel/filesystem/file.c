@@ -0,0 +1,314 @@
+// kernel/filesystem/file.c
+// Open files and per-process descriptor tables
+
+#include "../include/filesystem.h"
+#include "../include/kernel.h"
+#include "../include/process.h"
+#include "../include/memory.h"
+
+// Every process starts with the console on stdin, stdout and stderr
+static File console_file = {FILE_CONSOLE, 1, NULL, NULL, 0, O_RDWR, {0, NULL, 0}, {0, 0, 0, 0}};
+
+File* file_alloc(uint32_t type) {
+    File* file = (File*)kmalloc(sizeof(File));
+    if(!file) return NULL;
+    
+    file->type = type;
+    file->refs = 1;
+    file->pipe = NULL;
+    file->node = NULL;
+    file->offset = 0;
+    file->flags = O_RDWR;
+    file->dir.index = 0;
+    file->dir.next = NULL;
+    file->dir.generation = 0;
+    memset(&file->ra, 0, sizeof(file->ra));
+    return file;
+}
+
+File* file_get(File* file) {
+    uint32_t flags = irq_save();
+    file->refs++;
+    irq_restore(flags);
+    return file;
+}
+
+void file_put(File* file) {
+    uint32_t flags = irq_save();
+    int last = --file->refs == 0;
+    irq_restore(flags);
+    if(!last) return;
+    
+    switch(file->type) {
+        case FILE_PIPE_READ:
+            pipe_release(file->pipe, 0);
+            break;
+        case FILE_PIPE_WRITE:
+            pipe_release(file->pipe, 1);
+            break;
+        case FILE_VFS:
+            vfs_node_put(file->node);
+            break;
+    }
+    kfree(file);
+}
+
+static int console_read(char* buf, uint32_t size) {
+    for(uint32_t i = 0; i < size; i++) {
+        buf[i] = getchar();
+        if(buf[i] == 0x04) {
+            return i; // Ctrl+D ends input, so cat and wc can stop
+        }
+        if(buf[i] == '\n') {
+            return i + 1;
+        }
+    }
+    return size;
+}
+
+static int console_write(const char* buf, uint32_t size) {
+    console_write_text(buf, size, CONSOLE_DEFAULT_COLOR);
+    return size;
+}
+
+static int vfs_read(File* file, void* buffer, uint32_t size, uint32_t offset) {
+    if((file->flags & O_ACCMODE) == O_WRONLY) return -1;
+    file_readahead(file, offset, size);
+    return page_cache_read(file->node, offset, size, (char*)buffer);
+}
+
+static int vfs_write(File* file, const void* buffer, uint32_t size, uint32_t offset) {
+    if((file->flags & O_ACCMODE) == O_RDONLY) return -1;
+    return write_file(file->node, offset, size, (char*)buffer);
+}
+
+int file_read(File* file, void* buffer, uint32_t size) {
+    int n;
+    switch(file->type) {
+        case FILE_CONSOLE:
+            return console_read((char*)buffer, size);
+        case FILE_PIPE_READ:
+            return pipe_read(file->pipe, buffer, size);
+        case FILE_VFS:
+            n = vfs_read(file, buffer, size, file->offset);
+            if(n > 0) {
+                file->offset += n;
+            }
+            return n;
+        default:
+            return -1;
+    }
+}
+
+int file_write(File* file, const void* buffer, uint32_t size) {
+    int n;
+    switch(file->type) {
+        case FILE_CONSOLE:
+            return console_write((const char*)buffer, size);
+        case FILE_PIPE_WRITE:
+            return pipe_write(file->pipe, buffer, size);
+        case FILE_VFS:
+            if(file->flags & O_APPEND) {
+                file->offset = get_file_size(file->node);
+            }
+            n = vfs_write(file, buffer, size, file->offset);
+            if(n > 0) {
+                file->offset += n;
+            }
+            return n;
+        default:
+            return -1;
+    }
+}
+
+// Positioned I/O leaves the file offset alone; only files have positions
+int file_pread(File* file, void* buffer, uint32_t size, uint32_t offset) {
+    if(file->type != FILE_VFS) return -1;
+    return vfs_read(file, buffer, size, offset);
+}
+
+int file_pwrite(File* file, const void* buffer, uint32_t size, uint32_t offset) {
+    if(file->type != FILE_VFS) return -1;
+    return vfs_write(file, buffer, size, offset);
+}
+
+// 1 if a read would return at once, with data or at end of input
+int file_readable(File* file) {
+    switch(file->type) {
+        case FILE_CONSOLE:
+            return keyboard_pending();
+        case FILE_PIPE_READ:
+            return file->pipe->count || !file->pipe->writers;
+        case FILE_VFS:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+int file_lseek(File* file, int offset, int whence) {
+    if(file->type != FILE_VFS) return -1;
+    
+    // Directories can only be rewound
+    if(is_directory(file->node)) {
+        if(whence != SEEK_SET || offset != 0) return -1;
+        file->dir.index = 0;
+        file->dir.next = NULL;
+        return 0;
+    }
+    
+    int base;
+    switch(whence) {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = file->offset; break;
+        case SEEK_END: base = get_file_size(file->node); break;
+        default: return -1;
+    }
+    if(base + offset < 0) return -1;
+    
+    file->offset = base + offset;
+    return file->offset;
+}
+
+// Vectored I/O stops at the first short transfer, like a single read would
+int file_readv(File* file, const struct iovec* iov, int iovcnt) {
+    if(iovcnt < 0 || iovcnt > IOV_MAX) return -1;
+    
+    int total = 0;
+    for(int i = 0; i < iovcnt; i++) {
+        int n = file_read(file, iov[i].iov_base, iov[i].iov_len);
+        if(n < 0) return total ? total : -1;
+        total += n;
+        if((uint32_t)n < iov[i].iov_len) break;
+    }
+    return total;
+}
+
+int file_writev(File* file, const struct iovec* iov, int iovcnt) {
+    if(iovcnt < 0 || iovcnt > IOV_MAX) return -1;
+    
+    int total = 0;
+    for(int i = 0; i < iovcnt; i++) {
+        int n = file_write(file, iov[i].iov_base, iov[i].iov_len);
+        if(n < 0) return total ? total : -1;
+        total += n;
+        if((uint32_t)n < iov[i].iov_len) break;
+    }
+    return total;
+}
+
+// Packed struct dirent records, continuing where the last call stopped
+int file_getdents(File* file, void* buffer, uint32_t size) {
+    if(file->type != FILE_VFS) return -1;
+    return read_dir(file->node, &file->dir, (char*)buffer, size);
+}
+
+// Open a file by path. Directories may only be opened for reading.
+File* file_open(const char* path, int flags) {
+    int access = flags & O_ACCMODE;
+    if(!path || access == O_ACCMODE) return NULL;
+    
+    struct vfs_node* node = find_file(path);
+    if(!node) {
+        if(!(flags & O_CREAT)) return NULL;
+        node = create_file_path(path);
+    } else if((flags & O_TRUNC) && access != O_RDONLY) {
+        node = create_file_path(path); // Truncates it
+    }
+    if(!node || (is_directory(node) && access != O_RDONLY)) return NULL;
+    
+    File* file = file_alloc(FILE_VFS);
+    if(!file) return NULL;
+    
+    file->node = vfs_node_get(node);
+    file->flags = flags;
+    return file;
+}
+
+// A new process shares its parent's open files, or gets the console
+void files_init(Process* proc, Process* parent) {
+    uint32_t flags = irq_save();
+    for(int fd = 0; fd < MAX_FDS; fd++) {
+        proc->files[fd] = NULL;
+        if(parent) {
+            if(parent->files[fd]) {
+                proc->files[fd] = parent->files[fd];
+                proc->files[fd]->refs++;
+            }
+        } else if(fd < 3) {
+            proc->files[fd] = &console_file;
+            console_file.refs++;
+        }
+    }
+    irq_restore(flags);
+}
+
+void files_release(Process* proc) {
+    for(int fd = 0; fd < MAX_FDS; fd++) {
+        if(proc->files[fd]) {
+            file_put(proc->files[fd]);
+            proc->files[fd] = NULL;
+        }
+    }
+}
+
+// Lowest free descriptor for file, which now owns the caller's reference
+int fd_install_in(Process* proc, File* file) {
+    uint32_t flags = irq_save();
+    
+    for(int fd = 0; fd < MAX_FDS; fd++) {
+        if(!proc->files[fd]) {
+            proc->files[fd] = file;
+            irq_restore(flags);
+            return fd;
+        }
+    }
+    
+    irq_restore(flags);
+    return -1;
+}
+
+int fd_install(File* file) {
+    return fd_install_in(get_current_process(), file);
+}
+
+File* fd_get(int fd) {
+    Process* proc = get_current_process();
+    if(!proc || fd < 0 || fd >= MAX_FDS) return NULL;
+    return proc->files[fd];
+}
+
+int fd_close(int fd) {
+    File* file = fd_get(fd);
+    if(!file) return -1;
+    
+    get_current_process()->files[fd] = NULL;
+    file_put(file);
+    return 0;
+}
+
+int fd_dup(int fd) {
+    File* file = fd_get(fd);
+    if(!file) return -1;
+    
+    int newfd = fd_install(file_get(file));
+    if(newfd < 0) {
+        file_put(file);
+    }
+    return newfd;
+}
+
+// Make newfd refer to the same open file as fd, closing what it had
+int fd_dup2(int fd, int newfd) {
+    File* file = fd_get(fd);
+    if(!file || newfd < 0 || newfd >= MAX_FDS) return -1;
+    if(fd == newfd) return newfd;
+    
+    Process* proc = get_current_process();
+    File* old = proc->files[newfd];
+    proc->files[newfd] = file_get(file);
+    if(old) {
+        file_put(old);
+    }
+    return newfd;
+}
@@ -0,0 +1,101 @@
+// kernel/filesystem/page_tree.c
+// Radix tree of 4 KB pages holding an in-memory file's data
+
+#include "../include/kernel.h"
+#include "../include/memory.h"
+#include "../include/filesystem.h"
+
+#define PAGE_TREE_MASK (PAGE_TREE_SLOTS - 1)
+
+// Pages a tree of this height can index
+static uint32_t capacity(uint32_t height) {
+    return height ? 1u << (height * PAGE_TREE_SHIFT) : 0;
+}
+
+static void** alloc_slots(void) {
+    void** slots = (void**)kmalloc(PAGE_TREE_SLOTS * sizeof(void*));
+    if(slots) {
+        memset(slots, 0, PAGE_TREE_SLOTS * sizeof(void*));
+    }
+    return slots;
+}
+
+void page_tree_init(PageTree* tree) {
+    tree->root = NULL;
+    tree->height = 0;
+}
+
+// The page at index, NULL for a hole
+char* page_tree_lookup(PageTree* tree, uint32_t index) {
+    if(index >= capacity(tree->height)) return NULL;
+    
+    void** slots = (void**)tree->root;
+    for(uint32_t level = tree->height; level > 1 && slots; level--) {
+        slots = (void**)slots[(index >> ((level - 1) * PAGE_TREE_SHIFT)) & PAGE_TREE_MASK];
+    }
+    return slots ? (char*)slots[index & PAGE_TREE_MASK] : NULL;
+}
+
+// The page at index, a zeroed one is added if it is a hole. NULL if out of memory.
+char* page_tree_get(PageTree* tree, uint32_t index) {
+    // Grow upwards until index fits, the old root becomes slot 0
+    while(index >= capacity(tree->height)) {
+        if(tree->height && tree->root) {
+            void** root = alloc_slots();
+            if(!root) return NULL;
+            root[0] = tree->root;
+            tree->root = root;
+        }
+        tree->height++;
+    }
+    
+    void** slot = &tree->root;
+    for(uint32_t level = tree->height; level > 0; level--) {
+        if(!*slot) {
+            *slot = alloc_slots();
+            if(!*slot) return NULL;
+        }
+        slot = &((void**)*slot)[(index >> ((level - 1) * PAGE_TREE_SHIFT)) & PAGE_TREE_MASK];
+    }
+    
+    if(!*slot) {
+        char* page = (char*)kmalloc(PAGE_SIZE);
+        if(!page) return NULL;
+        memset(page, 0, PAGE_SIZE);
+        *slot = page;
+    }
+    return (char*)*slot;
+}
+
+// Free what slots covers from page first on; base is its first page
+static void truncate_slots(void** slots, uint32_t level, uint32_t base, uint32_t first) {
+    uint32_t span = 1u << ((level - 1) * PAGE_TREE_SHIFT);
+    
+    for(uint32_t i = 0; i < PAGE_TREE_SLOTS; i++) {
+        uint32_t start = base + i * span;
+        if(!slots[i] || start + span <= first) continue;
+        
+        if(level == 1) {
+            kfree(slots[i]);
+            slots[i] = NULL;
+        } else if(start >= first) {
+            truncate_slots((void**)slots[i], level - 1, start, 0);
+            kfree(slots[i]);
+            slots[i] = NULL;
+        } else {
+            truncate_slots((void**)slots[i], level - 1, start, first);
+        }
+    }
+}
+
+// Drop every page from first on, the whole tree when first is 0
+void page_tree_truncate(PageTree* tree, uint32_t first) {
+    if(!tree->root || first >= capacity(tree->height)) return;
+    
+    truncate_slots((void**)tree->root, tree->height, 0, first);
+    if(first == 0) {
+        kfree(tree->root);
+        tree->root = NULL;
+        tree->height = 0;
+    }
+}
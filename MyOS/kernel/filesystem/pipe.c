@@ -0,0 +1,203 @@
+// kernel/filesystem/pipe.c
+// Pipes built from a ring of page buffers
+
+#include "../include/filesystem.h"
+#include "../include/kernel.h"
+#include "../include/process.h"
+#include "../include/memory.h"
+
+int pipe_create(File** read_end, File** write_end) {
+    Pipe* pipe = (Pipe*)kmalloc(sizeof(Pipe));
+    File* reader = file_alloc(FILE_PIPE_READ);
+    File* writer = file_alloc(FILE_PIPE_WRITE);
+    
+    if(!pipe || !reader || !writer) {
+        if(pipe) kfree(pipe);
+        if(reader) kfree(reader);
+        if(writer) kfree(writer);
+        return -1;
+    }
+    
+    memset(pipe, 0, sizeof(Pipe));
+    wait_queue_init(&pipe->read_wait);
+    wait_queue_init(&pipe->write_wait);
+    pipe->readers = 1;
+    pipe->writers = 1;
+    
+    reader->pipe = pipe;
+    writer->pipe = pipe;
+    *read_end = reader;
+    *write_end = writer;
+    return 0;
+}
+
+static char* page_get(Pipe* pipe) {
+    char* page = pipe->spare;
+    if(page) {
+        pipe->spare = NULL;
+        return page;
+    }
+    return (char*)alloc_pages(1);
+}
+
+static void page_put(Pipe* pipe, char* page) {
+    if(!pipe->spare) {
+        pipe->spare = page;
+    } else {
+        free_pages(page, 1);
+    }
+}
+
+static PipeBuffer* pipe_tail(Pipe* pipe) {
+    return &pipe->bufs[(pipe->head + pipe->count - 1) % PIPE_BUFFERS];
+}
+
+// Append an empty buffer for page (interrupts disabled, ring not full)
+static void pipe_push(Pipe* pipe, char* page, uint32_t length) {
+    PipeBuffer* buf = &pipe->bufs[(pipe->head + pipe->count) % PIPE_BUFFERS];
+    buf->page = page;
+    buf->offset = 0;
+    buf->length = length;
+    pipe->count++;
+}
+
+// Blocks until there is data, returns 0 once empty with no writers left
+int pipe_read(Pipe* pipe, void* buffer, uint32_t size) {
+    char* out = (char*)buffer;
+    uint32_t done = 0;
+    uint32_t flags = irq_save();
+    
+    while(!pipe->count) {
+        if(!pipe->writers) {
+            irq_restore(flags);
+            return 0;
+        }
+        sleep_on(&pipe->read_wait);
+    }
+    
+    while(done < size && pipe->count) {
+        PipeBuffer* buf = &pipe->bufs[pipe->head];
+        uint32_t n = buf->length < size - done ? buf->length : size - done;
+        
+        memcpy(out + done, buf->page + buf->offset, n);
+        buf->offset += n;
+        buf->length -= n;
+        done += n;
+        
+        if(!buf->length) {
+            page_put(pipe, buf->page);
+            buf->page = NULL;
+            pipe->head = (pipe->head + 1) % PIPE_BUFFERS;
+            pipe->count--;
+        }
+    }
+    
+    wake_up_all(&pipe->write_wait);
+    irq_restore(flags);
+    check_preempt();
+    return done;
+}
+
+// Blocks while the ring is full. Returns bytes written, -1 if there are
+// no readers left or no memory before anything was written.
+int pipe_write(Pipe* pipe, const void* buffer, uint32_t size) {
+    if(!size) return 0;
+    
+    const char* in = (const char*)buffer;
+    uint32_t done = 0;
+    uint32_t flags = irq_save();
+    
+    while(done < size) {
+        if(!pipe->readers) break;
+        
+        // Top up the last page before starting another
+        if(pipe->count) {
+            PipeBuffer* tail = pipe_tail(pipe);
+            uint32_t end = tail->offset + tail->length;
+            if(end < PAGE_SIZE) {
+                uint32_t n = PAGE_SIZE - end < size - done ? PAGE_SIZE - end : size - done;
+                memcpy(tail->page + end, in + done, n);
+                tail->length += n;
+                done += n;
+                continue;
+            }
+        }
+        
+        if(pipe->count == PIPE_BUFFERS) {
+            wake_up_all(&pipe->read_wait);
+            sleep_on(&pipe->write_wait);
+            continue;
+        }
+        
+        char* page = page_get(pipe);
+        if(!page) break;
+        pipe_push(pipe, page, 0);
+    }
+    
+    wake_up_all(&pipe->read_wait);
+    irq_restore(flags);
+    check_preempt();
+    return done ? (int)done : -1;
+}
+
+// Splice whole pages from ipc_alloc_buffer() into the pipe without copying.
+// Pages that went in are no longer the caller's; returns the bytes moved,
+// -1 if none could be because there are no readers or no memory.
+int pipe_gift(Pipe* pipe, void* pages, uint32_t length) {
+    if(!length) return 0;
+    
+    uint32_t base = (uint32_t)pages;
+    if((base & (PAGE_SIZE - 1)) || !is_vmap_addr(base) || length % PAGE_SIZE) {
+        return -1;
+    }
+    
+    uint32_t npages = length / PAGE_SIZE;
+    uint32_t done = 0;
+    uint32_t flags = irq_save();
+    
+    while(done < npages && pipe->readers) {
+        if(pipe->count == PIPE_BUFFERS) {
+            wake_up_all(&pipe->read_wait);
+            sleep_on(&pipe->write_wait);
+            continue;
+        }
+        
+        char* page = (char*)move_pages((void*)(base + done * PAGE_SIZE), 1);
+        if(!page) break;
+        pipe_push(pipe, page, PAGE_SIZE);
+        done++;
+    }
+    
+    wake_up_all(&pipe->read_wait);
+    irq_restore(flags);
+    check_preempt();
+    return done ? (int)(done * PAGE_SIZE) : -1;
+}
+
+// Drop one end, the pipe goes once both are closed
+void pipe_release(Pipe* pipe, int writer) {
+    uint32_t flags = irq_save();
+    
+    // Wake the other side so it sees EOF or a broken pipe
+    if(writer) {
+        pipe->writers--;
+        wake_up_all(&pipe->read_wait);
+    } else {
+        pipe->readers--;
+        wake_up_all(&pipe->write_wait);
+    }
+    
+    int last = !pipe->readers && !pipe->writers;
+    irq_restore(flags);
+    if(!last) return;
+    
+    while(pipe->count) {
+        free_pages(pipe->bufs[pipe->head].page, 1);
+        pipe->head = (pipe->head + 1) % PIPE_BUFFERS;
+        pipe->count--;
+    }
+    if(pipe->spare) {
+        free_pages(pipe->spare, 1);
+    }
+    kfree(pipe);
+}
@@ -0,0 +1,73 @@
+// kernel/filesystem/readahead.c
+// Per-file readahead window for sequential readers
+
+#include "../include/kernel.h"
+#include "../include/memory.h"
+#include "../include/filesystem.h"
+
+typedef struct {
+    struct vfs_node* node;
+    uint32_t first;
+    uint32_t count;
+} ReadaheadRequest;
+
+static void run_readahead(void* data) {
+    ReadaheadRequest* req = (ReadaheadRequest*)data;
+    page_cache_readahead(req->node, req->first, req->count);
+    vfs_node_put(req->node);
+    kfree(req);
+}
+
+// Read pages in on a worker, the node is held until it is done
+static void start_readahead(struct vfs_node* node, uint32_t first, uint32_t count) {
+    ReadaheadRequest* req = (ReadaheadRequest*)kmalloc(sizeof(ReadaheadRequest));
+    if(!req) return;
+    
+    req->node = vfs_node_get(node);
+    req->first = first;
+    req->count = count;
+    if(queue_work_fn(run_readahead, req) != 0) {
+        vfs_node_put(node);
+        kfree(req);
+    }
+}
+
+// read() is about to read size bytes at offset. A read that starts where
+// the last one ended continues a stream: once it reaches the window read
+// ahead last time, the next one, twice as large, is started behind it.
+// Any other read ends the stream and halves the window.
+void file_readahead(File* file, uint32_t offset, uint32_t size) {
+    if(!size || offset >= get_file_size(file->node)) return;
+    
+    FileReadahead* ra = &file->ra;
+    uint32_t last = (offset + size - 1) / PAGE_SIZE;
+    uint32_t first = 0;
+    uint32_t count = 0;
+    
+    uint32_t flags = irq_save();
+    int sequential = offset == ra->prev_end;
+    ra->prev_end = offset + size;
+    
+    if(!sequential) {
+        ra->size /= 2;
+        ra->next = 0;
+    } else if(!ra->next || ra->next <= last) {
+        // New stream, or the reader got past everything read ahead
+        if(ra->size < RA_MIN_PAGES) ra->size = RA_MIN_PAGES;
+        first = last + 1;
+        count = ra->size;
+        ra->trigger = first;
+        ra->next = first + count;
+    } else if(last >= ra->trigger) {
+        ra->size = ra->size * 2 > RA_MAX_PAGES ? RA_MAX_PAGES : ra->size * 2;
+        first = ra->next;
+        count = ra->size;
+        ra->trigger = first;
+        ra->next = first + count;
+    }
+    irq_restore(flags);
+    
+    if(count) {
+        start_readahead(file->node, first, count);
+    }
+}
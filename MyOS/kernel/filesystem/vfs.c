@@ -4,8 +4,9 @@
 #include "../include/filesystem.h"
 #include "../include/memory.h"
 #include "../include/kernel.h"
+#include "../include/process.h"
 
-#define MAX_FILES 1024
+#define INODE_FREE_MAX 64     // Released nodes kept for reuse
 #define MAX_PATH_LENGTH 256
 #define MAX_FILENAME_LENGTH 64
 
@@ -25,10 +26,12 @@ typedef struct vfs_node {
     unsigned int permissions;
     unsigned int size;
     unsigned int inode;
+    unsigned int refs;        // Its directory entry plus open files
+    unsigned int generation;  // Directories: bumped when an entry is removed
     struct vfs_node* parent;
     struct vfs_node* children;
     struct vfs_node* next;
-    void* data;
+    PageTree pages;           // Regular file data, holes read as zeroes
     
     // Function pointers for operations
     int (*read)(struct vfs_node* node, unsigned int offset, unsigned int size, char* buffer);
@@ -37,13 +40,16 @@ typedef struct vfs_node {
     int (*close)(struct vfs_node* node);
     struct vfs_node* (*readdir)(struct vfs_node* node, unsigned int index);
     struct vfs_node* (*finddir)(struct vfs_node* node, char* name);
+    int (*getdents)(struct vfs_node* node, DirCursor* cursor, char* buffer, unsigned int size);
 } VFSNode;
 
 typedef struct {
     VFSNode* root;
     VFSNode* current_dir;
-    VFSNode nodes[MAX_FILES];
-    int node_count;
+    VFSNode* free_nodes;      // Released nodes, linked through next
+    int free_count;
+    int node_count;           // Nodes in use
+    unsigned int next_inode;
 } VFSManager;
 
 // Global VFS manager
@@ -65,6 +71,13 @@ int move_file(const char* src, const char* dest);
 char** list_directory(const char* path);
 int change_directory(const char* path);
 char* get_current_directory(void);
+VFSNode* create_file_path(const char* path);
+VFSNode* create_directory_path(const char* path);
+VFSNode* vfs_node_get(VFSNode* node);
+void vfs_node_put(VFSNode* node);
+unsigned int get_file_size(VFSNode* node);
+int is_directory(VFSNode* node);
+int read_dir(VFSNode* dir, DirCursor* cursor, char* buffer, unsigned int size);
 
 // Default file operations
 int default_read(VFSNode* node, unsigned int offset, unsigned int size, char* buffer);
@@ -73,34 +86,27 @@ int default_open(VFSNode* node);
 int default_close(VFSNode* node);
 VFSNode* default_readdir(VFSNode* node, unsigned int index);
 VFSNode* default_finddir(VFSNode* node, char* name);
+int default_getdents(VFSNode* node, DirCursor* cursor, char* buffer, unsigned int size);
 
 void init_vfs(void) {
     vfs.node_count = 0;
     vfs.root = NULL;
     vfs.current_dir = NULL;
-    
-    // Clear node array
-    for(int i = 0; i < MAX_FILES; i++) {
-        vfs.nodes[i].name[0] = '\0';
-        vfs.nodes[i].type = 0;
-        vfs.nodes[i].size = 0;
-        vfs.nodes[i].inode = 0;
-        vfs.nodes[i].parent = NULL;
-        vfs.nodes[i].children = NULL;
-        vfs.nodes[i].next = NULL;
-        vfs.nodes[i].data = NULL;
-    }
+    vfs.free_nodes = NULL;
+    vfs.free_count = 0;
+    vfs.next_inode = 0;
+    init_dcache();
 }
 
 void mount_root_fs(void) {
     // Create root directory
     vfs.root = create_directory("/");
-    vfs.current_dir = vfs.root;
     
     if(!vfs.root) {
         print("Failed to create root directory!\n");
         return;
     }
+    vfs.current_dir = vfs_node_get(vfs.root);
 }
 
 void create_system_dirs(void) {
@@ -123,38 +129,127 @@ void create_system_dirs(void) {
     VFSNode* readme = create_file("README.txt", FILE_TYPE_REGULAR);
     if(readme) {
         char* content = "Welcome to MyOS!\n\nThis is a simple operating system built from scratch.\n";
-        readme->data = malloc(strlen(content) + 1);
-        strcpy((char*)readme->data, content);
-        readme->size = strlen(content);
+        default_write(readme, 0, strlen(content), content);
         add_child(vfs.root, readme);
     }
     
     VFSNode* version = create_file("version.txt", FILE_TYPE_REGULAR);
     if(version) {
         char* content = "MyOS v1.0\nBuild: 2025-07-01\n";
-        version->data = malloc(strlen(content) + 1);
-        strcpy((char*)version->data, content);
-        version->size = strlen(content);
+        default_write(version, 0, strlen(content), content);
         add_child(vfs.root, version);
     }
 }
 
+// A released node if there is one, otherwise a new one from the heap
+static VFSNode* alloc_node(void) {
+    uint32_t flags = irq_save();
+    VFSNode* node = vfs.free_nodes;
+    if(node) {
+        vfs.free_nodes = node->next;
+        vfs.free_count--;
+    }
+    irq_restore(flags);
+    
+    if(!node) {
+        node = (VFSNode*)kmalloc(sizeof(VFSNode));
+        if(!node) {
+            return NULL;
+        }
+    }
+    
+    flags = irq_save();
+    vfs.node_count++;
+    node->inode = ++vfs.next_inode;
+    irq_restore(flags);
+    return node;
+}
+
+static void free_page_tree(void* data) {
+    PageTree* pages = (PageTree*)data;
+    page_tree_truncate(pages, 0);
+    kfree(pages);
+}
+
+// The last reference is gone, so the node is no longer in any directory
+static void release_node(VFSNode* node) {
+    page_cache_invalidate(node);
+    
+    // Lookups in a deleted working directory still cached names under it,
+    // a node reused at this address must not find them
+    if(node->type == FILE_TYPE_DIRECTORY) {
+        dcache_purge(node);
+    }
+    
+    // Free data on a worker thread, inline if that fails
+    if(node->pages.root) {
+        PageTree* pages = (PageTree*)kmalloc(sizeof(PageTree));
+        if(pages) {
+            *pages = node->pages;
+            if(queue_work_fn(free_page_tree, pages) != 0) {
+                free_page_tree(pages);
+            }
+        } else {
+            page_tree_truncate(&node->pages, 0);
+        }
+    }
+    
+    // Clear node
+    node->name[0] = '\0';
+    node->type = 0;
+    node->size = 0;
+    page_tree_init(&node->pages);
+    
+    uint32_t flags = irq_save();
+    vfs.node_count--;
+    if(vfs.free_count < INODE_FREE_MAX) {
+        node->next = vfs.free_nodes;
+        vfs.free_nodes = node;
+        vfs.free_count++;
+        node = NULL;
+    }
+    irq_restore(flags);
+    
+    if(node) {
+        kfree(node);
+    }
+}
+
+VFSNode* vfs_node_get(VFSNode* node) {
+    uint32_t flags = irq_save();
+    node->refs++;
+    irq_restore(flags);
+    return node;
+}
+
+void vfs_node_put(VFSNode* node) {
+    uint32_t flags = irq_save();
+    int last = --node->refs == 0;
+    irq_restore(flags);
+    
+    if(last) {
+        release_node(node);
+    }
+}
+
+// The new node's reference belongs to the directory it is added to
 VFSNode* create_file(const char* name, unsigned int type) {
-    if(vfs.node_count >= MAX_FILES) {
+    VFSNode* node = alloc_node();
+    if(!node) {
         return NULL;
     }
     
-    VFSNode* node = &vfs.nodes[vfs.node_count++];
     strncpy(node->name, name, MAX_FILENAME_LENGTH - 1);
     node->name[MAX_FILENAME_LENGTH - 1] = '\0';
     node->type = type;
     node->permissions = PERM_READ | PERM_WRITE;
     node->size = 0;
-    node->inode = vfs.node_count;
+    node->refs = 1;
+    node->generation = 0;
     node->parent = NULL;
     node->children = NULL;
     node->next = NULL;
-    node->data = NULL;
+    page_tree_init(&node->pages);
     
     // Set default operations
     node->read = default_read;
@@ -163,6 +258,7 @@ VFSNode* create_file(const char* name, unsigned int type) {
     node->close = default_close;
     node->readdir = default_readdir;
     node->finddir = default_finddir;
+    node->getdents = default_getdents;
     
     return node;
 }
@@ -176,56 +272,90 @@ int add_child(VFSNode* parent, VFSNode* child) {
         return -1;
     }
     
+    // A deleted directory (the working directory can be one) stays empty
+    uint32_t flags = irq_save();
+    if(parent != vfs.root && !parent->parent) {
+        irq_restore(flags);
+        return -1;
+    }
+    
     child->parent = parent;
     child->next = parent->children;
     parent->children = child;
     
+    // Replaces a cached miss for the name
+    dcache_add(parent, child->name, strlen(child->name), child);
+    irq_restore(flags);
+    
     return 0;
 }
 
-VFSNode* find_file(const char* path) {
-    if(!path || path[0] == '\0') {
-        return NULL;
+// Look a name up in a directory, through the dentry cache
+static VFSNode* lookup_child(VFSNode* dir, const char* name, unsigned int len) {
+    VFSNode* child;
+    if(dcache_lookup(dir, name, len, &child) != DCACHE_MISS) {
+        return child; // NULL for a cached miss
     }
     
-    VFSNode* current = (path[0] == '/') ? vfs.root : vfs.current_dir;
-    
-    if(strcmp(path, "/") == 0) {
-        return vfs.root;
+    // Search with interrupts off so a create or delete cannot slip in
+    // between the search and caching its result
+    uint32_t flags = irq_save();
+    child = dir->children;
+    while(child && !(strncmp(child->name, name, len) == 0 && child->name[len] == '\0')) {
+        child = child->next;
     }
+    dcache_add(dir, name, len, child);
+    irq_restore(flags);
     
-    char path_copy[MAX_PATH_LENGTH];
-    strncpy(path_copy, path, MAX_PATH_LENGTH - 1);
-    path_copy[MAX_PATH_LENGTH - 1] = '\0';
-    
-    // Skip leading slash
-    char* token = strtok((path[0] == '/') ? path_copy + 1 : path_copy, "/");
-    
-    while(token && current) {
-        if(strcmp(token, ".") == 0) {
+    return child;
+}
+
+// Resolve the first len bytes of path. Components are compared in place and
+// there is no hidden state, so walks may run concurrently.
+static VFSNode* walk_path(const char* path, unsigned int len) {
+    const char* end = path + len;
+    const char* p = path;
+    VFSNode* current = (len && path[0] == '/') ? vfs.root : vfs.current_dir;
+    
+    while(current) {
+        while(p < end && *p == '/') {
+            p++;
+        }
+        if(p == end) {
+            break;
+        }
+        
+        const char* name = p;
+        while(p < end && *p != '/') {
+            p++;
+        }
+        unsigned int name_len = p - name;
+        
+        if(name_len == 1 && name[0] == '.') {
             // Current directory - do nothing
-        } else if(strcmp(token, "..") == 0) {
+        } else if(name_len == 2 && name[0] == '.' && name[1] == '.') {
             // Parent directory
             if(current->parent) {
                 current = current->parent;
             }
+        } else if(current->type != FILE_TYPE_DIRECTORY) {
+            return NULL;
         } else {
-            // Find child with matching name
-            VFSNode* child = current->children;
-            while(child) {
-                if(strcmp(child->name, token) == 0) {
-                    break;
-                }
-                child = child->next;
-            }
-            current = child;
+            current = lookup_child(current, name, name_len);
         }
-        token = strtok(NULL, "/");
     }
     
     return current;
 }
 
+VFSNode* find_file(const char* path) {
+    if(!path || path[0] == '\0') {
+        return NULL;
+    }
+    
+    return walk_path(path, strlen(path));
+}
+
 int read_file(VFSNode* node, unsigned int offset, unsigned int size, char* buffer) {
     if(!node || !buffer || node->type != FILE_TYPE_REGULAR) {
         return -1;
@@ -239,7 +369,11 @@ int write_file(VFSNode* node, unsigned int offset, unsigned int size, char* buff
         return -1;
     }
     
-    return node->write(node, offset, size, buffer);
+    int written = node->write(node, offset, size, buffer);
+    if(written > 0) {
+        page_cache_update(node, offset, written, buffer);
+    }
+    return written;
 }
 
 int delete_file(const char* path) {
@@ -248,6 +382,11 @@ int delete_file(const char* path) {
         return -1;
     }
     
+    // A directory must be empty, its children would be left without a parent
+    if(node->children) {
+        return -1;
+    }
+    
     // Remove from parent's children list
     VFSNode* parent = node->parent;
     if(parent->children == node) {
@@ -262,17 +401,14 @@ int delete_file(const char* path) {
         }
     }
     
-    // Free data
-    if(node->data) {
-        free(node->data);
-    }
-    
-    // Clear node
-    node->name[0] = '\0';
-    node->type = 0;
-    node->size = 0;
-    node->data = NULL;
+    // A directory's own entries go when it is released
+    parent->generation++;
+    node->parent = NULL;
+    node->next = NULL;
+    dcache_remove(parent, node->name, strlen(node->name));
     
+    // Open files keep the node and its data until they are closed
+    vfs_node_put(node);
     return 0;
 }
 
@@ -308,13 +444,28 @@ char** list_directory(const char* path) {
     return list;
 }
 
+// Fill buffer with packed entries from the cursor on. Returns the bytes
+// used, 0 at the end, -1 if not a directory or the next entry does not fit.
+int read_dir(VFSNode* dir, DirCursor* cursor, char* buffer, unsigned int size) {
+    if(!dir || !buffer || dir->type != FILE_TYPE_DIRECTORY) {
+        return -1;
+    }
+    
+    return dir->getdents(dir, cursor, buffer, size);
+}
+
 int change_directory(const char* path) {
     VFSNode* dir = find_file(path);
     if(!dir || dir->type != FILE_TYPE_DIRECTORY) {
         return -1;
     }
     
-    vfs.current_dir = dir;
+    // The working directory stays valid even if it is deleted
+    VFSNode* old = vfs.current_dir;
+    vfs.current_dir = vfs_node_get(dir);
+    if(old) {
+        vfs_node_put(old);
+    }
     return 0;
 }
 
@@ -351,32 +502,134 @@ char* get_current_directory(void) {
     return path;
 }
 
+// New node named by the last component of path, added to its directory
+static VFSNode* create_in_parent(const char* path, unsigned int type) {
+    const char* name = NULL;
+    for(const char* p = path; *p; p++) {
+        if(*p == '/') name = p;
+    }
+    VFSNode* dir = vfs.current_dir;
+    if(name) {
+        dir = name > path ? walk_path(path, name - path) : vfs.root;
+        name++;
+    } else {
+        name = path;
+    }
+    
+    if(!dir || dir->type != FILE_TYPE_DIRECTORY || name[0] == '\0') {
+        return NULL;
+    }
+    
+    VFSNode* node = create_file(name, type);
+    if(node && add_child(dir, node) != 0) {
+        vfs_node_put(node);
+        return NULL;
+    }
+    return node;
+}
+
+// Shorten a file, whole pages past the new end are freed
+static void truncate_data(VFSNode* node, unsigned int size) {
+    if(size >= node->size) {
+        return;
+    }
+    
+    page_tree_truncate(&node->pages, (size + PAGE_SIZE - 1) / PAGE_SIZE);
+    
+    // The rest of the last page must read as zeroes if the file grows again
+    char* page = size % PAGE_SIZE ? page_tree_lookup(&node->pages, size / PAGE_SIZE) : NULL;
+    if(page) {
+        memset(page + size % PAGE_SIZE, 0, PAGE_SIZE - size % PAGE_SIZE);
+    }
+    node->size = size;
+    page_cache_invalidate(node);
+}
+
+// Empty regular file at path, created in its directory or truncated
+VFSNode* create_file_path(const char* path) {
+    VFSNode* node = find_file(path);
+    if(node) {
+        if(node->type != FILE_TYPE_REGULAR) {
+            return NULL;
+        }
+        truncate_data(node, 0);
+        return node;
+    }
+    
+    return create_in_parent(path, FILE_TYPE_REGULAR);
+}
+
+// Directory at path, created in its parent unless it already exists
+VFSNode* create_directory_path(const char* path) {
+    VFSNode* node = find_file(path);
+    if(node) {
+        return node->type == FILE_TYPE_DIRECTORY ? node : NULL;
+    }
+    
+    return create_in_parent(path, FILE_TYPE_DIRECTORY);
+}
+
+unsigned int get_file_size(VFSNode* node) {
+    return node ? node->size : 0;
+}
+
+int is_directory(VFSNode* node) {
+    return node && node->type == FILE_TYPE_DIRECTORY;
+}
+
 // Default file operations
+// Only the pages the range touches are copied
 int default_read(VFSNode* node, unsigned int offset, unsigned int size, char* buffer) {
-    if(!node->data || offset >= node->size) {
+    if(offset >= node->size) {
         return 0;
     }
     
-    unsigned int bytes_to_read = (offset + size > node->size) ? 
+    unsigned int bytes_to_read = (size > node->size - offset) ? 
                                  (node->size - offset) : size;
     
-    memcpy(buffer, (char*)node->data + offset, bytes_to_read);
+    unsigned int done = 0;
+    while(done < bytes_to_read) {
+        unsigned int pos = offset + done;
+        unsigned int in_page = pos % PAGE_SIZE;
+        unsigned int chunk = PAGE_SIZE - in_page;
+        if(chunk > bytes_to_read - done) {
+            chunk = bytes_to_read - done;
+        }
+        
+        char* page = page_tree_lookup(&node->pages, pos / PAGE_SIZE);
+        if(page) {
+            memcpy(buffer + done, page + in_page, chunk);
+        } else {
+            memset(buffer + done, 0, chunk); // A hole
+        }
+        done += chunk;
+    }
     return bytes_to_read;
 }
 
+// Pages are added as the file grows, nothing already written is copied
 int default_write(VFSNode* node, unsigned int offset, unsigned int size, char* buffer) {
-    if(offset + size > node->size) {
-        // Resize data buffer
-        void* new_data = realloc(node->data, offset + size);
-        if(!new_data) {
-            return -1;
+    unsigned int done = 0;
+    while(done < size) {
+        unsigned int pos = offset + done;
+        unsigned int in_page = pos % PAGE_SIZE;
+        unsigned int chunk = PAGE_SIZE - in_page;
+        if(chunk > size - done) {
+            chunk = size - done;
+        }
+        
+        char* page = page_tree_get(&node->pages, pos / PAGE_SIZE);
+        if(!page) {
+            break; // Out of memory
         }
-        node->data = new_data;
-        node->size = offset + size;
+        memcpy(page + in_page, buffer + done, chunk);
+        done += chunk;
     }
     
-    memcpy((char*)node->data + offset, buffer, size);
-    return size;
+    if(offset + done > node->size) {
+        node->size = offset + done;
+    }
+    return (done || !size) ? (int)done : -1;
 }
 
 int default_open(VFSNode* node) {
@@ -405,13 +658,48 @@ VFSNode* default_finddir(VFSNode* node, char* name) {
         return NULL;
     }
     
-    VFSNode* child = node->children;
+    return lookup_child(node, name, strlen(name));
+}
+
+int default_getdents(VFSNode* node, DirCursor* cursor, char* buffer, unsigned int size) {
+    uint32_t flags = irq_save();
+    
+    // The saved position is only good if no entry was removed since
+    VFSNode* child;
+    if(cursor->index == 0) {
+        child = node->children;
+    } else if(cursor->generation == node->generation) {
+        child = cursor->next;
+    } else {
+        child = node->children;
+        for(unsigned int i = 0; i < cursor->index && child; i++) {
+            child = child->next;
+        }
+    }
+    
+    unsigned int used = 0;
     while(child) {
-        if(strcmp(child->name, name) == 0) {
-            return child;
+        unsigned int name_len = strlen(child->name);
+        unsigned int reclen = (sizeof(struct dirent) + name_len + 1 + 3) & ~3;
+        if(used + reclen > size) {
+            break;
         }
+        
+        struct dirent* entry = (struct dirent*)(buffer + used);
+        entry->d_ino = child->inode;
+        entry->d_reclen = reclen;
+        entry->d_type = child->type;
+        entry->d_namlen = name_len;
+        memcpy(entry->d_name, child->name, name_len + 1);
+        
+        used += reclen;
+        cursor->index++;
         child = child->next;
     }
     
-    return NULL;
+    cursor->next = child;
+    cursor->generation = node->generation;
+    irq_restore(flags);
+    
+    return (child && used == 0) ? -1 : (int)used;
 }
\ No newline at end of file
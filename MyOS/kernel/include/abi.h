@@ -0,0 +1,60 @@
+// kernel/include/abi.h
+// Flags and structures shared by the kernel and userspace programs
+
+#ifndef ABI_H
+#define ABI_H
+
+// Userspace includes this without kernel.h, so only plain C types here
+
+// Flags for open()
+#define O_RDONLY 0x0000
+#define O_WRONLY 0x0001
+#define O_RDWR 0x0002
+#define O_ACCMODE 0x0003
+#define O_CREAT 0x0040
+#define O_TRUNC 0x0200
+#define O_APPEND 0x0400
+
+// Whence for lseek()
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
+#define IOV_MAX 16
+
+struct iovec {
+    void* iov_base;
+    unsigned int iov_len;
+};
+
+// Directory entries from getdents(), packed one after another
+#define DT_UNKNOWN 0
+#define DT_REG 1
+#define DT_DIR 2
+#define DT_DEV 3
+
+struct dirent {
+    unsigned int d_ino;
+    unsigned short d_reclen;  // Bytes from this entry to the next
+    unsigned char d_type;     // DT_*
+    unsigned char d_namlen;
+    char d_name[];            // NUL-terminated
+};
+
+// Memory mappings
+#define PROT_NONE 0x0
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+
+#define MAP_SHARED 0x01      // File pages are the page cache's own frames
+#define MAP_PRIVATE 0x02     // A copy, stores never reach the file
+#define MAP_FIXED 0x10       // Not supported
+#define MAP_ANONYMOUS 0x20
+#define MAP_FAILED ((void*)-1)
+
+#define MS_ASYNC 0x1         // Only note which pages were stored to
+#define MS_INVALIDATE 0x2
+#define MS_SYNC 0x4          // Write stored-to pages back to the file
+
+#endif
@@ -27,12 +27,20 @@ typedef enum { false = 0, true = 1 } bool;
 void kernel_main(void);
 void print(const char* str);
 void print_colored(const char* str, int color);
+void console_write_text(const char* buf, uint32_t size, int color);
+#define CONSOLE_DEFAULT_COLOR 15   // White on black
 void clear_screen(void);
 void outb(unsigned short port, unsigned char val);
 unsigned char inb(unsigned short port);
 
-// System call interface
+// System call interface, syscall() picks the fastest entry available
 int syscall(int num, int arg1, int arg2, int arg3);
+int syscall_int80(int num, int arg1, int arg2, int arg3);
+int syscall_sysenter(int num, int arg1, int arg2, int arg3);
+int syscall_handler(int num, int arg1, int arg2, int arg3);
+const char* syscall_path_name(void);
+int sysenter_supported(void);
+void init_sysenter(void);
 
 // Process management
 void schedule_processes(void);
@@ -42,6 +50,54 @@ void update_gui(void);
 // Memory functions
 void* kmalloc_early(unsigned int size);
 
+// Timer functions
+void timer_callback(void);
+unsigned int get_timer_ticks(void);
+unsigned int get_uptime_seconds(void);
+void sleep(unsigned int ms);
+uint32_t tsc_cycles_per_ms(void);
+uint32_t ms_to_ticks(uint32_t ms);
+
+// Keyboard input
+int keyboard_pending(void);
+
+// ATA disks: dev 0 is the primary master, dev 1 the primary slave
+#define DISK_SECTOR_SIZE 512
+int disk_read(uint32_t dev, uint32_t lba, uint32_t count, void* buffer);
+int disk_write(uint32_t dev, uint32_t lba, uint32_t count, const void* buffer);
+
+// CPU helpers
+#define NR_CPUS 1
+
+static inline int cpu_id(void) {
+    return 0; // Uniprocessor for now
+}
+
+// Save EFLAGS and disable interrupts
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// Restore the interrupt flag saved by irq_save()
+static inline void irq_restore(uint32_t flags) {
+    asm volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+// Segments
+#define GDT_TLS_SELECTOR 0x2B  // GS, its base follows the running thread's TLS
+
+void init_gdt(void);
+void set_tls_base(uint32_t base);
+
+// Read the CPU timestamp counter
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
 // String functions
 int strlen(const char* str);
 int strcmp(const char* str1, const char* str2);
@@ -72,6 +128,7 @@ void* malloc(unsigned int size);
 void free(void* ptr);
 void* kmalloc(unsigned int size);
 void kfree(void* ptr);
+unsigned int ksize(void* ptr);
 
 // Physical memory
 unsigned int allocate_physical_page(void);
@@ -80,8 +137,49 @@ void free_physical_page(unsigned int page);
 // Virtual memory
 void map_page(unsigned int virtual_addr, unsigned int physical_addr, unsigned int flags);
 void unmap_page(unsigned int virtual_addr);
+unsigned int virt_to_phys(unsigned int virtual_addr);
+int page_test_and_clear_dirty(unsigned int virtual_addr);
 void enable_paging(void);
 
+// Page buffers in a dedicated window, can be moved between owners by remapping
+#define PAGE_SIZE 4096
+
+unsigned int vmap_alloc(unsigned int npages);
+void vmap_free(unsigned int addr, unsigned int npages);
+int is_vmap_addr(unsigned int addr);
+void* alloc_pages(unsigned int npages);
+void free_pages(void* addr, unsigned int npages);
+void* move_pages(void* addr, unsigned int npages);
+
+// Memory mappings. There is one address space, so addresses come from the
+// page window and hints are refused; pages are populated when mapped.
+#include "abi.h"  // PROT_*, MAP_* and MS_*
+
+struct mmap_args {
+    void* addr;
+    unsigned int length;
+    int prot;
+    int flags;
+    int fd;
+    unsigned int offset;     // Multiple of PAGE_SIZE
+};
+
+struct cache_page;
+struct vm_area {
+    unsigned int start;
+    unsigned int npages;
+    int prot;
+    int flags;
+    struct cache_page** pages; // Shared file mappings, one per page
+    struct vm_area* next;
+};
+
+struct process;
+void* do_mmap(void* addr, unsigned int length, int prot, int flags, int fd, unsigned int offset);
+int do_munmap(void* addr, unsigned int length);
+int do_msync(void* addr, unsigned int length, int flags);
+void mmap_release(struct process* proc);
+
 // Memory information
 unsigned int get_total_memory(void);
 unsigned int get_free_memory(void);
@@ -103,6 +201,74 @@ unsigned int get_heap_usage(void);
 #define PROC_READY 2
 #define PROC_BLOCKED 3
 #define PROC_TERMINATED 4
+#define PROC_ZOMBIE 5     // Exited, waiting for the parent to collect it
+
+// Process flags
+#define PROC_FLAG_KERNEL 0x01  // Kernel thread, never enters user mode
+
+#define KERNEL_STACK_SIZE 8192
+#define USER_THREAD_STACK_SIZE 65536  // User threads still run in ring 0 on this stack
+#define MAX_PROCESSES 256  // Matches max_processes in system.conf
+#define KERNEL_PID 1       // The kernel process, adopts orphans
+#define MAX_FDS 16
+
+// Thread priorities, higher runs first
+#define NR_PRIORITIES 32
+#define DEFAULT_PRIORITY 10
+
+struct thread;
+
+// Deferred work item
+typedef struct work {
+    void (*func)(struct work* work);
+    void* data;
+    uint32_t flags;
+    struct work* next;
+} Work;
+
+#define WORK_PENDING 0x01
+#define WORK_AUTOFREE 0x02  // Allocated by queue_work_fn, freed after it runs
+
+// Work item that is queued once its timer expires
+typedef struct delayed_work {
+    Work work;
+    uint32_t expires;
+    struct delayed_work* next;
+} DelayedWork;
+
+// Queue of threads sleeping on an event
+typedef struct wait_queue {
+    struct thread* head;
+    struct thread* tail;
+} WaitQueue;
+
+// Sleeping kernel mutex with priority inheritance
+typedef struct kmutex {
+    const char* name;
+    struct thread* owner;
+    WaitQueue waiters;
+    struct kmutex* next_held; // Owner's list of held mutexes
+} KMutex;
+
+#define KMUTEX_INIT(mutex_name) {mutex_name, NULL, {NULL, NULL}, NULL}
+
+#define MAILBOX_CAPACITY 32
+
+// Bounded FIFO of messages waiting for a process
+typedef struct mailbox {
+    struct message* slots[MAILBOX_CAPACITY];
+    uint32_t head;
+    uint32_t count;
+    WaitQueue receivers;
+    WaitQueue senders;    // Blocked while the mailbox is full
+} Mailbox;
+
+#define IPC_MSG_WORDS 4
+
+// Short message for ipc_call()/ipc_reply_wait(), carried in message registers
+typedef struct ipc_msg {
+    uint32_t words[IPC_MSG_WORDS];
+} IpcMsg;
 
 // Process structure
 typedef struct process {
@@ -112,13 +278,40 @@ typedef struct process {
     uint32_t ebp;
     uint32_t page_directory;
     struct process* next;
+    struct process* prev;
+    struct process* hash_next;
+    struct process* parent;
+    struct process* children;     // Zombies are kept at the front
+    struct process* sibling_next;
+    struct process* sibling_prev;
+    WaitQueue child_exit;
+    int exit_status;
+    Mailbox mailbox;
+    WaitQueue ipc_callers;        // Blocked in ipc_call() until a server thread waits
+    WaitQueue ipc_servers;        // Threads waiting in ipc_reply_wait()
+    struct file* files[MAX_FDS];  // Descriptor table, NULL slots are free
     char name[64];
+    uint32_t flags;
+    struct thread* threads;
+    uint32_t nr_threads;          // Threads that have not exited
+    Work reap_work;
+    uint64_t user_cycles;     // CPU time, summed over all threads
+    uint64_t sys_cycles;
+    uint64_t start_tsc;
+    uint32_t nvcsw;           // Voluntary context switches
+    uint32_t nivcsw;          // Involuntary context switches
+    uint32_t rss_bytes;       // Kernel stacks plus heap allocations
+    struct vm_area* mmaps;    // From mmap(), unmapped when it is reaped
+    uint32_t channels;        // Bit per channel id it holds open
 } Process;
 
 // Process management functions
 void init_scheduler(void);
 Process* create_process(const char* name, void* entry_point);
 void destroy_process(uint32_t pid);
+Process* find_process(uint32_t pid);
+void reparent_process(Process* proc, Process* parent);
+int wait_process(int pid, int* status);
 void schedule(void);
 Process* get_current_process(void);
 void yield(void);
@@ -131,10 +324,307 @@ typedef struct thread {
     uint32_t ebp;
     Process* process;
     struct thread* next;
+    struct thread* proc_next;
+    struct thread* run_next;
+    WaitQueue* waiting_on;
+    void* kernel_stack;
+    void (*entry)(void* arg);
+    void* arg;
+    uint32_t futex_key;
+    uint32_t priority;        // Effective priority, may be boosted
+    uint32_t base_priority;
+    KMutex* blocked_on;
+    KMutex* held_mutexes;
+    uint64_t user_cycles;
+    uint64_t sys_cycles;
+    uint64_t mark_tsc;        // Start of the interval not yet accounted
+    uint32_t nvcsw;
+    uint32_t nivcsw;
+    int in_syscall;
+    void* fpu_alloc;
+    uint8_t* fpu_state;       // FXSAVE area, allocated on first FPU use
+    uint32_t stack_size;
+    uint32_t tls_base;        // Base of the GS segment while it runs
+    void* exit_value;
+    WaitQueue join_wait;
+    struct thread* joiner;
+    uint32_t wake_tick;       // Deadline of sleep_on_timeout()
+    struct thread* timeout_next;
+    int on_timeout_list;
+    int timed_out;
+    uint32_t ipc_words[IPC_MSG_WORDS]; // Message registers
+    struct thread* ipc_server; // Handling our ipc_call()
+    struct thread* ipc_caller; // Waiting for our reply
+    int ipc_status;
 } Thread;
 
 Thread* create_thread(Process* proc, void* entry_point);
+Thread* create_kernel_thread(const char* name, void (*entry)(void* arg), void* arg);
+Thread* create_user_thread(Process* proc, void (*entry)(void* arg), void* arg, uint32_t tls_base);
+int join_thread(uint32_t tid, void** result);
 void destroy_thread(uint32_t tid);
+void thread_exit(void);
+void free_thread(Thread* thread);
+Thread* get_current_thread(void);
+
+// Scheduler internals shared with thread.c
+void make_ready(Thread* thread);
+void unlink_thread(Thread* thread);
+void set_thread_priority(Thread* thread, uint32_t priority);
+void check_preempt(void);
+int need_resched(void);
+void finish_context_switch(void);
+void switch_to(Thread* next);
+void sleep_on_switch(WaitQueue* wq, Thread* next);
+Thread* wait_queue_take(WaitQueue* wq);
+void switch_context(uint32_t* old_esp, uint32_t new_esp);
+
+// CPU accounting
+typedef struct {
+    uint32_t pid;
+    uint32_t ppid;
+    uint32_t state;
+    uint32_t flags;
+    uint32_t nr_threads;
+    uint32_t priority;        // Highest among its threads
+    uint64_t user_cycles;
+    uint64_t sys_cycles;
+    uint64_t start_tsc;
+    uint32_t user_ms;
+    uint32_t sys_ms;
+    uint32_t nvcsw;
+    uint32_t nivcsw;
+    uint32_t rss_bytes;
+    char name[64];
+} ProcInfo;
+
+void account_syscall_enter(void);
+void account_syscall_exit(void);
+void account_alloc(void* ptr, int allocated);
+int get_process_info(ProcInfo* info, int max);
+
+// System call tracing and latency histograms
+#define SYSCALL_SLOTS 64          // Table size the statistics are kept for
+#define SYSCALL_HIST_BUCKETS 32   // Bucket b counts calls of 2^b to 2^(b+1)-1 cycles
+#define TRACE_RING_SIZE 1024      // Records per CPU, a power of two
+
+typedef struct trace_record {
+    uint32_t seq;             // Position in its CPU's ring, gaps mean lost records
+    uint32_t pid;
+    uint32_t num;
+    int args[3];
+    int ret;
+    uint32_t cycles;
+    uint64_t tsc;             // Entry time
+} TraceRecord;
+
+typedef struct syscall_stat {
+    uint32_t num;
+    uint32_t count;
+    uint64_t cycles;
+    uint32_t hist[SYSCALL_HIST_BUCKETS];
+    char name[16];
+} SyscallStat;
+
+const char* syscall_name(int num);
+void syscall_trace_exit(int num, int arg1, int arg2, int arg3, int ret, uint64_t start);
+int syscall_trace_follow(int pid);
+int syscall_trace_read(TraceRecord* out, int max, uint32_t* cursors);
+int syscall_get_stats(SyscallStat* out, int max);
+
+// Lazy FPU/SSE switching
+#define FPU_STATE_SIZE 512
+
+void init_fpu(void);
+void fpu_switch(Thread* next);
+void fpu_device_not_available(void);
+void fpu_release(Thread* thread);
+
+// SYSENTER entry stack follows the running thread
+void sysenter_set_stack(Thread* next);
+
+// Wait queues (call with interrupts disabled)
+void wait_queue_init(WaitQueue* wq);
+void sleep_on(WaitQueue* wq);
+void wake_up(WaitQueue* wq);
+void wake_up_all(WaitQueue* wq);
+int sleep_on_timeout(WaitQueue* wq, uint32_t ticks);
+void timeout_tick(uint32_t now);
+
+// Workqueues
+void init_workqueues(void);
+void init_work(Work* work, void (*func)(Work* work), void* data);
+void init_delayed_work(DelayedWork* dwork, void (*func)(Work* work), void* data);
+int queue_work(Work* work);
+int queue_work_fn(void (*func)(void* data), void* data);
+int queue_delayed_work(DelayedWork* dwork, uint32_t delay_ticks);
+int cancel_delayed_work(DelayedWork* dwork);
+void flush_workqueue(void);
+void workqueue_tick(uint32_t now);
+
+// Kernel mutexes
+void kmutex_init(KMutex* mutex, const char* name);
+void kmutex_lock(KMutex* mutex);
+int kmutex_trylock(KMutex* mutex);
+void kmutex_unlock(KMutex* mutex);
+void thread_set_base_priority(Thread* thread, uint32_t priority);
+
+#define MUTEX_MAX_CHAIN 8  // Priority is only propagated this many owners deep
+
+#ifdef MUTEX_DEBUG
+// Worst cases seen since boot
+typedef struct {
+    uint32_t contentions;
+    uint32_t max_chain;                     // Owners walked while blocking
+    const char* chain[MUTEX_MAX_CHAIN];     // Mutexes along that chain
+    uint32_t chain_tids[MUTEX_MAX_CHAIN];   // Their owners
+    uint64_t max_wait_cycles;
+    const char* max_wait_mutex;
+    uint32_t max_wait_tid;
+} MutexDebugStats;
+
+void kmutex_get_debug_stats(MutexDebugStats* stats);
+#endif
+
+// Message passing
+#define IPC_NOWAIT 0
+#define IPC_WAIT_FOREVER 0xFFFFFFFF
+
+void mailbox_init(Mailbox* box);
+void mailbox_close(Mailbox* box);
+void mailbox_flush(Mailbox* box);
+int send_message(uint32_t dest_pid, uint32_t type, void* data, uint32_t length);
+int send_message_timeout(uint32_t dest_pid, uint32_t type, void* data, uint32_t length, uint32_t timeout_ms);
+int send_message_from(uint32_t sender_pid, uint32_t dest_pid, uint32_t type, void* data, uint32_t length, uint32_t timeout_ms);
+int receive_message(uint32_t* sender_pid, uint32_t* type, void* buffer, uint32_t buffer_size);
+int receive_message_timeout(uint32_t* sender_pid, uint32_t* type, void* buffer, uint32_t buffer_size, uint32_t timeout_ms);
+int receive_message_grant(uint32_t* sender_pid, uint32_t* type, void** data, uint32_t* length, uint32_t timeout_ms);
+void* ipc_alloc_buffer(uint32_t size);
+void ipc_free_buffer(void* buffer, uint32_t size);
+
+// Synchronous call/reply, switches straight between client and server
+int ipc_call(uint32_t dest_pid, IpcMsg* msg);
+int ipc_reply_wait(IpcMsg* msg);
+void ipc_detach(Thread* thread);
+void ipc_close(Process* proc);
+
+// Futexes
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+int futex_wait(volatile int* uaddr, int val);
+int futex_wake(volatile int* uaddr, int count);
+
+// Shared-memory ring channels
+#define CHANNEL_MAX 32            // At most 32, a process keeps a bit per channel
+#define CHANNEL_MAX_SLOTS 4096
+
+// Header at the start of a channel's pages, the slots follow at data_offset.
+// Producer and consumer indices live on separate cache lines.
+typedef struct ipc_channel {
+    volatile uint32_t tail;       // Next position producers reserve
+    uint32_t pad0[15];
+    volatile uint32_t head;       // Next position the consumer reads
+    uint32_t pad1[15];
+    volatile int data_seq;        // Doorbell futex for a sleeping consumer
+    volatile int data_waiting;
+    volatile int space_seq;       // Doorbell futex for producers waiting on a full ring
+    volatile int space_waiting;
+    uint32_t id;
+    uint32_t slot_size;           // Largest payload
+    uint32_t slot_stride;
+    uint32_t nr_slots;            // Power of two
+    uint32_t data_offset;
+    uint32_t size;                // Bytes mapped, header included
+} IpcChannel;
+
+// Slot for position p is free when seq == p and filled when seq == p + 1
+typedef struct channel_slot {
+    volatile uint32_t seq;
+    uint32_t length;
+} ChannelSlot;
+
+IpcChannel* channel_create(uint32_t slot_size, uint32_t nr_slots);
+IpcChannel* channel_open(int id);
+int channel_close(IpcChannel* channel);
+void channel_release(Process* proc);
+
+// Pipes: a ring of page buffers between a writer and a reader
+#define PIPE_BUFFERS 16
+
+typedef struct pipe_buffer {
+    char* page;
+    uint32_t offset;          // First unread byte
+    uint32_t length;          // Unread bytes
+} PipeBuffer;
+
+typedef struct pipe {
+    PipeBuffer bufs[PIPE_BUFFERS];
+    uint32_t head;
+    uint32_t count;
+    char* spare;              // Last freed page, saves a trip to the allocator
+    uint32_t readers;
+    uint32_t writers;
+    WaitQueue read_wait;
+    WaitQueue write_wait;
+} Pipe;
+
+struct file;
+int pipe_create(struct file** read_end, struct file** write_end);
+int pipe_read(Pipe* pipe, void* buffer, uint32_t size);
+int pipe_write(Pipe* pipe, const void* buffer, uint32_t size);
+int pipe_gift(Pipe* pipe, void* pages, uint32_t length);
+void pipe_release(Pipe* pipe, int writer);
+
+// Submission/completion rings, operations run on kernel workers
+#define IORING_MAX 16
+#define IORING_MAX_ENTRIES 1024
+
+#define IORING_OP_NOP 0
+#define IORING_OP_READ 1
+#define IORING_OP_WRITE 2
+#define IORING_OP_OPEN 3     // addr is the path, arg the open flags
+#define IORING_OP_SEND 4     // fd is the destination pid, arg the message type
+
+typedef struct io_sqe {
+    uint32_t opcode;
+    int32_t fd;
+    uint32_t addr;            // Buffer or path
+    uint32_t length;
+    uint32_t arg;
+    uint32_t user_data;       // Copied to the completion
+} IoSqe;
+
+typedef struct io_cqe {
+    uint32_t user_data;
+    int32_t result;
+} IoCqe;
+
+// Header at the start of a ring's pages. The process fills SQEs and moves
+// sq_tail, ring_enter() consumes them; workers post CQEs at cq_tail and the
+// process consumes them at cq_head. Both queues are powers of two and the
+// completion queue is twice as long, it cannot overflow.
+typedef struct io_ring {
+    volatile uint32_t sq_head;
+    uint32_t pad0[15];
+    volatile uint32_t sq_tail;
+    uint32_t pad1[15];
+    volatile uint32_t cq_head;
+    uint32_t pad2[15];
+    volatile uint32_t cq_tail;
+    uint32_t pad3[15];
+    uint32_t id;
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t sq_offset;
+    uint32_t cq_offset;
+    uint32_t size;            // Bytes mapped, header included
+} IoRing;
+
+IoRing* ioring_setup(uint32_t entries);
+int ioring_enter(int id, uint32_t to_submit, uint32_t min_complete);
+int ioring_close(int id);
+void ioring_release(Process* proc);
 
 #endif // PROCESS_H
 
@@ -149,6 +639,20 @@ void destroy_thread(uint32_t tid);
 // Forward declaration
 struct vfs_node;
 
+// In-memory file data: a radix tree of 4 KB pages, 64 slots per level
+#define PAGE_TREE_SHIFT 6
+#define PAGE_TREE_SLOTS (1 << PAGE_TREE_SHIFT)
+
+typedef struct page_tree {
+    void* root;
+    uint32_t height;          // Levels, 0 while empty
+} PageTree;
+
+void page_tree_init(PageTree* tree);
+char* page_tree_lookup(PageTree* tree, uint32_t index);
+char* page_tree_get(PageTree* tree, uint32_t index);
+void page_tree_truncate(PageTree* tree, uint32_t first);
+
 // File system functions
 void init_vfs(void);
 void mount_root_fs(void);
@@ -168,6 +672,156 @@ int move_file(const char* src, const char* dest);
 char** list_directory(const char* path);
 int change_directory(const char* path);
 char* get_current_directory(void);
+struct vfs_node* create_file_path(const char* path);
+struct vfs_node* create_directory_path(const char* path);
+
+// Nodes are freed once deleted and no longer open
+struct vfs_node* vfs_node_get(struct vfs_node* node);
+void vfs_node_put(struct vfs_node* node);
+unsigned int get_file_size(struct vfs_node* node);
+int is_directory(struct vfs_node* node);
+
+// Directory entry cache, names known to be absent are cached as well
+#define DCACHE_ENTRIES 512
+#define DCACHE_NAME_MAX 64        // Longer names are never cached
+
+#define DCACHE_MISS 0
+#define DCACHE_HIT 1
+#define DCACHE_NEGATIVE 2
+
+typedef struct {
+    uint32_t hits;
+    uint32_t negative_hits;
+    uint32_t misses;
+    uint32_t evictions;
+} DcacheStats;
+
+void init_dcache(void);
+int dcache_lookup(struct vfs_node* parent, const char* name, uint32_t len, struct vfs_node** node);
+void dcache_add(struct vfs_node* parent, const char* name, uint32_t len, struct vfs_node* node);
+void dcache_remove(struct vfs_node* parent, const char* name, uint32_t len);
+void dcache_purge(struct vfs_node* node);
+void dcache_get_stats(DcacheStats* stats);
+
+// Page cache, file pages shared by read(), write_file() and shared mappings
+#define PAGE_CACHE_MAX_PAGES 1024  // 4 MB, pages in use by mappings stay past it
+
+struct cache_page;
+struct cache_page* page_cache_get(struct vfs_node* node, uint32_t index);
+void page_cache_put(struct cache_page* page);
+uint32_t page_cache_frame(struct cache_page* page);
+void page_cache_set_dirty(struct cache_page* page);
+void page_cache_sync(struct cache_page* page);
+int page_cache_read(struct vfs_node* node, uint32_t offset, uint32_t size, char* buffer);
+void page_cache_update(struct vfs_node* node, uint32_t offset, uint32_t size, const char* buffer);
+void page_cache_invalidate(struct vfs_node* node);
+void page_cache_readahead(struct vfs_node* node, uint32_t first, uint32_t count);
+
+// Readahead: a sequential reader gets the next window of pages read into
+// the page cache in the background, the window doubles while reads stay
+// sequential and halves on a seek
+#define RA_MIN_PAGES 4
+#define RA_MAX_PAGES 32           // 128 KB
+
+typedef struct file_ra {
+    uint32_t prev_end;        // Byte after the last read, where a sequential one starts
+    uint32_t size;            // Window in pages, 0 until the first sequential read
+    uint32_t next;            // First page not yet read ahead, 0 with no stream going
+    uint32_t trigger;         // Reading this page starts on the next window
+} FileReadahead;
+
+typedef struct {
+    uint32_t hits;            // Read-ahead pages later used
+    uint32_t misses;          // Pages read on demand, the reader waited for them
+    uint32_t pages;           // Pages read ahead
+    uint32_t wasted;          // Read-ahead pages evicted unused
+    uint32_t windows;
+} ReadaheadStats;
+
+void readahead_get_stats(ReadaheadStats* stats);
+
+// Buffer cache of disk blocks, keyed by (device, block number)
+#define BLOCK_SIZE 1024
+#define BUFFER_CACHE_SIZE (4 * 1024 * 1024)  // Matches buffer_cache_size in system.conf
+#define BCACHE_WRITEBACK_MS 5000             // Dirty blocks reach the disk this late at most
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t ghost_hits;      // Misses on blocks evicted recently, they go straight to the hot queue
+    uint32_t reads;           // Blocks read from disk
+    uint32_t writes;          // Blocks written back
+    uint32_t evictions;
+    uint32_t resident;
+    uint32_t dirty;
+} BcacheStats;
+
+struct buffer;
+void init_buffer_cache(void);
+struct buffer* bread(uint32_t dev, uint32_t block);
+void brelse(struct buffer* buf);
+char* buffer_data(struct buffer* buf);
+void mark_buffer_dirty(struct buffer* buf);
+int bcache_read(uint32_t dev, uint32_t block, uint32_t offset, uint32_t size, char* buffer);
+int bcache_write(uint32_t dev, uint32_t block, uint32_t offset, uint32_t size, const char* buffer);
+int bcache_sync(void);
+void bcache_get_stats(BcacheStats* stats);
+
+// O_*, SEEK_*, struct iovec and struct dirent
+#include "abi.h"
+
+// Position in a directory: the entry to return next, kept as a pointer so
+// a read resumes without a walk while nothing was removed from the directory
+typedef struct dir_cursor {
+    uint32_t index;           // Entries returned so far
+    struct vfs_node* next;    // NULL at the end
+    uint32_t generation;      // Directory's generation when next was taken
+} DirCursor;
+
+int read_dir(struct vfs_node* dir, DirCursor* cursor, char* buffer, unsigned int size);
+
+// Open files, shared by every descriptor that refers to them
+#define FILE_CONSOLE 1
+#define FILE_PIPE_READ 2
+#define FILE_PIPE_WRITE 3
+#define FILE_VFS 4
+
+typedef struct file {
+    uint32_t type;
+    uint32_t refs;
+    struct pipe* pipe;
+    struct vfs_node* node;    // FILE_VFS
+    uint32_t offset;          // Position for read(), write() and lseek()
+    uint32_t flags;           // O_* given to open()
+    DirCursor dir;            // getdents() position in a directory
+    FileReadahead ra;
+} File;
+
+File* file_alloc(uint32_t type);
+File* file_get(File* file);
+void file_put(File* file);
+int file_read(File* file, void* buffer, uint32_t size);
+int file_write(File* file, const void* buffer, uint32_t size);
+File* file_open(const char* path, int flags);
+int file_pread(File* file, void* buffer, uint32_t size, uint32_t offset);
+int file_pwrite(File* file, const void* buffer, uint32_t size, uint32_t offset);
+int file_lseek(File* file, int offset, int whence);
+int file_readv(File* file, const struct iovec* iov, int iovcnt);
+int file_writev(File* file, const struct iovec* iov, int iovcnt);
+int file_getdents(File* file, void* buffer, uint32_t size);
+int file_readable(File* file);
+void file_readahead(File* file, uint32_t offset, uint32_t size);
+
+// Descriptor tables; fd_* work on the current process
+struct process;
+void files_init(struct process* proc, struct process* parent);
+void files_release(struct process* proc);
+int fd_install(File* file);
+int fd_install_in(struct process* proc, File* file);
+File* fd_get(int fd);
+int fd_close(int fd);
+int fd_dup(int fd);
+int fd_dup2(int fd, int newfd);
 
 #endif // FILESYSTEM_H
 
@@ -4,10 +4,12 @@
 #include "../include/memory.h"
 #include "../include/kernel.h"
 
-#define PAGE_SIZE 4096
 #define HEAP_START 0x100000
 #define HEAP_SIZE 0x1000000  // 16MB heap
 #define MAX_PAGES 1024
+#define IDENTITY_MAP_END 0x2000000  // 32MB, covers the heap and every page table
+#define VMAP_BASE 0xD0000000
+#define VMAP_PAGES 4096      // 16MB window for page buffers
 
 // Physical memory management
 typedef struct {
@@ -41,6 +43,7 @@ typedef struct {
 static PhysicalMemoryManager pmm;
 static VirtualMemoryManager vmm;
 static HeapManager heap;
+static unsigned int vmap_bitmap[VMAP_PAGES / 32];
 
 // Function prototypes
 void init_physical_memory(void);
@@ -50,11 +53,17 @@ void* kmalloc(unsigned int size);
 void kfree(void* ptr);
 void* malloc(unsigned int size);
 void free(void* ptr);
+unsigned int ksize(void* ptr);
 unsigned int allocate_physical_page(void);
 void free_physical_page(unsigned int page);
 void map_page(unsigned int virtual_addr, unsigned int physical_addr, unsigned int flags);
 void unmap_page(unsigned int virtual_addr);
+unsigned int virt_to_phys(unsigned int virtual_addr);
+int page_test_and_clear_dirty(unsigned int virtual_addr);
 void enable_paging(void);
+void* alloc_pages(unsigned int npages);
+void free_pages(void* addr, unsigned int npages);
+void* move_pages(void* addr, unsigned int npages);
 
 void init_physical_memory(void) {
     // Initialize physical memory bitmap
@@ -71,8 +80,8 @@ void init_physical_memory(void) {
         pmm.bitmap[i] = 0;
     }
     
-    // Mark first 1MB as used (kernel space)
-    for(unsigned int i = 0; i < 256; i++) {
+    // Mark first 1MB (kernel space) and the heap as used
+    for(unsigned int i = 0; i < (HEAP_START + HEAP_SIZE) / PAGE_SIZE; i++) {
         allocate_physical_page();
     }
 }
@@ -87,11 +96,18 @@ void init_paging(void) {
         vmm.page_tables[i] = 0;
     }
     
-    // Identity map first 4MB (kernel space)
-    for(unsigned int addr = 0; addr < 0x400000; addr += PAGE_SIZE) {
+    // Identity map kernel space, the heap and the frames page tables come from
+    for(unsigned int addr = 0; addr < IDENTITY_MAP_END; addr += PAGE_SIZE) {
         map_page(addr, addr, 0x03); // Present + Read/Write
     }
     
+    // Page tables are written through their physical address, so the
+    // window's are made now while frames still come from below
+    // IDENTITY_MAP_END; no page table is allocated after this
+    for(unsigned int addr = VMAP_BASE; addr < VMAP_BASE + VMAP_PAGES * PAGE_SIZE; addr += 1024 * PAGE_SIZE) {
+        map_page(addr, 0, 0); // Not present, only creates the table
+    }
+    
     enable_paging();
 }
 
@@ -121,6 +137,8 @@ void* malloc(unsigned int size) {
     // Align size to 4 bytes
     size = (size + 3) & ~3;
     
+    // Threads can be preempted, keep the block list consistent
+    uint32_t flags = irq_save();
     HeapBlock* current = heap.first_block;
     
     // Find suitable free block
@@ -143,17 +161,20 @@ void* malloc(unsigned int size) {
             
             current->free = 0;
             heap.used_size += current->size;
+            irq_restore(flags);
             return (void*)((char*)current + sizeof(HeapBlock));
         }
         current = current->next;
     }
     
+    irq_restore(flags);
     return 0; // Out of memory
 }
 
 void free(void* ptr) {
     if(!ptr) return;
     
+    uint32_t flags = irq_save();
     HeapBlock* block = (HeapBlock*)((char*)ptr - sizeof(HeapBlock));
     block->free = 1;
     heap.used_size -= block->size;
@@ -175,6 +196,16 @@ void free(void* ptr) {
         }
         block->prev->next = block->next;
     }
+    
+    irq_restore(flags);
+}
+
+// Usable size of an allocated block
+unsigned int ksize(void* ptr) {
+    if(!ptr) return 0;
+    
+    HeapBlock* block = (HeapBlock*)((char*)ptr - sizeof(HeapBlock));
+    return block->size;
 }
 
 unsigned int allocate_physical_page(void) {
@@ -237,6 +268,142 @@ void unmap_page(unsigned int virtual_addr) {
     }
 }
 
+// Translate through the page tables, returns 0xFFFFFFFF if not mapped
+unsigned int virt_to_phys(unsigned int virtual_addr) {
+    unsigned int page_dir_index = virtual_addr >> 22;
+    unsigned int page_table_index = (virtual_addr >> 12) & 0x3FF;
+    
+    if(!(vmm.page_directory[page_dir_index] & 0x01)) {
+        return 0xFFFFFFFF;
+    }
+    
+    unsigned int entry = vmm.page_tables[page_dir_index][page_table_index];
+    if(!(entry & 0x01)) {
+        return 0xFFFFFFFF;
+    }
+    
+    return (entry & 0xFFFFF000) | (virtual_addr & 0xFFF);
+}
+
+// Clear the dirty bit the MMU sets on the first store, returns whether it was set
+int page_test_and_clear_dirty(unsigned int virtual_addr) {
+    unsigned int page_dir_index = virtual_addr >> 22;
+    unsigned int page_table_index = (virtual_addr >> 12) & 0x3FF;
+    
+    if(!(vmm.page_directory[page_dir_index] & 0x01)) {
+        return 0;
+    }
+    
+    unsigned int* entry = &vmm.page_tables[page_dir_index][page_table_index];
+    if((*entry & 0x41) != 0x41) {
+        return 0;
+    }
+    
+    *entry &= ~0x40;
+    asm volatile("invlpg (%0)" :: "r"(virtual_addr) : "memory");
+    return 1;
+}
+
+// Reserve npages of contiguous address space in the page window, 0 if none
+unsigned int vmap_alloc(unsigned int npages) {
+    uint32_t flags = irq_save();
+    unsigned int run = 0;
+    
+    for(unsigned int i = 0; i < VMAP_PAGES; i++) {
+        if(vmap_bitmap[i / 32] & (1 << (i % 32))) {
+            run = 0;
+            continue;
+        }
+        
+        if(++run == npages) {
+            unsigned int first = i + 1 - npages;
+            for(unsigned int j = first; j <= i; j++) {
+                vmap_bitmap[j / 32] |= 1 << (j % 32);
+            }
+            irq_restore(flags);
+            return VMAP_BASE + first * PAGE_SIZE;
+        }
+    }
+    
+    irq_restore(flags);
+    return 0;
+}
+
+void vmap_free(unsigned int addr, unsigned int npages) {
+    uint32_t flags = irq_save();
+    unsigned int first = (addr - VMAP_BASE) / PAGE_SIZE;
+    
+    for(unsigned int j = first; j < first + npages; j++) {
+        vmap_bitmap[j / 32] &= ~(1 << (j % 32));
+    }
+    irq_restore(flags);
+}
+
+int is_vmap_addr(unsigned int addr) {
+    return addr >= VMAP_BASE && addr < VMAP_BASE + VMAP_PAGES * PAGE_SIZE;
+}
+
+// Page-aligned buffer backed by fresh physical pages
+void* alloc_pages(unsigned int npages) {
+    unsigned int base = vmap_alloc(npages);
+    if(!base) return 0;
+    
+    uint32_t flags = irq_save();
+    for(unsigned int i = 0; i < npages; i++) {
+        unsigned int page = allocate_physical_page();
+        if(!page) {
+            // Out of memory, undo what we mapped so far
+            while(i--) {
+                unsigned int addr = base + i * PAGE_SIZE;
+                free_physical_page(virt_to_phys(addr) & 0xFFFFF000);
+                unmap_page(addr);
+            }
+            irq_restore(flags);
+            vmap_free(base, npages);
+            return 0;
+        }
+        map_page(base + i * PAGE_SIZE, page, 0x03); // Present + Read/Write
+    }
+    irq_restore(flags);
+    
+    return (void*)base;
+}
+
+void free_pages(void* addr, unsigned int npages) {
+    unsigned int base = (unsigned int)addr;
+    
+    uint32_t flags = irq_save();
+    for(unsigned int i = 0; i < npages; i++) {
+        unsigned int page = virt_to_phys(base + i * PAGE_SIZE);
+        if(page != 0xFFFFFFFF) {
+            free_physical_page(page & 0xFFFFF000);
+        }
+        unmap_page(base + i * PAGE_SIZE);
+    }
+    irq_restore(flags);
+    
+    vmap_free(base, npages);
+}
+
+// Move page mappings to a new range in the window, the old range is unmapped.
+// Returns the new address, or 0 if the window is full.
+void* move_pages(void* addr, unsigned int npages) {
+    unsigned int from = (unsigned int)addr;
+    unsigned int to = vmap_alloc(npages);
+    if(!to) return 0;
+    
+    uint32_t flags = irq_save();
+    for(unsigned int i = 0; i < npages; i++) {
+        unsigned int page = virt_to_phys(from + i * PAGE_SIZE) & 0xFFFFF000;
+        map_page(to + i * PAGE_SIZE, page, 0x03);
+        unmap_page(from + i * PAGE_SIZE);
+    }
+    irq_restore(flags);
+    
+    vmap_free(from, npages);
+    return (void*)to;
+}
+
 void enable_paging(void) {
     // Load page directory
     asm volatile("mov %0, %%cr3" :: "r"(vmm.page_directory));
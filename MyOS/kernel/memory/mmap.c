@@ -0,0 +1,250 @@
+// kernel/memory/mmap.c
+// mmap(), munmap() and msync() over the page window and the page cache
+
+#include "../include/kernel.h"
+#include "../include/memory.h"
+#include "../include/process.h"
+#include "../include/filesystem.h"
+
+// Serializes changes to every process's mapping list
+static KMutex mmap_lock = KMUTEX_INIT("mmap");
+
+// Pages stay present even for PROT_NONE, a fault would halt the machine
+static unsigned int pte_flags(int prot) {
+    return (prot & PROT_WRITE) ? 0x03 : 0x01;
+}
+
+// The page cache's own frames, so every shared mapping of a page and read()
+// and write() all see the same bytes
+static int map_shared(struct vm_area* area, struct vfs_node* node, unsigned int first) {
+    area->pages = (struct cache_page**)kmalloc(area->npages * sizeof(struct cache_page*));
+    if(!area->pages) return -1;
+    
+    area->start = vmap_alloc(area->npages);
+    if(!area->start) {
+        kfree(area->pages);
+        return -1;
+    }
+    
+    for(unsigned int i = 0; i < area->npages; i++) {
+        struct cache_page* page = page_cache_get(node, first + i);
+        if(!page) {
+            // Too many pages mapped already, undo what we have
+            while(i--) {
+                unmap_page(area->start + i * PAGE_SIZE);
+                page_cache_put(area->pages[i]);
+            }
+            vmap_free(area->start, area->npages);
+            kfree(area->pages);
+            return -1;
+        }
+        area->pages[i] = page;
+        map_page(area->start + i * PAGE_SIZE, page_cache_frame(page), pte_flags(area->prot));
+    }
+    return 0;
+}
+
+// Private and anonymous mappings get fresh frames, copied from the file
+// now since there is no fault handler to copy on write
+static int map_private(struct vm_area* area, struct vfs_node* node, unsigned int offset) {
+    unsigned int size = area->npages * PAGE_SIZE;
+    char* data = (char*)alloc_pages(area->npages);
+    if(!data) return -1;
+    
+    int n = node ? page_cache_read(node, offset, size, data) : 0;
+    if(n < 0) n = 0;
+    memset(data + n, 0, size - n);
+    
+    area->start = (unsigned int)data;
+    area->pages = NULL;
+    if(!(area->prot & PROT_WRITE)) {
+        for(unsigned int i = 0; i < area->npages; i++) {
+            unsigned int addr = area->start + i * PAGE_SIZE;
+            map_page(addr, virt_to_phys(addr) & 0xFFFFF000, pte_flags(area->prot));
+            asm volatile("invlpg (%0)" :: "r"(addr) : "memory");
+        }
+    }
+    return 0;
+}
+
+// Pass stores made through a shared mapping on to the page cache
+static void collect_dirty(struct vm_area* area, unsigned int first, unsigned int count) {
+    for(unsigned int i = first; i < first + count; i++) {
+        if(page_test_and_clear_dirty(area->start + i * PAGE_SIZE)) {
+            page_cache_set_dirty(area->pages[i]);
+        }
+    }
+}
+
+// Unmap count pages from first, writing stored-to file pages back
+static void unmap_range(struct vm_area* area, unsigned int first, unsigned int count) {
+    unsigned int start = area->start + first * PAGE_SIZE;
+    
+    if(!area->pages) {
+        free_pages((void*)start, count);
+        return;
+    }
+    
+    collect_dirty(area, first, count);
+    for(unsigned int i = first; i < first + count; i++) {
+        unmap_page(area->start + i * PAGE_SIZE);
+        page_cache_sync(area->pages[i]);
+        page_cache_put(area->pages[i]);
+    }
+    vmap_free(start, count);
+}
+
+void* do_mmap(void* addr, unsigned int length, int prot, int flags, int fd, unsigned int offset) {
+    int type = flags & (MAP_SHARED | MAP_PRIVATE);
+    // The kernel picks every address, hints are not supported
+    if(addr || !length || (flags & MAP_FIXED) || offset % PAGE_SIZE) return MAP_FAILED;
+    if(type != MAP_SHARED && type != MAP_PRIVATE) return MAP_FAILED;
+    
+    // Pin the file so a close() from another thread cannot pull it away
+    File* file = NULL;
+    if(!(flags & MAP_ANONYMOUS)) {
+        file = fd_get(fd);
+        if(!file || file->type != FILE_VFS || is_directory(file->node)) return MAP_FAILED;
+        
+        int access = file->flags & O_ACCMODE;
+        if(access == O_WRONLY) return MAP_FAILED;
+        if(type == MAP_SHARED && (prot & PROT_WRITE) && access != O_RDWR) return MAP_FAILED;
+        file_get(file);
+    }
+    
+    struct vm_area* area = (struct vm_area*)kmalloc(sizeof(struct vm_area));
+    if(!area) {
+        if(file) file_put(file);
+        return MAP_FAILED;
+    }
+    area->npages = (length + PAGE_SIZE - 1) / PAGE_SIZE;
+    area->prot = prot;
+    area->flags = flags;
+    
+    int result;
+    if(file && type == MAP_SHARED) {
+        result = map_shared(area, file->node, offset / PAGE_SIZE);
+    } else {
+        result = map_private(area, file ? file->node : NULL, offset);
+    }
+    if(file) file_put(file);
+    
+    if(result != 0) {
+        kfree(area);
+        return MAP_FAILED;
+    }
+    
+    Process* proc = get_current_process();
+    kmutex_lock(&mmap_lock);
+    area->next = proc->mmaps;
+    proc->mmaps = area;
+    kmutex_unlock(&mmap_lock);
+    
+    return (void*)area->start;
+}
+
+// Unmap whole pages in the range; areas that straddle it are trimmed or split
+int do_munmap(void* addr, unsigned int length) {
+    unsigned int start = (unsigned int)addr;
+    if(start % PAGE_SIZE || !length) return -1;
+    unsigned int end = start + ((length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+    
+    Process* proc = get_current_process();
+    kmutex_lock(&mmap_lock);
+    
+    struct vm_area** link = &proc->mmaps;
+    while(*link) {
+        struct vm_area* area = *link;
+        unsigned int area_end = area->start + area->npages * PAGE_SIZE;
+        if(area_end <= start || area->start >= end) {
+            link = &area->next;
+            continue;
+        }
+        
+        unsigned int first = area->start < start ? (start - area->start) / PAGE_SIZE : 0;
+        unsigned int last = area_end > end ? (end - area->start) / PAGE_SIZE : area->npages;
+        
+        // Split off the tail first, so a failure leaves everything mapped
+        if(last < area->npages) {
+            struct vm_area* tail = (struct vm_area*)kmalloc(sizeof(struct vm_area));
+            if(!tail) {
+                kmutex_unlock(&mmap_lock);
+                return -1;
+            }
+            *tail = *area;
+            tail->start = area->start + last * PAGE_SIZE;
+            tail->npages = area->npages - last;
+            if(area->pages) {
+                tail->pages = (struct cache_page**)kmalloc(tail->npages * sizeof(struct cache_page*));
+                if(!tail->pages) {
+                    kfree(tail);
+                    kmutex_unlock(&mmap_lock);
+                    return -1;
+                }
+                memcpy(tail->pages, area->pages + last, tail->npages * sizeof(struct cache_page*));
+            }
+            area->npages = last;
+            area->next = tail;
+        }
+        
+        unmap_range(area, first, last - first);
+        
+        if(first == 0) {
+            *link = area->next;
+            if(area->pages) kfree(area->pages);
+            kfree(area);
+        } else {
+            area->npages = first;
+            link = &area->next;
+        }
+    }
+    
+    kmutex_unlock(&mmap_lock);
+    return 0;
+}
+
+int do_msync(void* addr, unsigned int length, int flags) {
+    unsigned int start = (unsigned int)addr;
+    if(start % PAGE_SIZE) return -1;
+    if((flags & MS_ASYNC) && (flags & MS_SYNC)) return -1;
+    unsigned int end = start + ((length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+    
+    Process* proc = get_current_process();
+    kmutex_lock(&mmap_lock);
+    
+    int found = 0;
+    for(struct vm_area* area = proc->mmaps; area; area = area->next) {
+        unsigned int area_end = area->start + area->npages * PAGE_SIZE;
+        if(area_end <= start || area->start >= end) continue;
+        found = 1;
+        if(!area->pages) continue;
+        
+        unsigned int first = area->start < start ? (start - area->start) / PAGE_SIZE : 0;
+        unsigned int last = area_end > end ? (end - area->start) / PAGE_SIZE : area->npages;
+        
+        // The pages are the cache's, so MS_INVALIDATE has nothing to drop
+        collect_dirty(area, first, last - first);
+        if(flags & MS_SYNC) {
+            for(unsigned int i = first; i < last; i++) {
+                page_cache_sync(area->pages[i]);
+            }
+        }
+    }
+    
+    kmutex_unlock(&mmap_lock);
+    return found ? 0 : -1;
+}
+
+// Process is being reaped, none of its threads can touch the mappings
+void mmap_release(Process* proc) {
+    kmutex_lock(&mmap_lock);
+    while(proc->mmaps) {
+        struct vm_area* area = proc->mmaps;
+        proc->mmaps = area->next;
+        
+        unmap_range(area, 0, area->npages);
+        if(area->pages) kfree(area->pages);
+        kfree(area);
+    }
+    kmutex_unlock(&mmap_lock);
+}
@@ -0,0 +1,308 @@
+// kernel/memory/page_cache.c
+// File pages shared by read(), write() and mmap()
+
+#include "../include/kernel.h"
+#include "../include/memory.h"
+#include "../include/filesystem.h"
+
+#define PAGE_CACHE_HASH_SIZE 256
+
+typedef struct cache_page {
+    struct vfs_node* node;    // NULL once the file is truncated or deleted
+    uint32_t index;           // Page number within the file
+    char* data;               // Mapped in the page window
+    uint32_t refs;            // Mappings using the frame, pinned while non-zero
+    int dirty;                // Written through a mapping, not yet written back
+    int readahead;            // Read ahead and not used yet
+    struct cache_page* hash_next;
+    struct cache_page* lru_prev;  // Most recently used at the head
+    struct cache_page* lru_next;
+} CachePage;
+
+static CachePage* page_hash[PAGE_CACHE_HASH_SIZE];
+static CachePage* lru_head;
+static CachePage* lru_tail;
+static uint32_t nr_cached;
+static ReadaheadStats ra_stats;
+
+static uint32_t hash_page(struct vfs_node* node, uint32_t index) {
+    return (((uint32_t)node >> 4) ^ (index * 2654435761u)) % PAGE_CACHE_HASH_SIZE;
+}
+
+static void lru_unlink(CachePage* page) {
+    if(page->lru_prev) page->lru_prev->lru_next = page->lru_next;
+    else lru_head = page->lru_next;
+    if(page->lru_next) page->lru_next->lru_prev = page->lru_prev;
+    else lru_tail = page->lru_prev;
+}
+
+static void lru_push(CachePage* page) {
+    page->lru_prev = NULL;
+    page->lru_next = lru_head;
+    if(lru_head) lru_head->lru_prev = page;
+    else lru_tail = page;
+    lru_head = page;
+}
+
+static void hash_unlink(CachePage* page) {
+    CachePage** link = &page_hash[hash_page(page->node, page->index)];
+    while(*link != page) {
+        link = &(*link)->hash_next;
+    }
+    *link = page->hash_next;
+}
+
+// Interrupts must be disabled
+static CachePage* lookup(struct vfs_node* node, uint32_t index) {
+    CachePage* page = page_hash[hash_page(node, index)];
+    while(page && (page->node != node || page->index != index)) {
+        page = page->hash_next;
+    }
+    return page;
+}
+
+// Copy a page's bytes back to the file, up to its current end
+static void writeback(CachePage* page) {
+    page->dirty = 0;
+    if(!page->node) return;
+    
+    uint32_t offset = page->index * PAGE_SIZE;
+    uint32_t size = get_file_size(page->node);
+    if(offset >= size) return;
+    
+    uint32_t length = size - offset < PAGE_SIZE ? size - offset : PAGE_SIZE;
+    write_file(page->node, offset, length, page->data);
+}
+
+static void release(CachePage* page) {
+    free_pages(page->data, 1);
+    kfree(page);
+}
+
+// Drop the least recently used page nobody has mapped, 0 if all are in use
+static int evict_one(void) {
+    uint32_t flags = irq_save();
+    CachePage* page = lru_tail;
+    while(page && page->refs) {
+        page = page->lru_prev;
+    }
+    if(!page) {
+        irq_restore(flags);
+        return 0;
+    }
+    
+    lru_unlink(page);
+    hash_unlink(page);
+    nr_cached--;
+    if(page->readahead) ra_stats.wasted++;
+    irq_restore(flags);
+    
+    if(page->dirty) {
+        writeback(page);
+    }
+    release(page);
+    return 1;
+}
+
+// Read a page that was not cached in. It comes back pinned unless it is
+// read ahead, then nothing holds it until it is used.
+static CachePage* add_page(struct vfs_node* node, uint32_t index, int readahead) {
+    uint32_t flags = irq_save();
+    int full = nr_cached >= PAGE_CACHE_MAX_PAGES;
+    irq_restore(flags);
+    
+    if(full && !evict_one()) return NULL;
+    
+    CachePage* page = (CachePage*)kmalloc(sizeof(CachePage));
+    if(!page) return NULL;
+    page->data = (char*)alloc_pages(1);
+    if(!page->data) {
+        kfree(page);
+        return NULL;
+    }
+    
+    // Somebody may have read the same page while we allocated
+    flags = irq_save();
+    CachePage* other = lookup(node, index);
+    if(other) {
+        if(!readahead) other->refs++;
+        irq_restore(flags);
+        release(page);
+        return other;
+    }
+    
+    // Filled with interrupts off so a write() cannot slip in before the
+    // page is visible to page_cache_write(). Past the end reads as zeroes.
+    int n = read_file(node, index * PAGE_SIZE, PAGE_SIZE, page->data);
+    if(n < 0) n = 0;
+    memset(page->data + n, 0, PAGE_SIZE - n);
+    
+    page->node = node;
+    page->index = index;
+    page->refs = readahead ? 0 : 1;
+    page->dirty = 0;
+    page->readahead = readahead;
+    if(readahead) ra_stats.pages++;
+    else ra_stats.misses++;
+    
+    uint32_t bucket = hash_page(node, index);
+    page->hash_next = page_hash[bucket];
+    page_hash[bucket] = page;
+    lru_push(page);
+    nr_cached++;
+    irq_restore(flags);
+    
+    return page;
+}
+
+// Find a page or read it in; the caller holds a reference until page_cache_put()
+struct cache_page* page_cache_get(struct vfs_node* node, uint32_t index) {
+    uint32_t flags = irq_save();
+    CachePage* page = lookup(node, index);
+    if(page) {
+        page->refs++;
+        if(page->readahead) {
+            page->readahead = 0;
+            ra_stats.hits++;
+        }
+        lru_unlink(page);
+        lru_push(page);
+        irq_restore(flags);
+        return page;
+    }
+    irq_restore(flags);
+    
+    return add_page(node, index, 0);
+}
+
+// Bring pages in ahead of a sequential reader, past the end of the file
+// there is nothing to read
+void page_cache_readahead(struct vfs_node* node, uint32_t first, uint32_t count) {
+    uint32_t end = (get_file_size(node) + PAGE_SIZE - 1) / PAGE_SIZE;
+    if(first >= end) return;
+    if(count > end - first) count = end - first;
+    
+    uint32_t flags = irq_save();
+    ra_stats.windows++;
+    irq_restore(flags);
+    
+    for(uint32_t index = first; index < first + count; index++) {
+        flags = irq_save();
+        int cached = lookup(node, index) != NULL;
+        irq_restore(flags);
+        
+        if(!cached && !add_page(node, index, 1)) break;
+    }
+}
+
+void readahead_get_stats(ReadaheadStats* out) {
+    uint32_t flags = irq_save();
+    *out = ra_stats;
+    irq_restore(flags);
+}
+
+// Pages orphaned by page_cache_invalidate() go with their last reference
+void page_cache_put(struct cache_page* page) {
+    uint32_t flags = irq_save();
+    int orphan = --page->refs == 0 && !page->node;
+    irq_restore(flags);
+    
+    if(orphan) {
+        release(page);
+    }
+}
+
+uint32_t page_cache_frame(struct cache_page* page) {
+    return virt_to_phys((uint32_t)page->data) & 0xFFFFF000;
+}
+
+void page_cache_set_dirty(struct cache_page* page) {
+    page->dirty = 1;
+}
+
+void page_cache_sync(struct cache_page* page) {
+    if(page->dirty) {
+        writeback(page);
+    }
+}
+
+// Reads are served from the cache, so they see stores made through mappings
+int page_cache_read(struct vfs_node* node, uint32_t offset, uint32_t size, char* buffer) {
+    if(!node || !buffer || is_directory(node)) return -1;
+    
+    uint32_t file_size = get_file_size(node);
+    if(offset >= file_size) return 0;
+    if(size > file_size - offset) size = file_size - offset;
+    
+    uint32_t done = 0;
+    while(done < size) {
+        uint32_t pos = offset + done;
+        uint32_t in_page = pos % PAGE_SIZE;
+        uint32_t chunk = PAGE_SIZE - in_page;
+        if(chunk > size - done) chunk = size - done;
+        
+        CachePage* page = page_cache_get(node, pos / PAGE_SIZE);
+        if(!page) {
+            // Every page is mapped, go to the file directly
+            int n = read_file(node, pos, size - done, buffer + done);
+            return n < 0 ? (done ? (int)done : -1) : (int)(done + n);
+        }
+        memcpy(buffer + done, page->data + in_page, chunk);
+        page_cache_put(page);
+        done += chunk;
+    }
+    return done;
+}
+
+// write_file() has stored size bytes at offset, refresh any cached copy
+// so mappings see them at once
+void page_cache_update(struct vfs_node* node, uint32_t offset, uint32_t size, const char* buffer) {
+    if(!size) return;
+    uint32_t first = offset / PAGE_SIZE;
+    uint32_t last = (offset + size - 1) / PAGE_SIZE;
+    
+    uint32_t flags = irq_save();
+    for(uint32_t index = first; index <= last; index++) {
+        CachePage* page = lookup(node, index);
+        if(!page) continue;
+        
+        uint32_t start = index == first ? offset % PAGE_SIZE : 0;
+        uint32_t end = index == last ? (offset + size - 1) % PAGE_SIZE + 1 : PAGE_SIZE;
+        const char* src = buffer + (index * PAGE_SIZE + start - offset);
+        if(src != page->data + start) { // Not a writeback of this very page
+            memcpy(page->data + start, src, end - start);
+        }
+    }
+    irq_restore(flags);
+}
+
+// The file was truncated or deleted. Unmapped pages go now; mapped ones stay
+// with their mappings but no longer belong to the file.
+void page_cache_invalidate(struct vfs_node* node) {
+    CachePage* dead = NULL;
+    
+    uint32_t flags = irq_save();
+    CachePage* page = lru_head;
+    while(page) {
+        CachePage* next = page->lru_next;
+        if(page->node == node) {
+            lru_unlink(page);
+            hash_unlink(page);
+            nr_cached--;
+            page->node = NULL;
+            page->dirty = 0;
+            if(!page->refs) {
+                page->hash_next = dead;
+                dead = page;
+            }
+        }
+        page = next;
+    }
+    irq_restore(flags);
+    
+    while(dead) {
+        CachePage* next = dead->hash_next;
+        release(dead);
+        dead = next;
+    }
+}
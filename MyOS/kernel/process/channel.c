@@ -0,0 +1,134 @@
+// kernel/process/channel.c
+// Shared-memory ring channels; the kernel only sets them up, data moves in user space
+
+#include "../include/kernel.h"
+#include "../include/process.h"
+#include "../include/memory.h"
+
+typedef struct {
+    IpcChannel* ring;
+    uint32_t refs;
+} ChannelEntry;
+
+static ChannelEntry channels[CHANNEL_MAX];
+
+// Drop one reference (interrupts must be disabled, restored here). The
+// pages go with the last one.
+static void channel_put(ChannelEntry* entry, uint32_t flags) {
+    if(--entry->refs > 0) {
+        irq_restore(flags);
+        return;
+    }
+    IpcChannel* ring = entry->ring;
+    entry->ring = NULL;
+    irq_restore(flags);
+    
+    free_pages(ring, ring->size / PAGE_SIZE);
+}
+
+// Create a ring of nr_slots messages of up to slot_size bytes, already
+// open in the creating process
+IpcChannel* channel_create(uint32_t slot_size, uint32_t nr_slots) {
+    if(!slot_size || nr_slots < 2 || nr_slots > CHANNEL_MAX_SLOTS) return NULL;
+    if(nr_slots & (nr_slots - 1)) return NULL; // Positions wrap with a mask
+    
+    uint32_t stride = (sizeof(ChannelSlot) + slot_size + 15) & ~15;
+    uint32_t offset = (sizeof(IpcChannel) + 63) & ~63;
+    uint32_t size = offset + stride * nr_slots;
+    uint32_t npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    
+    uint32_t flags = irq_save();
+    int id = 0;
+    while(id < CHANNEL_MAX && channels[id].ring) {
+        id++;
+    }
+    if(id == CHANNEL_MAX) {
+        irq_restore(flags);
+        return NULL;
+    }
+    channels[id].ring = (IpcChannel*)1; // Reserve the entry while we allocate
+    irq_restore(flags);
+    
+    // Every process shares the kernel page window, so these pages are
+    // mapped at the same address for producer and consumer alike
+    IpcChannel* ring = (IpcChannel*)alloc_pages(npages);
+    if(!ring) {
+        channels[id].ring = NULL;
+        return NULL;
+    }
+    memset(ring, 0, sizeof(IpcChannel));
+    
+    ring->id = id;
+    ring->slot_size = slot_size;
+    ring->slot_stride = stride;
+    ring->nr_slots = nr_slots;
+    ring->data_offset = offset;
+    ring->size = npages * PAGE_SIZE;
+    
+    for(uint32_t i = 0; i < nr_slots; i++) {
+        ChannelSlot* slot = (ChannelSlot*)((char*)ring + offset + i * stride);
+        slot->seq = i;
+        slot->length = 0;
+    }
+    
+    flags = irq_save();
+    channels[id].refs = 1;
+    channels[id].ring = ring;
+    get_current_process()->channels |= 1u << id;
+    irq_restore(flags);
+    return ring;
+}
+
+// A process holds one reference however often it opens the channel
+IpcChannel* channel_open(int id) {
+    if(id < 0 || id >= CHANNEL_MAX) return NULL;
+    
+    uint32_t flags = irq_save();
+    IpcChannel* ring = channels[id].ring;
+    if(!ring || ring == (IpcChannel*)1) {
+        irq_restore(flags);
+        return NULL;
+    }
+    Process* proc = get_current_process();
+    if(!(proc->channels & (1u << id))) {
+        proc->channels |= 1u << id;
+        channels[id].refs++;
+    }
+    irq_restore(flags);
+    
+    return ring;
+}
+
+// Drop this process's reference, the pages go once every holder has closed.
+// The pointer comes from user space, so it is only trusted once it is
+// found in the table; it may be stale or already freed.
+int channel_close(IpcChannel* channel) {
+    if(!channel || channel == (IpcChannel*)1) return -1;
+    
+    uint32_t flags = irq_save();
+    int id = 0;
+    while(id < CHANNEL_MAX && channels[id].ring != channel) {
+        id++;
+    }
+    Process* proc = get_current_process();
+    if(id == CHANNEL_MAX || !(proc->channels & (1u << id))) {
+        irq_restore(flags);
+        return -1;
+    }
+    proc->channels &= ~(1u << id);
+    channel_put(&channels[id], flags);
+    return 0;
+}
+
+// Process exit: drop the references it still holds
+void channel_release(Process* proc) {
+    for(int id = 0; id < CHANNEL_MAX; id++) {
+        uint32_t flags = irq_save();
+        if(proc->channels & (1u << id)) {
+            proc->channels &= ~(1u << id);
+            channel_put(&channels[id], flags);
+        } else {
+            irq_restore(flags);
+        }
+    }
+}
@@ -0,0 +1,68 @@
+// kernel/process/futex.c
+// Fast userspace mutex support (FUTEX_WAIT / FUTEX_WAKE)
+
+#include "../include/kernel.h"
+#include "../include/process.h"
+#include "../include/memory.h"
+
+#define FUTEX_HASH_SIZE 64
+
+// Waiters for every futex word hashing to the same bucket
+static WaitQueue futex_queues[FUTEX_HASH_SIZE];
+
+// Key on the physical address so every mapping of a word shares waiters
+static uint32_t futex_key(volatile int* uaddr) {
+    return virt_to_phys((unsigned int)uaddr);
+}
+
+static uint32_t futex_hash(uint32_t key) {
+    return ((key >> 2) * 2654435761u) >> 26; // Top 6 bits
+}
+
+// Sleep until woken, unless *uaddr no longer holds the expected value
+int futex_wait(volatile int* uaddr, int val) {
+    uint32_t key = futex_key(uaddr);
+    if(key == (uint32_t)-1) {
+        return -1; // Not mapped
+    }
+    
+    uint32_t flags = irq_save();
+    
+    // Checked with interrupts off so a wake can't slip in before we sleep
+    if(*uaddr != val) {
+        irq_restore(flags);
+        return -1;
+    }
+    
+    get_current_thread()->futex_key = key;
+    sleep_on(&futex_queues[futex_hash(key)]);
+    
+    irq_restore(flags);
+    return 0;
+}
+
+// Wake up to count threads waiting on uaddr, returns how many were woken
+int futex_wake(volatile int* uaddr, int count) {
+    uint32_t key = futex_key(uaddr);
+    if(key == (uint32_t)-1) {
+        return -1;
+    }
+    
+    uint32_t flags = irq_save();
+    Thread* thread = futex_queues[futex_hash(key)].head;
+    int woken = 0;
+    
+    // Other keys may share the bucket, only wake exact matches
+    while(thread && woken < count) {
+        Thread* next = thread->run_next;
+        if(thread->futex_key == key) {
+            unlink_thread(thread);
+            make_ready(thread);
+            woken++;
+        }
+        thread = next;
+    }
+    
+    irq_restore(flags);
+    return woken;
+}
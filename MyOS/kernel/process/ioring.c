@@ -0,0 +1,345 @@
+// kernel/process/ioring.c
+// Submission/completion rings: batches of system calls run on kernel workers
+
+#include "../include/kernel.h"
+#include "../include/process.h"
+#include "../include/memory.h"
+#include "../include/filesystem.h"
+
+// Each ring has its own workers, so operations that block for long, like a
+// read from an empty pipe, tie up neither the shared workqueue nor other
+// rings. A ring gets a new worker whenever none is idle, up to this many.
+#define IORING_MAX_WORKERS 8
+
+struct io_request;
+
+typedef struct {
+    IoRing* ring;
+    Process* owner;           // NULL once it has exited
+    uint32_t owner_pid;
+    uint32_t inflight;        // Submitted, completion not yet posted
+    int open;
+    WaitQueue cq_wait;        // ring_enter() waiting for completions
+    struct io_request* head;  // Submitted, waiting for a worker
+    struct io_request* tail;
+    uint32_t queued;
+    uint32_t nr_workers;
+    uint32_t nr_idle;
+    WaitQueue work_wait;      // Idle workers
+} RingEntry;
+
+// One submitted operation, owned by the worker that runs it
+typedef struct io_request {
+    struct io_request* next;
+    RingEntry* entry;
+    IoSqe sqe;
+    File* file;               // Reference taken at submission
+} IoRequest;
+
+static RingEntry rings[IORING_MAX];
+
+static IoSqe* ring_sqe(IoRing* ring, uint32_t pos) {
+    return (IoSqe*)((char*)ring + ring->sq_offset) + (pos & (ring->sq_entries - 1));
+}
+
+static IoCqe* ring_cqe(IoRing* ring, uint32_t pos) {
+    return (IoCqe*)((char*)ring + ring->cq_offset) + (pos & (ring->cq_entries - 1));
+}
+
+static RingEntry* ring_entry(int id) {
+    if(id < 0 || id >= IORING_MAX) return NULL;
+    RingEntry* entry = &rings[id];
+    if(!entry->ring || entry->ring == (IoRing*)1 || !entry->open) return NULL;
+    if(entry->owner != get_current_process()) return NULL;
+    return entry;
+}
+
+// Give the pages back once the ring is closed, nothing is in flight and its
+// workers are gone (interrupts must be disabled, restored here)
+static void ring_put(RingEntry* entry, uint32_t flags) {
+    if(entry->open || entry->inflight || entry->nr_workers) {
+        irq_restore(flags);
+        return;
+    }
+    IoRing* ring = entry->ring;
+    entry->ring = NULL;
+    irq_restore(flags);
+    
+    free_pages(ring, ring->size / PAGE_SIZE);
+}
+
+IoRing* ioring_setup(uint32_t entries) {
+    if(entries < 2 || entries > IORING_MAX_ENTRIES) return NULL;
+    if(entries & (entries - 1)) return NULL;
+    
+    uint32_t sq_offset = (sizeof(IoRing) + 63) & ~63;
+    uint32_t cq_offset = sq_offset + entries * sizeof(IoSqe);
+    uint32_t size = cq_offset + entries * 2 * sizeof(IoCqe);
+    uint32_t npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    
+    uint32_t flags = irq_save();
+    int id = 0;
+    while(id < IORING_MAX && rings[id].ring) {
+        id++;
+    }
+    if(id == IORING_MAX) {
+        irq_restore(flags);
+        return NULL;
+    }
+    rings[id].ring = (IoRing*)1; // Reserve the entry while we allocate
+    irq_restore(flags);
+    
+    // Mapped at the same address in every process, like channels
+    IoRing* ring = (IoRing*)alloc_pages(npages);
+    if(!ring) {
+        rings[id].ring = NULL;
+        return NULL;
+    }
+    memset(ring, 0, sizeof(IoRing));
+    
+    ring->id = id;
+    ring->sq_entries = entries;
+    ring->cq_entries = entries * 2;
+    ring->sq_offset = sq_offset;
+    ring->cq_offset = cq_offset;
+    ring->size = npages * PAGE_SIZE;
+    
+    RingEntry* entry = &rings[id];
+    entry->owner = get_current_process();
+    entry->owner_pid = entry->owner->pid;
+    entry->inflight = 0;
+    entry->open = 1;
+    wait_queue_init(&entry->cq_wait);
+    entry->head = NULL;
+    entry->tail = NULL;
+    entry->queued = 0;
+    entry->nr_workers = 0;
+    entry->nr_idle = 0;
+    wait_queue_init(&entry->work_wait);
+    entry->ring = ring;
+    return ring;
+}
+
+static void post_completion(RingEntry* entry, uint32_t user_data, int result) {
+    uint32_t flags = irq_save();
+    IoRing* ring = entry->ring;
+    
+    IoCqe* cqe = ring_cqe(ring, ring->cq_tail);
+    cqe->user_data = user_data;
+    cqe->result = result;
+    __sync_synchronize(); // The entry before the index that publishes it
+    ring->cq_tail++;
+    
+    entry->inflight--;
+    wake_up_all(&entry->cq_wait);
+    ring_put(entry, flags);
+}
+
+static int run_open(RingEntry* entry, IoSqe* sqe) {
+    File* file = file_open((const char*)sqe->addr, (int)sqe->arg);
+    if(!file) return -1;
+    
+    // Install into the submitter's table, unless it has exited meanwhile
+    uint32_t flags = irq_save();
+    int fd = entry->owner ? fd_install_in(entry->owner, file) : -1;
+    irq_restore(flags);
+    
+    if(fd < 0) {
+        file_put(file);
+    }
+    return fd;
+}
+
+static void run_request(IoRequest* req) {
+    IoSqe* sqe = &req->sqe;
+    int result = -1;
+    
+    switch(sqe->opcode) {
+        case IORING_OP_NOP:
+            result = 0;
+            break;
+        case IORING_OP_READ:
+            result = file_read(req->file, (void*)sqe->addr, sqe->length);
+            break;
+        case IORING_OP_WRITE:
+            result = file_write(req->file, (const void*)sqe->addr, sqe->length);
+            break;
+        case IORING_OP_OPEN:
+            result = run_open(req->entry, sqe);
+            break;
+        case IORING_OP_SEND:
+            result = send_message_from(req->entry->owner_pid, sqe->fd, sqe->arg,
+                                       (void*)sqe->addr, sqe->length, IPC_WAIT_FOREVER);
+            break;
+    }
+    
+    if(req->file) {
+        file_put(req->file);
+    }
+    post_completion(req->entry, sqe->user_data, result);
+    kfree(req);
+}
+
+// Runs the ring's requests until it is closed and nothing is left queued
+static void ring_worker(void* arg) {
+    RingEntry* entry = (RingEntry*)arg;
+    uint32_t flags = irq_save();
+    
+    while(1) {
+        while(!entry->head && entry->open) {
+            entry->nr_idle++;
+            sleep_on(&entry->work_wait);
+            entry->nr_idle--;
+        }
+        if(!entry->head) break;
+        
+        IoRequest* req = entry->head;
+        entry->head = req->next;
+        if(!entry->head) {
+            entry->tail = NULL;
+        }
+        entry->queued--;
+        irq_restore(flags);
+        
+        run_request(req);
+        flags = irq_save();
+    }
+    
+    // The last worker out frees a closed ring
+    entry->nr_workers--;
+    ring_put(entry, flags);
+}
+
+// Complete a request that no worker will run
+static void fail_request(IoRequest* req) {
+    if(req->file) {
+        file_put(req->file);
+    }
+    post_completion(req->entry, req->sqe.user_data, -1);
+    kfree(req);
+}
+
+// Hand one SQE to the workers. Descriptors are resolved here, in the
+// submitter's context; bad ones complete at once with -1.
+static void submit_one(RingEntry* entry, IoSqe* sqe) {
+    IoRequest* req = (IoRequest*)kmalloc(sizeof(IoRequest));
+    if(!req) {
+        post_completion(entry, sqe->user_data, -1);
+        return;
+    }
+    
+    req->entry = entry;
+    req->sqe = *sqe;
+    req->file = NULL;
+    
+    if(sqe->opcode == IORING_OP_READ || sqe->opcode == IORING_OP_WRITE) {
+        File* file = fd_get(sqe->fd);
+        if(!file) {
+            kfree(req);
+            post_completion(entry, sqe->user_data, -1);
+            return;
+        }
+        req->file = file_get(file);
+    }
+    
+    uint32_t flags = irq_save();
+    req->next = NULL;
+    if(entry->tail) {
+        entry->tail->next = req;
+    } else {
+        entry->head = req;
+    }
+    entry->tail = req;
+    entry->queued++;
+    
+    int grow = entry->queued > entry->nr_idle && entry->nr_workers < IORING_MAX_WORKERS;
+    if(grow) {
+        entry->nr_workers++;
+    }
+    wake_up(&entry->work_wait);
+    irq_restore(flags);
+    
+    if(!grow || create_kernel_thread("ioring", ring_worker, entry)) return;
+    
+    // Without any worker the queue would never drain
+    flags = irq_save();
+    entry->nr_workers--;
+    while(!entry->nr_workers && entry->head) {
+        IoRequest* stuck = entry->head;
+        entry->head = stuck->next;
+        if(!entry->head) {
+            entry->tail = NULL;
+        }
+        entry->queued--;
+        irq_restore(flags);
+        fail_request(stuck);
+        flags = irq_save();
+    }
+    irq_restore(flags);
+}
+
+// Submit up to to_submit queued SQEs, then wait until at least min_complete
+// completions are ready. Returns the number submitted.
+int ioring_enter(int id, uint32_t to_submit, uint32_t min_complete) {
+    uint32_t flags = irq_save();
+    RingEntry* entry = ring_entry(id);
+    if(!entry) {
+        irq_restore(flags);
+        return -1;
+    }
+    IoRing* ring = entry->ring;
+    
+    int submitted = 0;
+    while(to_submit-- > 0 && ring->sq_head != ring->sq_tail) {
+        // Keep room for every completion we have promised
+        uint32_t unread = ring->cq_tail - ring->cq_head;
+        if(entry->inflight + unread >= ring->cq_entries) break;
+        
+        IoSqe sqe = *ring_sqe(ring, ring->sq_head);
+        ring->sq_head++;
+        entry->inflight++;
+        submitted++;
+        
+        irq_restore(flags);
+        submit_one(entry, &sqe);
+        flags = irq_save();
+    }
+    
+    // Nothing left in flight means nothing more will arrive
+    while(entry->open && entry->inflight && ring->cq_tail - ring->cq_head < min_complete) {
+        sleep_on(&entry->cq_wait);
+    }
+    irq_restore(flags);
+    
+    return submitted;
+}
+
+int ioring_close(int id) {
+    uint32_t flags = irq_save();
+    RingEntry* entry = ring_entry(id);
+    if(!entry) {
+        irq_restore(flags);
+        return -1;
+    }
+    entry->open = 0;
+    entry->owner = NULL;
+    wake_up_all(&entry->work_wait);
+    ring_put(entry, flags);
+    return 0;
+}
+
+// Process exit: its rings close, in-flight work completes into the void
+void ioring_release(Process* proc) {
+    for(int id = 0; id < IORING_MAX; id++) {
+        uint32_t flags = irq_save();
+        RingEntry* entry = &rings[id];
+        if(entry->ring && entry->ring != (IoRing*)1 && entry->open && entry->owner == proc) {
+            entry->open = 0;
+            entry->owner = NULL;
+            wake_up_all(&entry->work_wait);
+            ring_put(entry, flags);
+        } else {
+            irq_restore(flags);
+        }
+    }
+}
@@ -0,0 +1,187 @@
+// kernel/process/mutex.c
+// Sleeping kernel mutexes with priority inheritance
+// Build with -DMUTEX_DEBUG to record the longest blocking chains
+
+#include "../include/kernel.h"
+#include "../include/process.h"
+
+#ifdef MUTEX_DEBUG
+static MutexDebugStats debug_stats;
+#endif
+
+void kmutex_init(KMutex* mutex, const char* name) {
+    mutex->name = name;
+    mutex->owner = NULL;
+    wait_queue_init(&mutex->waiters);
+    mutex->next_held = NULL;
+}
+
+static Thread* top_waiter(KMutex* mutex) {
+    Thread* best = mutex->waiters.head;
+    for(Thread* thread = best; thread; thread = thread->run_next) {
+        if(thread->priority > best->priority) {
+            best = thread;
+        }
+    }
+    return best;
+}
+
+// Base priority raised by the best waiter on any mutex the thread holds
+static uint32_t inherited_priority(Thread* thread) {
+    uint32_t priority = thread->base_priority;
+    
+    for(KMutex* mutex = thread->held_mutexes; mutex; mutex = mutex->next_held) {
+        Thread* waiter = top_waiter(mutex);
+        if(waiter && waiter->priority > priority) {
+            priority = waiter->priority;
+        }
+    }
+    return priority;
+}
+
+static void take_ownership(KMutex* mutex, Thread* thread) {
+    mutex->owner = thread;
+    mutex->next_held = thread->held_mutexes;
+    thread->held_mutexes = mutex;
+}
+
+static void release_ownership(KMutex* mutex, Thread* thread) {
+    KMutex** link = &thread->held_mutexes;
+    while(*link && *link != mutex) {
+        link = &(*link)->next_held;
+    }
+    if(*link) {
+        *link = mutex->next_held;
+    }
+    mutex->next_held = NULL;
+    mutex->owner = NULL;
+}
+
+// Lend our priority to the owner and to whoever that owner waits on
+static void boost_chain(KMutex* mutex, Thread* self) {
+    uint32_t depth = 0;
+#ifdef MUTEX_DEBUG
+    const char* chain[MUTEX_MAX_CHAIN];
+    uint32_t chain_tids[MUTEX_MAX_CHAIN];
+#endif
+
+    while(mutex && mutex->owner && depth < MUTEX_MAX_CHAIN) {
+        Thread* owner = mutex->owner;
+
+#ifdef MUTEX_DEBUG
+        chain[depth] = mutex->name;
+        chain_tids[depth] = owner->tid;
+#endif
+        depth++;
+        
+        if(owner->priority >= self->priority) {
+            break;
+        }
+        set_thread_priority(owner, self->priority);
+        mutex = owner->blocked_on;
+    }
+
+#ifdef MUTEX_DEBUG
+    if(depth > debug_stats.max_chain) {
+        debug_stats.max_chain = depth;
+        for(uint32_t i = 0; i < depth; i++) {
+            debug_stats.chain[i] = chain[i];
+            debug_stats.chain_tids[i] = chain_tids[i];
+        }
+    }
+#endif
+}
+
+// Blocking lends our priority to the owner until it unlocks
+void kmutex_lock(KMutex* mutex) {
+    uint32_t flags = irq_save();
+    Thread* self = get_current_thread();
+    
+    if(!mutex->owner) {
+        take_ownership(mutex, self);
+        irq_restore(flags);
+        return;
+    }
+
+#ifdef MUTEX_DEBUG
+    uint64_t start = rdtsc();
+    debug_stats.contentions++;
+#endif
+
+    self->blocked_on = mutex;
+    boost_chain(mutex, self);
+    
+    // Unlock hands ownership over directly, so there is no retry race
+    while(mutex->owner != self) {
+        sleep_on(&mutex->waiters);
+    }
+    self->blocked_on = NULL;
+
+#ifdef MUTEX_DEBUG
+    uint64_t waited = rdtsc() - start;
+    if(waited > debug_stats.max_wait_cycles) {
+        debug_stats.max_wait_cycles = waited;
+        debug_stats.max_wait_mutex = mutex->name;
+        debug_stats.max_wait_tid = self->tid;
+    }
+#endif
+
+    irq_restore(flags);
+}
+
+int kmutex_trylock(KMutex* mutex) {
+    uint32_t flags = irq_save();
+    int result = -1;
+    
+    if(!mutex->owner) {
+        take_ownership(mutex, get_current_thread());
+        result = 0;
+    }
+    
+    irq_restore(flags);
+    return result;
+}
+
+void kmutex_unlock(KMutex* mutex) {
+    uint32_t flags = irq_save();
+    Thread* self = get_current_thread();
+    
+    release_ownership(mutex, self);
+    
+    Thread* next = top_waiter(mutex);
+    if(next) {
+        unlink_thread(next);
+        take_ownership(mutex, next);
+        make_ready(next);
+    }
+    
+    // Give back any priority borrowed through this mutex
+    set_thread_priority(self, inherited_priority(self));
+    
+    irq_restore(flags);
+    check_preempt();
+}
+
+void thread_set_base_priority(Thread* thread, uint32_t priority) {
+    if(priority >= NR_PRIORITIES) {
+        priority = NR_PRIORITIES - 1;
+    }
+    
+    uint32_t flags = irq_save();
+    thread->base_priority = priority;
+    set_thread_priority(thread, inherited_priority(thread));
+    
+    // A lower owner may now need our new priority
+    if(thread->blocked_on) {
+        boost_chain(thread->blocked_on, thread);
+    }
+    irq_restore(flags);
+}
+
+#ifdef MUTEX_DEBUG
+void kmutex_get_debug_stats(MutexDebugStats* stats) {
+    uint32_t flags = irq_save();
+    *stats = debug_stats;
+    irq_restore(flags);
+}
+#endif
@@ -0,0 +1,27 @@
+; kernel/process/switch_asm.asm
+; Thread context switch
+
+[BITS 32]
+
+global switch_context
+
+; void switch_context(uint32_t* old_esp, uint32_t new_esp)
+; Saves callee-saved registers on the current stack, stores the stack
+; pointer in *old_esp and resumes the thread whose stack is new_esp.
+switch_context:
+    mov eax, [esp + 4]       ; old_esp
+    mov edx, [esp + 8]       ; new_esp
+
+    push ebp
+    push ebx
+    push esi
+    push edi
+
+    mov [eax], esp           ; Save current stack pointer
+    mov esp, edx             ; Switch to the new thread's stack
+
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret                      ; Resume where the new thread left off
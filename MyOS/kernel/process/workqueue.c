@@ -0,0 +1,264 @@
+// kernel/process/workqueue.c
+// Kernel worker threads for deferred work
+
+#include "../include/kernel.h"
+#include "../include/process.h"
+#include "../include/memory.h"
+
+#define WQ_MIN_WORKERS 1
+#define WQ_MAX_WORKERS 4
+
+// Per-CPU pool of worker threads sharing one queue
+typedef struct {
+    int cpu;
+    Work* head;
+    Work* tail;
+    uint32_t pending;      // Queued but not started
+    uint32_t running;      // Currently executing
+    uint32_t nr_workers;
+    uint32_t nr_idle;
+    uint32_t completed;
+    WaitQueue more_work;   // Idle workers
+    WaitQueue flush_wait;  // Callers of flush_workqueue()
+} WorkerPool;
+
+// Work item wrapping a plain function call
+typedef struct {
+    Work work;
+    void (*func)(void* data);
+    void* data;
+} FnWork;
+
+static WorkerPool worker_pools[NR_CPUS];
+static DelayedWork* delayed_list = NULL; // Sorted by expiry
+
+static void worker_thread(void* arg);
+
+static int start_worker(WorkerPool* pool) {
+    char name[16];
+    strcpy(name, "kworker/0:0");
+    name[8] = '0' + pool->cpu;
+    name[10] = '0' + pool->nr_workers;
+    
+    pool->nr_workers++;
+    if(!create_kernel_thread(name, worker_thread, pool)) {
+        pool->nr_workers--;
+        return -1;
+    }
+    return 0;
+}
+
+void init_workqueues(void) {
+    for(int cpu = 0; cpu < NR_CPUS; cpu++) {
+        WorkerPool* pool = &worker_pools[cpu];
+        pool->cpu = cpu;
+        wait_queue_init(&pool->more_work);
+        wait_queue_init(&pool->flush_wait);
+        
+        for(int i = 0; i < WQ_MIN_WORKERS; i++) {
+            start_worker(pool);
+        }
+    }
+    
+    print("Workqueues initialized\n");
+}
+
+void init_work(Work* work, void (*func)(Work* work), void* data) {
+    work->func = func;
+    work->data = data;
+    work->flags = 0;
+    work->next = NULL;
+}
+
+void init_delayed_work(DelayedWork* dwork, void (*func)(Work* work), void* data) {
+    init_work(&dwork->work, func, data);
+    dwork->expires = 0;
+    dwork->next = NULL;
+}
+
+// Append to a pool and wake a worker (interrupts must be disabled)
+static void insert_work(WorkerPool* pool, Work* work) {
+    work->next = NULL;
+    if(pool->tail) {
+        pool->tail->next = work;
+    } else {
+        pool->head = work;
+    }
+    pool->tail = work;
+    pool->pending++;
+    
+    wake_up(&pool->more_work);
+}
+
+// Returns 1 if queued, 0 if the work was already pending
+int queue_work(Work* work) {
+    uint32_t flags = irq_save();
+    
+    if(work->flags & WORK_PENDING) {
+        irq_restore(flags);
+        return 0;
+    }
+    
+    work->flags |= WORK_PENDING;
+    insert_work(&worker_pools[cpu_id()], work);
+    
+    irq_restore(flags);
+    return 1;
+}
+
+static void run_fn_work(Work* work) {
+    FnWork* fn = (FnWork*)work->data;
+    fn->func(fn->data);
+}
+
+// Run func(data) on a worker without the caller owning a Work item
+int queue_work_fn(void (*func)(void* data), void* data) {
+    FnWork* fn = (FnWork*)kmalloc(sizeof(FnWork));
+    if(!fn) return -1;
+    
+    init_work(&fn->work, run_fn_work, fn);
+    fn->work.flags = WORK_AUTOFREE;
+    fn->func = func;
+    fn->data = data;
+    
+    queue_work(&fn->work);
+    return 0;
+}
+
+int queue_delayed_work(DelayedWork* dwork, uint32_t delay_ticks) {
+    if(delay_ticks == 0) {
+        return queue_work(&dwork->work);
+    }
+    
+    uint32_t flags = irq_save();
+    
+    if(dwork->work.flags & WORK_PENDING) {
+        irq_restore(flags);
+        return 0;
+    }
+    
+    dwork->work.flags |= WORK_PENDING;
+    dwork->expires = get_timer_ticks() + delay_ticks;
+    
+    // Keep the list sorted so the timer only has to look at the head
+    DelayedWork** link = &delayed_list;
+    while(*link && (int32_t)((*link)->expires - dwork->expires) <= 0) {
+        link = &(*link)->next;
+    }
+    dwork->next = *link;
+    *link = dwork;
+    
+    irq_restore(flags);
+    return 1;
+}
+
+// Returns 1 if the work was pending and has been cancelled
+int cancel_delayed_work(DelayedWork* dwork) {
+    uint32_t flags = irq_save();
+    int cancelled = 0;
+    
+    DelayedWork** link = &delayed_list;
+    while(*link && *link != dwork) {
+        link = &(*link)->next;
+    }
+    
+    if(*link) {
+        *link = dwork->next;
+        cancelled = 1;
+    } else if(dwork->work.flags & WORK_PENDING) {
+        // Timer already fired, pull it back off the pool queue
+        WorkerPool* pool = &worker_pools[cpu_id()];
+        Work* prev = NULL;
+        for(Work* work = pool->head; work; prev = work, work = work->next) {
+            if(work == &dwork->work) {
+                if(prev) {
+                    prev->next = work->next;
+                } else {
+                    pool->head = work->next;
+                }
+                if(pool->tail == work) {
+                    pool->tail = prev;
+                }
+                pool->pending--;
+                cancelled = 1;
+                break;
+            }
+        }
+    }
+    
+    if(cancelled) {
+        dwork->work.flags &= ~WORK_PENDING;
+    }
+    
+    irq_restore(flags);
+    return cancelled;
+}
+
+// Called from the timer interrupt
+void workqueue_tick(uint32_t now) {
+    while(delayed_list && (int32_t)(now - delayed_list->expires) >= 0) {
+        DelayedWork* dwork = delayed_list;
+        delayed_list = dwork->next;
+        dwork->next = NULL;
+        
+        insert_work(&worker_pools[cpu_id()], &dwork->work);
+    }
+}
+
+// Wait until all queued work has finished. Must not be called from a work item.
+void flush_workqueue(void) {
+    WorkerPool* pool = &worker_pools[cpu_id()];
+    uint32_t flags = irq_save();
+    
+    while(pool->head || pool->running) {
+        sleep_on(&pool->flush_wait);
+    }
+    
+    irq_restore(flags);
+}
+
+static void worker_thread(void* arg) {
+    WorkerPool* pool = (WorkerPool*)arg;
+    uint32_t flags = irq_save();
+    
+    while(1) {
+        while(!pool->head) {
+            pool->nr_idle++;
+            sleep_on(&pool->more_work);
+            pool->nr_idle--;
+        }
+        
+        Work* work = pool->head;
+        pool->head = work->next;
+        if(!pool->head) {
+            pool->tail = NULL;
+        }
+        pool->pending--;
+        pool->running++;
+        work->flags &= ~WORK_PENDING;
+        
+        // Backlog and nobody idle to take it: grow the pool
+        int grow = pool->pending > 0 && pool->nr_idle == 0 &&
+                   pool->nr_workers < WQ_MAX_WORKERS;
+        
+        irq_restore(flags);
+        
+        if(grow) {
+            start_worker(pool);
+        }
+        
+        int autofree = work->flags & WORK_AUTOFREE;
+        work->func(work);
+        if(autofree) {
+            kfree(work);
+        }
+        
+        flags = irq_save();
+        pool->running--;
+        pool->completed++;
+        
+        if(!pool->head && !pool->running) {
+            wake_up_all(&pool->flush_wait);
+        }
+    }
+}
@@ -0,0 +1,145 @@
+// userspace/lib/libc/channel.c
+// Shared-memory ring channels for streaming between processes
+
+#include "channel.h"
+#include "../../../kernel/include/kernel.h"
+#include "../../../kernel/include/process.h"
+
+// System call numbers
+#define SYS_FUTEX 11
+#define SYS_CHANNEL_CREATE 19
+#define SYS_CHANNEL_OPEN 20
+#define SYS_CHANNEL_CLOSE 21
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+static int futex(volatile int* addr, int op, int val) {
+    return syscall(SYS_FUTEX, (int)addr, op, val);
+}
+
+static ChannelSlot* slot_at(ipc_channel_t* channel, uint32_t pos) {
+    uint32_t index = pos & (channel->nr_slots - 1);
+    return (ChannelSlot*)((char*)channel + channel->data_offset + index * channel->slot_stride);
+}
+
+static int ring_full(ipc_channel_t* channel) {
+    uint32_t pos = channel->tail;
+    return (int32_t)(__atomic_load_n(&slot_at(channel, pos)->seq, __ATOMIC_ACQUIRE) - pos) < 0;
+}
+
+static int ring_empty(ipc_channel_t* channel) {
+    uint32_t pos = channel->head;
+    return (int32_t)(__atomic_load_n(&slot_at(channel, pos)->seq, __ATOMIC_ACQUIRE) - (pos + 1)) < 0;
+}
+
+ipc_channel_t* ipc_channel_create(unsigned int slot_size, unsigned int nr_slots) {
+    int addr = syscall(SYS_CHANNEL_CREATE, slot_size, nr_slots, 0);
+    return addr == -1 ? NULL : (ipc_channel_t*)addr;
+}
+
+ipc_channel_t* ipc_channel_open(int id) {
+    int addr = syscall(SYS_CHANNEL_OPEN, id, 0, 0);
+    return addr == -1 ? NULL : (ipc_channel_t*)addr;
+}
+
+int ipc_channel_id(ipc_channel_t* channel) {
+    return channel->id;
+}
+
+void ipc_channel_close(ipc_channel_t* channel) {
+    syscall(SYS_CHANNEL_CLOSE, (int)channel, 0, 0);
+}
+
+int ipc_channel_try_send(ipc_channel_t* channel, const void* data, unsigned int length) {
+    if(length > channel->slot_size) return -1;
+    
+    uint32_t pos = channel->tail;
+    ChannelSlot* slot;
+    while(1) {
+        slot = slot_at(channel, pos);
+        int32_t diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        
+        if(diff == 0) {
+            // Free for this position, claim it against other producers
+            if(__atomic_compare_exchange_n(&channel->tail, &pos, pos + 1, 0,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+            // Lost the race, pos now holds the new tail
+        } else if(diff < 0) {
+            return -1; // Full, the consumer has not freed this slot yet
+        } else {
+            pos = channel->tail;
+        }
+    }
+    
+    memcpy(slot + 1, data, length);
+    slot->length = length;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    
+    // Pairs with the barrier in ipc_channel_recv(), one of us sees the other
+    __sync_synchronize();
+    if(channel->data_waiting) {
+        __sync_fetch_and_add(&channel->data_seq, 1);
+        futex(&channel->data_seq, FUTEX_WAKE, 1);
+    }
+    return 0;
+}
+
+int ipc_channel_send(ipc_channel_t* channel, const void* data, unsigned int length) {
+    if(length > channel->slot_size) return -1;
+    
+    while(ipc_channel_try_send(channel, data, length) != 0) {
+        int seq = channel->space_seq;
+        
+        // Locked add is a full barrier, so the recheck cannot miss a free slot
+        __sync_fetch_and_add(&channel->space_waiting, 1);
+        if(ring_full(channel)) {
+            futex(&channel->space_seq, FUTEX_WAIT, seq);
+        }
+        __sync_fetch_and_sub(&channel->space_waiting, 1);
+    }
+    return 0;
+}
+
+// Returns the message length, or -1 if the ring is empty
+int ipc_channel_try_recv(ipc_channel_t* channel, void* buffer, unsigned int size) {
+    uint32_t pos = channel->head;
+    ChannelSlot* slot = slot_at(channel, pos);
+    
+    if((int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1)) < 0) {
+        return -1;
+    }
+    
+    uint32_t length = slot->length < size ? slot->length : size;
+    memcpy(buffer, slot + 1, length);
+    
+    // Hand the slot back for the position one lap ahead
+    __atomic_store_n(&slot->seq, pos + channel->nr_slots, __ATOMIC_RELEASE);
+    channel->head = pos + 1;
+    
+    __sync_synchronize();
+    if(channel->space_waiting) {
+        __sync_fetch_and_add(&channel->space_seq, 1);
+        futex(&channel->space_seq, FUTEX_WAKE, 0x7FFFFFFF);
+    }
+    return length;
+}
+
+int ipc_channel_recv(ipc_channel_t* channel, void* buffer, unsigned int size) {
+    int length;
+    
+    while((length = ipc_channel_try_recv(channel, buffer, size)) < 0) {
+        int seq = channel->data_seq;
+        
+        // Announce we are going to sleep, then check once more
+        channel->data_waiting = 1;
+        __sync_synchronize();
+        if(ring_empty(channel)) {
+            futex(&channel->data_seq, FUTEX_WAIT, seq);
+        }
+        channel->data_waiting = 0;
+    }
+    return length;
+}
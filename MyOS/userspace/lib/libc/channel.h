@@ -0,0 +1,23 @@
+// userspace/lib/libc/channel.h
+// Shared-memory ring channels for streaming between processes
+
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+typedef struct ipc_channel ipc_channel_t;
+
+// A ring of nr_slots (a power of two) messages of up to slot_size bytes.
+// The creator is opened too; pass ipc_channel_id() to the other side.
+ipc_channel_t* ipc_channel_create(unsigned int slot_size, unsigned int nr_slots);
+ipc_channel_t* ipc_channel_open(int id);
+int ipc_channel_id(ipc_channel_t* channel);
+void ipc_channel_close(ipc_channel_t* channel);
+
+// Any number of producers and a single consumer. The try_ variants return
+// -1 instead of blocking; nothing enters the kernel unless a side sleeps.
+int ipc_channel_send(ipc_channel_t* channel, const void* data, unsigned int length);
+int ipc_channel_try_send(ipc_channel_t* channel, const void* data, unsigned int length);
+int ipc_channel_recv(ipc_channel_t* channel, void* buffer, unsigned int size);
+int ipc_channel_try_recv(ipc_channel_t* channel, void* buffer, unsigned int size);
+
+#endif
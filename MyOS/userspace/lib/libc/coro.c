@@ -0,0 +1,330 @@
+// userspace/lib/libc/coro.c
+// Stackful coroutines scheduled over a few kernel threads
+
+#include "coro.h"
+#include "sync.h"
+#include "thread.h"
+#include "stdlib.h"
+#include "../../../kernel/include/kernel.h"
+
+// System call numbers
+#define SYS_WRITE 1
+#define SYS_READ 2
+#define SYS_SLEEP 8
+
+#define CORO_RUNNING 0
+#define CORO_READY 1
+#define CORO_PARKED 2
+#define CORO_DONE 3
+
+struct coro {
+    uint32_t esp;              // Saved while switched out
+    void* stack;
+    void (*fn)(void* arg);
+    void* arg;
+    int state;
+    struct coro* next;         // Run queue link
+};
+
+// A kernel thread running tasks
+typedef struct {
+    uint32_t sched_esp;        // The worker loop's own context
+    coro_t* current;
+    void (*publish)(coro_t* self, void* arg);  // Run once current is switched out
+    void* publish_arg;
+    uthread_t thread;
+} Worker;
+
+// Blocking system call handed to an I/O thread
+typedef struct io_request {
+    int num;
+    int arg1;
+    int arg2;
+    int arg3;
+    int result;
+    coro_t* coro;
+    struct io_request* next;
+} IORequest;
+
+static mutex_t run_lock = MUTEX_INITIALIZER;
+static cond_t run_cond = COND_INITIALIZER;
+static coro_t* run_head = NULL;
+static coro_t* run_tail = NULL;
+static int live_tasks = 0;
+
+static mutex_t io_lock = MUTEX_INITIALIZER;
+static cond_t io_cond = COND_INITIALIZER;
+static IORequest* io_head = NULL;
+static IORequest* io_tail = NULL;
+static int io_shutdown = 0;
+
+// void coro_switch(uint32_t* save_esp, uint32_t new_esp)
+// Same frame as the kernel's switch_context(): only callee-saved registers
+// are pushed, so a switch is a handful of instructions
+void coro_switch(uint32_t* save_esp, uint32_t new_esp);
+asm(
+    ".text\n"
+    ".globl coro_switch\n"
+    "coro_switch:\n"
+    "    mov 4(%esp), %eax\n"
+    "    mov 8(%esp), %edx\n"
+    "    push %ebp\n"
+    "    push %ebx\n"
+    "    push %esi\n"
+    "    push %edi\n"
+    "    mov %esp, (%eax)\n"
+    "    mov %edx, %esp\n"
+    "    pop %edi\n"
+    "    pop %esi\n"
+    "    pop %ebx\n"
+    "    pop %ebp\n"
+    "    ret\n"
+);
+
+static Worker* current_worker(void) {
+    return (Worker*)uthread_self()->local;
+}
+
+// Append to the run queue (run_lock held)
+static void runq_append(coro_t* coro) {
+    coro->next = NULL;
+    if(run_tail) {
+        run_tail->next = coro;
+    } else {
+        run_head = coro;
+    }
+    run_tail = coro;
+    cond_signal(&run_cond);
+}
+
+static void runq_push(coro_t* coro) {
+    mutex_lock(&run_lock);
+    runq_append(coro);
+    mutex_unlock(&run_lock);
+}
+
+// Next task to run, or NULL once every task has finished
+static coro_t* runq_pop(void) {
+    mutex_lock(&run_lock);
+    while(!run_head && live_tasks > 0) {
+        cond_wait(&run_cond, &run_lock);
+    }
+    
+    coro_t* coro = run_head;
+    if(coro) {
+        run_head = coro->next;
+        if(!run_head) {
+            run_tail = NULL;
+        }
+    }
+    mutex_unlock(&run_lock);
+    return coro;
+}
+
+// First frame of every task
+static void coro_entry(void) {
+    coro_t* self = current_worker()->current;
+    self->fn(self->arg);
+    
+    // May have moved to another worker while running
+    self->state = CORO_DONE;
+    coro_switch(&self->esp, current_worker()->sched_esp);
+}
+
+int coro_spawn_stack(void (*fn)(void* arg), void* arg, unsigned int stack_size) {
+    coro_t* coro = (coro_t*)malloc(sizeof(coro_t));
+    if(!coro) return -1;
+    
+    coro->stack = malloc(stack_size);
+    if(!coro->stack) {
+        free(coro);
+        return -1;
+    }
+    
+    // Frame that coro_switch() will "return" into coro_entry()
+    uint32_t* sp = (uint32_t*)(((uint32_t)coro->stack + stack_size) & ~15);
+    *--sp = 0;                      // Return address of coro_entry
+    *--sp = (uint32_t)coro_entry;   // Return address of coro_switch
+    *--sp = 0;                      // ebp
+    *--sp = 0;                      // ebx
+    *--sp = 0;                      // esi
+    *--sp = 0;                      // edi
+    
+    coro->esp = (uint32_t)sp;
+    coro->fn = fn;
+    coro->arg = arg;
+    coro->state = CORO_READY;
+    
+    mutex_lock(&run_lock);
+    live_tasks++;
+    runq_append(coro);
+    mutex_unlock(&run_lock);
+    return 0;
+}
+
+int coro_spawn(void (*fn)(void* arg), void* arg) {
+    return coro_spawn_stack(fn, arg, CORO_STACK_SIZE);
+}
+
+static void* worker_main(void* arg) {
+    Worker* worker = (Worker*)arg;
+    uthread_self()->local = worker;
+    
+    coro_t* coro;
+    while((coro = runq_pop())) {
+        worker->current = coro;
+        coro->state = CORO_RUNNING;
+        coro_switch(&worker->sched_esp, coro->esp);
+        worker->current = NULL;
+        
+        // The task is switched out, nobody else can be running on its stack
+        switch(coro->state) {
+            case CORO_RUNNING: // Yielded
+                coro->state = CORO_READY;
+                runq_push(coro);
+                break;
+            case CORO_PARKED:
+                worker->publish(coro, worker->publish_arg);
+                break;
+            case CORO_DONE:
+                free(coro->stack);
+                free(coro);
+                
+                // Wake idle workers so they can exit when the last task is gone
+                mutex_lock(&run_lock);
+                if(--live_tasks == 0) {
+                    cond_broadcast(&run_cond);
+                }
+                mutex_unlock(&run_lock);
+                break;
+        }
+    }
+    return NULL;
+}
+
+static void* io_thread_main(void* arg) {
+    while(1) {
+        mutex_lock(&io_lock);
+        while(!io_head && !io_shutdown) {
+            cond_wait(&io_cond, &io_lock);
+        }
+        
+        IORequest* req = io_head;
+        if(!req) {
+            mutex_unlock(&io_lock);
+            break; // Shutting down and nothing left
+        }
+        io_head = req->next;
+        if(!io_head) {
+            io_tail = NULL;
+        }
+        mutex_unlock(&io_lock);
+        
+        req->result = syscall(req->num, req->arg1, req->arg2, req->arg3);
+        coro_unpark(req->coro);
+    }
+    return NULL;
+}
+
+int coro_run(int nr_workers) {
+    Worker workers[CORO_MAX_WORKERS];
+    uthread_t io_threads[CORO_IO_THREADS];
+    int nr_io = 0;
+    int started = 0;
+    
+    if(nr_workers < 1) nr_workers = 1;
+    if(nr_workers > CORO_MAX_WORKERS) nr_workers = CORO_MAX_WORKERS;
+    
+    io_shutdown = 0;
+    while(nr_io < CORO_IO_THREADS && uthread_create(&io_threads[nr_io], io_thread_main, NULL) == 0) {
+        nr_io++;
+    }
+    
+    while(started < nr_workers) {
+        workers[started].current = NULL;
+        if(uthread_create(&workers[started].thread, worker_main, &workers[started]) != 0) {
+            break;
+        }
+        started++;
+    }
+    
+    for(int i = 0; i < started; i++) {
+        uthread_join(workers[i].thread, NULL);
+    }
+    
+    mutex_lock(&io_lock);
+    io_shutdown = 1;
+    cond_broadcast(&io_cond);
+    mutex_unlock(&io_lock);
+    
+    for(int i = 0; i < nr_io; i++) {
+        uthread_join(io_threads[i], NULL);
+    }
+    
+    return started > 0 ? 0 : -1;
+}
+
+coro_t* coro_self(void) {
+    return current_worker()->current;
+}
+
+void coro_yield(void) {
+    coro_t* self = coro_self();
+    coro_switch(&self->esp, current_worker()->sched_esp);
+}
+
+void coro_park(void (*publish)(coro_t* self, void* arg), void* arg) {
+    Worker* worker = current_worker();
+    coro_t* self = worker->current;
+    
+    worker->publish = publish;
+    worker->publish_arg = arg;
+    self->state = CORO_PARKED;
+    coro_switch(&self->esp, worker->sched_esp);
+}
+
+void coro_unpark(coro_t* coro) {
+    coro->state = CORO_READY;
+    runq_push(coro);
+}
+
+static void submit_io(coro_t* self, void* arg) {
+    IORequest* req = (IORequest*)arg;
+    
+    mutex_lock(&io_lock);
+    req->next = NULL;
+    if(io_tail) {
+        io_tail->next = req;
+    } else {
+        io_head = req;
+    }
+    io_tail = req;
+    cond_signal(&io_cond);
+    mutex_unlock(&io_lock);
+}
+
+int coro_syscall(int num, int arg1, int arg2, int arg3) {
+    // Lives on our stack, which stays put while we are parked
+    IORequest req;
+    req.num = num;
+    req.arg1 = arg1;
+    req.arg2 = arg2;
+    req.arg3 = arg3;
+    req.result = -1;
+    req.coro = coro_self();
+    
+    coro_park(submit_io, &req);
+    return req.result;
+}
+
+int coro_read(int fd, void* buffer, int size) {
+    return coro_syscall(SYS_READ, fd, (int)buffer, size);
+}
+
+int coro_write(int fd, const void* buffer, int size) {
+    return coro_syscall(SYS_WRITE, fd, (int)buffer, size);
+}
+
+int coro_sleep(unsigned int ms) {
+    return coro_syscall(SYS_SLEEP, ms, 0, 0);
+}
@@ -0,0 +1,35 @@
+// userspace/lib/libc/coro.h
+// Stackful coroutines scheduled over a few kernel threads
+
+#ifndef CORO_H
+#define CORO_H
+
+#define CORO_STACK_SIZE 4096   // Default, a thousand tasks fit in about 4 MB
+#define CORO_MAX_WORKERS 8
+#define CORO_IO_THREADS 2      // Run blocking system calls for coroutines
+
+typedef struct coro coro_t;
+
+// Tasks may be spawned before coro_run() or from inside other tasks
+int coro_spawn(void (*fn)(void* arg), void* arg);
+int coro_spawn_stack(void (*fn)(void* arg), void* arg, unsigned int stack_size);
+
+// Run all tasks on nr_workers kernel threads, returns once every task is done
+int coro_run(int nr_workers);
+
+// The following may only be called from inside a task
+coro_t* coro_self(void);
+void coro_yield(void);
+
+// Suspend the task; publish(self, arg) runs once it is safely switched out
+// and must arrange for coro_unpark() to be called later
+void coro_park(void (*publish)(coro_t* self, void* arg), void* arg);
+void coro_unpark(coro_t* coro);
+
+// Blocking calls that suspend only the calling task
+int coro_syscall(int num, int arg1, int arg2, int arg3);
+int coro_read(int fd, void* buffer, int size);
+int coro_write(int fd, const void* buffer, int size);
+int coro_sleep(unsigned int ms);
+
+#endif
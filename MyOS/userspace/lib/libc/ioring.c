@@ -0,0 +1,86 @@
+// userspace/lib/libc/ioring.c
+// Batched asynchronous system calls through shared submission/completion rings
+
+#include "ioring.h"
+#include "../../../kernel/include/kernel.h"
+#include "../../../kernel/include/process.h"
+
+// System call numbers
+#define SYS_RING_SETUP 26
+#define SYS_RING_ENTER 27
+#define SYS_RING_CLOSE 28
+
+static IoSqe* next_sqe(ioring_t* ring) {
+    // Only we move the tail, the kernel moves the head
+    uint32_t tail = ring->sq_tail;
+    if(tail - __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) return NULL;
+    return (IoSqe*)((char*)ring + ring->sq_offset) + (tail & (ring->sq_entries - 1));
+}
+
+static int queue_sqe(ioring_t* ring, uint32_t opcode, int fd, uint32_t addr, uint32_t length, uint32_t arg, uint32_t user_data) {
+    IoSqe* sqe = next_sqe(ring);
+    if(!sqe) return -1;
+    
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = addr;
+    sqe->length = length;
+    sqe->arg = arg;
+    sqe->user_data = user_data;
+    __atomic_store_n(&ring->sq_tail, ring->sq_tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+ioring_t* ioring_create(unsigned int entries) {
+    int addr = syscall(SYS_RING_SETUP, entries, 0, 0);
+    return addr == -1 ? NULL : (ioring_t*)addr;
+}
+
+void ioring_destroy(ioring_t* ring) {
+    syscall(SYS_RING_CLOSE, ring->id, 0, 0);
+}
+
+int ioring_prep_read(ioring_t* ring, int fd, void* buffer, unsigned int size, unsigned int user_data) {
+    return queue_sqe(ring, IORING_OP_READ, fd, (uint32_t)buffer, size, 0, user_data);
+}
+
+int ioring_prep_write(ioring_t* ring, int fd, const void* buffer, unsigned int size, unsigned int user_data) {
+    return queue_sqe(ring, IORING_OP_WRITE, fd, (uint32_t)buffer, size, 0, user_data);
+}
+
+int ioring_prep_open(ioring_t* ring, const char* path, int flags, unsigned int user_data) {
+    return queue_sqe(ring, IORING_OP_OPEN, -1, (uint32_t)path, 0, flags, user_data);
+}
+
+int ioring_prep_send(ioring_t* ring, unsigned int pid, unsigned int type, const void* data, unsigned int length, unsigned int user_data) {
+    return queue_sqe(ring, IORING_OP_SEND, pid, (uint32_t)data, length, type, user_data);
+}
+
+int ioring_submit(ioring_t* ring) {
+    return ioring_submit_and_wait(ring, 0);
+}
+
+int ioring_submit_and_wait(ioring_t* ring, unsigned int wait_nr) {
+    uint32_t queued = ring->sq_tail - ring->sq_head;
+    return syscall(SYS_RING_ENTER, ring->id, queued, wait_nr);
+}
+
+int ioring_peek(ioring_t* ring, unsigned int* user_data, int* result) {
+    uint32_t head = ring->cq_head;
+    if(head == __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE)) return -1;
+    
+    IoCqe* cqe = (IoCqe*)((char*)ring + ring->cq_offset) + (head & (ring->cq_entries - 1));
+    *user_data = cqe->user_data;
+    *result = cqe->result;
+    __atomic_store_n(&ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int ioring_wait(ioring_t* ring, unsigned int* user_data, int* result) {
+    while(ioring_peek(ring, user_data, result) != 0) {
+        // Submits anything still queued as well
+        if(ioring_submit_and_wait(ring, 1) < 0) return -1;
+        if(ring->cq_head == ring->cq_tail) return -1; // Nothing in flight
+    }
+    return 0;
+}
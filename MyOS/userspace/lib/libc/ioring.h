@@ -0,0 +1,30 @@
+// userspace/lib/libc/ioring.h
+// Batched asynchronous system calls through shared submission/completion rings
+
+#ifndef IORING_H
+#define IORING_H
+
+typedef struct io_ring ioring_t;
+
+// entries is a power of two, at most 1024; one submitter thread per ring
+ioring_t* ioring_create(unsigned int entries);
+void ioring_destroy(ioring_t* ring);
+
+// Queue an operation without entering the kernel. Returns -1 when the
+// submission queue is full. user_data comes back with the completion.
+int ioring_prep_read(ioring_t* ring, int fd, void* buffer, unsigned int size, unsigned int user_data);
+int ioring_prep_write(ioring_t* ring, int fd, const void* buffer, unsigned int size, unsigned int user_data);
+int ioring_prep_open(ioring_t* ring, const char* path, int flags, unsigned int user_data);
+int ioring_prep_send(ioring_t* ring, unsigned int pid, unsigned int type, const void* data, unsigned int length, unsigned int user_data);
+
+// One ring_enter() call for everything queued, optionally waiting until
+// wait_nr completions are ready. Returns the number submitted.
+int ioring_submit(ioring_t* ring);
+int ioring_submit_and_wait(ioring_t* ring, unsigned int wait_nr);
+
+// Take the oldest completion. peek returns -1 if there is none yet, wait
+// blocks for one (and returns -1 if nothing is in flight).
+int ioring_peek(ioring_t* ring, unsigned int* user_data, int* result);
+int ioring_wait(ioring_t* ring, unsigned int* user_data, int* result);
+
+#endif
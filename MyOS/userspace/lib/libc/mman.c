@@ -0,0 +1,23 @@
+// userspace/lib/libc/mman.c
+// Memory mappings of files and anonymous memory
+
+#include "mman.h"
+#include "../../../kernel/include/kernel.h"
+
+// System call numbers
+#define SYS_MMAP 37
+#define SYS_MUNMAP 38
+#define SYS_MSYNC 39
+
+void* mmap(void* addr, unsigned int length, int prot, int flags, int fd, unsigned int offset) {
+    struct mmap_args args = {addr, length, prot, flags, fd, offset};
+    return (void*)syscall(SYS_MMAP, (int)&args, 0, 0);
+}
+
+int munmap(void* addr, unsigned int length) {
+    return syscall(SYS_MUNMAP, (int)addr, length, 0);
+}
+
+int msync(void* addr, unsigned int length, int flags) {
+    return syscall(SYS_MSYNC, (int)addr, length, flags);
+}
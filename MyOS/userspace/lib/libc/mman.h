@@ -0,0 +1,16 @@
+// userspace/lib/libc/mman.h
+// Memory mappings of files and anonymous memory
+
+#ifndef MMAN_H
+#define MMAN_H
+
+#include "../../../kernel/include/abi.h"  // PROT_*, MAP_* and MS_*
+
+// Returns MAP_FAILED on error; addr must be NULL, hints and MAP_FIXED are refused
+void* mmap(void* addr, unsigned int length, int prot, int flags, int fd, unsigned int offset);
+int munmap(void* addr, unsigned int length);
+
+// Write pages stored to through a MAP_SHARED mapping back to the file
+int msync(void* addr, unsigned int length, int flags);
+
+#endif
@@ -0,0 +1,49 @@
+// userspace/lib/libc/ps.c
+// Process list shared by the ps utility and the shell's ps command
+
+#include "ps.h"
+#include "stdio.h"
+#include "../../../kernel/include/kernel.h"
+#include "../../../kernel/include/process.h"
+
+#define SYS_PROCINFO 12
+#define MAX_PROCS 256
+
+static ProcInfo procs[MAX_PROCS];
+
+static const char* state_name(uint32_t state) {
+    switch(state) {
+        case PROC_RUNNING: return "RUNNING";
+        case PROC_READY: return "READY";
+        case PROC_BLOCKED: return "SLEEPING";
+        case PROC_TERMINATED: return "EXITING";
+        case PROC_ZOMBIE: return "ZOMBIE";
+        default: return "UNKNOWN";
+    }
+}
+
+int ps_run(void) {
+    int count = syscall(SYS_PROCINFO, (int)procs, MAX_PROCS, 0);
+    if(count < 0) {
+        printf("ps: cannot read process table\n");
+        return 1;
+    }
+    
+    uint64_t now = rdtsc();
+    printf("  PID  PPID STATE    PRI THR  %%CPU  RSS(KB)  USER(ms)   SYS(ms)   VCSW  IVCSW COMMAND\n");
+    
+    for(int i = 0; i < count; i++) {
+        ProcInfo* p = &procs[i];
+        
+        // Average CPU share over the process's lifetime, in tenths of a percent
+        uint64_t lifetime = now - p->start_tsc;
+        uint32_t cpu = lifetime ? (uint32_t)((p->user_cycles + p->sys_cycles) * 1000 / lifetime) : 0;
+        
+        printf("%5u %5u %-8s %3u %3u %3u.%u %8u %9u %9u %6u %6u %s\n",
+               p->pid, p->ppid, state_name(p->state), p->priority, p->nr_threads,
+               cpu / 10, cpu % 10, p->rss_bytes / 1024, p->user_ms, p->sys_ms,
+               p->nvcsw, p->nivcsw, p->name);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,11 @@
+// userspace/lib/libc/ps.h
+// Process list shared by the ps utility and the shell's ps command
+
+#ifndef PS_H
+#define PS_H
+
+// Print one line per process. Returns 0, or 1 if the process table
+// cannot be read.
+int ps_run(void);
+
+#endif
@@ -29,6 +29,25 @@ int sprintf(char* str, const char* format, ...) {
     return result;
 }
 
+// Unsigned integer to string in the given base
+static char* utoa(unsigned int value, char* str, int base) {
+    char digits[32];
+    int len = 0;
+    
+    do {
+        int digit = value % base;
+        digits[len++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= base;
+    } while(value);
+    
+    for(int i = 0; i < len; i++) {
+        str[i] = digits[len - 1 - i];
+    }
+    str[len] = '\0';
+    return str;
+}
+
+// Supports %d %u %x %s %c with optional '-', '0' and field width
 int vsprintf(char* str, const char* format, va_list args) {
     char* ptr = str;
     const char* fmt = format;
@@ -36,43 +55,67 @@ int vsprintf(char* str, const char* format, va_list args) {
     while(*fmt) {
         if(*fmt == '%') {
             fmt++;
+            
+            int left = 0;
+            char pad = ' ';
+            int width = 0;
+            if(*fmt == '-') {
+                left = 1;
+                fmt++;
+            }
+            if(*fmt == '0') {
+                pad = '0';
+                fmt++;
+            }
+            while(*fmt >= '0' && *fmt <= '9') {
+                width = width * 10 + (*fmt - '0');
+                fmt++;
+            }
+            if(*fmt == 'l') {
+                fmt++; // long is the same size as int
+            }
+            
+            char num_str[32];
+            const char* text = num_str;
             switch(*fmt) {
-                case 'd': {
-                    int val = va_arg(args, int);
-                    char num_str[32];
-                    itoa(val, num_str, 10);
-                    strcpy(ptr, num_str);
-                    ptr += strlen(num_str);
+                case 'd':
+                    itoa(va_arg(args, int), num_str, 10);
                     break;
-                }
-                case 'x': {
-                    unsigned int val = va_arg(args, unsigned int);
-                    char num_str[32];
-                    itoa(val, num_str, 16);
-                    strcpy(ptr, num_str);
-                    ptr += strlen(num_str);
+                case 'u':
+                    utoa(va_arg(args, unsigned int), num_str, 10);
                     break;
-                }
-                case 's': {
-                    char* val = va_arg(args, char*);
-                    strcpy(ptr, val);
-                    ptr += strlen(val);
+                case 'x':
+                    utoa(va_arg(args, unsigned int), num_str, 16);
                     break;
-                }
-                case 'c': {
-                    char val = va_arg(args, int);
-                    *ptr++ = val;
+                case 's':
+                    text = va_arg(args, char*);
                     break;
-                }
-                case '%': {
-                    *ptr++ = '%';
+                case 'c':
+                    num_str[0] = (char)va_arg(args, int);
+                    num_str[1] = '\0';
+                    break;
+                case '%':
+                    strcpy(num_str, "%");
                     break;
-                }
                 default:
-                    *ptr++ = '%';
-                    *ptr++ = *fmt;
+                    num_str[0] = '%';
+                    num_str[1] = *fmt;
+                    num_str[2] = '\0';
                     break;
             }
+            
+            int len = strlen(text);
+            if(pad == '0' && *text == '-') {
+                *ptr++ = *text++; // Sign goes before the zeros
+                len--;
+                width--;
+            }
+            if(!left) {
+                for(; width > len; width--) *ptr++ = pad;
+            }
+            strcpy(ptr, text);
+            ptr += len;
+            for(; width > len; width--) *ptr++ = ' ';
         } else {
             *ptr++ = *fmt;
         }
@@ -88,10 +131,13 @@ int putchar(int c) {
     return c;
 }
 
+// Returns -1 at end of input, e.g. once a pipe's writers are gone
 int getchar(void) {
     char ch;
-    syscall(SYS_READ, 0, (int)&ch, 1);
-    return ch;
+    if(syscall(SYS_READ, 0, (int)&ch, 1) <= 0) {
+        return -1;
+    }
+    return (unsigned char)ch;
 }
 
 int puts(const char* str) {
@@ -106,6 +152,9 @@ int puts(const char* str) {
 #include "string.h"
 #include "../../../kernel/include/memory.h"
 
+#define SYS_EXIT 0
+#define SYS_WAIT 13
+
 void* malloc(size_t size) {
     return kmalloc(size);
 }
@@ -197,11 +246,17 @@ char* itoa(int value, char* str, int base) {
 
 void exit(int status) {
     // Terminate current process
+    syscall(SYS_EXIT, status, 0, 0);
     while(1) {
         asm volatile("hlt");
     }
 }
 
+// Wait for a child (pid -1 for any) to exit, returns its pid
+int waitpid(int pid, int* status) {
+    return syscall(SYS_WAIT, pid, (int)status, 0);
+}
+
 int abs(int x) {
     return x < 0 ? -x : x;
 }
@@ -29,6 +29,7 @@ void* calloc(size_t num, size_t size);
 int atoi(const char* str);
 char* itoa(int value, char* str, int base);
 void exit(int status);
+int waitpid(int pid, int* status);
 int abs(int x);
 long labs(long x);
 int rand(void);
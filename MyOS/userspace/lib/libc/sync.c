@@ -0,0 +1,84 @@
+// userspace/lib/libc/sync.c
+// Mutexes and condition variables built on futexes
+
+#include "sync.h"
+#include "../../../kernel/include/kernel.h"
+
+// System call numbers
+#define SYS_FUTEX 11
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+static int futex(volatile int* addr, int op, int val) {
+    return syscall(SYS_FUTEX, (int)addr, op, val);
+}
+
+void mutex_init(mutex_t* mutex) {
+    mutex->state = 0;
+}
+
+void mutex_lock(mutex_t* mutex) {
+    // Uncontended: one atomic instruction, no system call
+    int c = __sync_val_compare_and_swap(&mutex->state, 0, 1);
+    if(c == 0) {
+        return;
+    }
+    
+    // Mark contended and sleep until the holder hands it back
+    if(c != 2) {
+        c = __atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE);
+    }
+    while(c != 0) {
+        futex(&mutex->state, FUTEX_WAIT, 2);
+        c = __atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+int mutex_trylock(mutex_t* mutex) {
+    return __sync_val_compare_and_swap(&mutex->state, 0, 1) == 0 ? 0 : -1;
+}
+
+void mutex_unlock(mutex_t* mutex) {
+    // Only enter the kernel if someone may be waiting
+    if(__sync_fetch_and_sub(&mutex->state, 1) != 1) {
+        mutex->state = 0;
+        futex(&mutex->state, FUTEX_WAKE, 1);
+    }
+}
+
+void cond_init(cond_t* cond) {
+    cond->seq = 0;
+    cond->waiters = 0;
+}
+
+void cond_wait(cond_t* cond, mutex_t* mutex) {
+    int seq = cond->seq;
+    
+    __sync_fetch_and_add(&cond->waiters, 1);
+    mutex_unlock(mutex);
+    
+    // Returns at once if a signal bumped seq after we sampled it
+    futex(&cond->seq, FUTEX_WAIT, seq);
+    
+    __sync_fetch_and_sub(&cond->waiters, 1);
+    
+    // Other waiters may have been woken too, so relock as contended
+    while(__atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        futex(&mutex->state, FUTEX_WAIT, 2);
+    }
+}
+
+void cond_signal(cond_t* cond) {
+    __sync_fetch_and_add(&cond->seq, 1);
+    if(cond->waiters) {
+        futex(&cond->seq, FUTEX_WAKE, 1);
+    }
+}
+
+void cond_broadcast(cond_t* cond) {
+    __sync_fetch_and_add(&cond->seq, 1);
+    if(cond->waiters) {
+        futex(&cond->seq, FUTEX_WAKE, 0x7FFFFFFF);
+    }
+}
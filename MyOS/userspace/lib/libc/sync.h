@@ -0,0 +1,30 @@
+// userspace/lib/libc/sync.h
+// Mutexes and condition variables built on futexes
+
+#ifndef SYNC_H
+#define SYNC_H
+
+// 0 = unlocked, 1 = locked, 2 = locked with waiters
+typedef struct {
+    volatile int state;
+} mutex_t;
+
+typedef struct {
+    volatile int seq;
+    volatile int waiters;
+} cond_t;
+
+#define MUTEX_INITIALIZER {0}
+#define COND_INITIALIZER {0, 0}
+
+void mutex_init(mutex_t* mutex);
+void mutex_lock(mutex_t* mutex);
+int mutex_trylock(mutex_t* mutex);
+void mutex_unlock(mutex_t* mutex);
+
+void cond_init(cond_t* cond);
+void cond_wait(cond_t* cond, mutex_t* mutex);
+void cond_signal(cond_t* cond);
+void cond_broadcast(cond_t* cond);
+
+#endif
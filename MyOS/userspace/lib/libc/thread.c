@@ -0,0 +1,57 @@
+// userspace/lib/libc/thread.c
+// Kernel-scheduled threads sharing the process address space
+
+#include "thread.h"
+#include "stdlib.h"
+#include "../../../kernel/include/kernel.h"
+
+// System call numbers
+#define SYS_THREAD_CREATE 14
+#define SYS_THREAD_JOIN 15
+#define SYS_THREAD_EXIT 16
+
+// Runs on the new thread, GS already points at its control block
+static void uthread_start(void* arg) {
+    uthread_t self = (uthread_t)arg;
+    uthread_exit(self->start(self->arg));
+}
+
+int uthread_create(uthread_t* thread, void* (*start)(void* arg), void* arg) {
+    uthread_t tcb = (uthread_t)malloc(sizeof(uthread_tcb));
+    if(!tcb) return -1;
+    
+    tcb->self = tcb;
+    tcb->start = start;
+    tcb->arg = arg;
+    tcb->local = NULL;
+    
+    tcb->tid = syscall(SYS_THREAD_CREATE, (int)uthread_start, (int)tcb, (int)tcb);
+    if(tcb->tid < 0) {
+        free(tcb);
+        return -1;
+    }
+    
+    *thread = tcb;
+    return 0;
+}
+
+// Wait for thread to finish, then release it
+int uthread_join(uthread_t thread, void** result) {
+    if(syscall(SYS_THREAD_JOIN, thread->tid, (int)result, 0) != 0) {
+        return -1;
+    }
+    free(thread);
+    return 0;
+}
+
+void uthread_exit(void* result) {
+    syscall(SYS_THREAD_EXIT, (int)result, 0, 0);
+    while(1); // Not reached
+}
+
+// Only meaningful in threads started by uthread_create()
+uthread_t uthread_self(void) {
+    uthread_t self;
+    asm volatile("mov %%gs:0, %0" : "=r"(self));
+    return self;
+}
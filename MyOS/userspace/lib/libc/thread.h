@@ -0,0 +1,23 @@
+// userspace/lib/libc/thread.h
+// Kernel-scheduled threads sharing the process address space
+
+#ifndef THREAD_H
+#define THREAD_H
+
+// Thread control block, GS points at it while the thread runs
+typedef struct uthread {
+    struct uthread* self;   // First word, so %gs:0 yields the block itself
+    int tid;
+    void* (*start)(void* arg);
+    void* arg;
+    void* local;            // Per-thread slot for runtime libraries
+} uthread_tcb;
+
+typedef uthread_tcb* uthread_t;
+
+int uthread_create(uthread_t* thread, void* (*start)(void* arg), void* arg);
+int uthread_join(uthread_t thread, void** result);
+void uthread_exit(void* result);
+uthread_t uthread_self(void);
+
+#endif
@@ -0,0 +1,99 @@
+// userspace/lib/libc/top.c
+// Process monitor shared by the top utility and the shell's top command
+
+#include "top.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "../../../kernel/include/kernel.h"
+#include "../../../kernel/include/process.h"
+
+#define SYS_SLEEP 8
+#define SYS_PROCINFO 12
+#define MAX_PROCS 256
+#define REFRESH_MS 1000
+
+static ProcInfo previous[MAX_PROCS];
+static ProcInfo current[MAX_PROCS];
+static uint32_t cpu[MAX_PROCS];   // Tenths of a percent over the last interval
+static int order[MAX_PROCS];
+
+// CPU cycles a process used since the previous sample
+static uint64_t cycles_since(ProcInfo* now, int prev_count) {
+    uint64_t total = now->user_cycles + now->sys_cycles;
+    
+    for(int i = 0; i < prev_count; i++) {
+        if(previous[i].pid == now->pid) {
+            return total - (previous[i].user_cycles + previous[i].sys_cycles);
+        }
+    }
+    return total; // Started during the interval
+}
+
+static void draw(int count) {
+    uint32_t running = 0;
+    uint32_t busy = 0;
+    
+    for(int i = 0; i < count; i++) {
+        if(current[i].state == PROC_RUNNING || current[i].state == PROC_READY) {
+            running++;
+        }
+        busy += cpu[i];
+    }
+    
+    printf("\033[2J\033[H");
+    printf("top - %u processes, %u runnable, CPU %u.%u%% busy (q to quit)\n\n",
+           count, running, busy / 10, busy % 10);
+    printf("  PID PRI THR  %%CPU  RSS(KB)  USER(ms)   SYS(ms)  IVCSW COMMAND\n");
+    
+    for(int i = 0; i < count; i++) {
+        ProcInfo* p = &current[order[i]];
+        uint32_t share = cpu[order[i]];
+        printf("%5u %3u %3u %3u.%u %8u %9u %9u %6u %s\n",
+               p->pid, p->priority, p->nr_threads, share / 10, share % 10,
+               p->rss_bytes / 1024, p->user_ms, p->sys_ms, p->nivcsw, p->name);
+    }
+}
+
+int top_run(void) {
+    int prev_count = syscall(SYS_PROCINFO, (int)previous, MAX_PROCS, 0);
+    if(prev_count < 0) {
+        printf("top: cannot read process table\n");
+        return 1;
+    }
+    uint64_t prev_tsc = rdtsc();
+    
+    while(1) {
+        syscall(SYS_SLEEP, REFRESH_MS, 0, 0);
+        
+        int count = syscall(SYS_PROCINFO, (int)current, MAX_PROCS, 0);
+        uint64_t now = rdtsc();
+        uint64_t elapsed = now - prev_tsc;
+        
+        // Insertion sort by CPU share, busiest first
+        for(int i = 0; i < count; i++) {
+            cpu[i] = elapsed ? (uint32_t)(cycles_since(&current[i], prev_count) * 1000 / elapsed) : 0;
+            
+            int j = i;
+            while(j > 0 && cpu[order[j - 1]] < cpu[i]) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+        
+        draw(count);
+        
+        memcpy(previous, current, count * sizeof(ProcInfo));
+        prev_count = count;
+        prev_tsc = now;
+        
+        // Poll, a blocking read would stop the refresh
+        if(readable(STDIN_FILENO) > 0 && getchar() == 'q') {
+            break;
+        }
+    }
+    
+    return 0;
+}
@@ -0,0 +1,11 @@
+// userspace/lib/libc/top.h
+// Process monitor shared by the top utility and the shell's top command
+
+#ifndef TOP_H
+#define TOP_H
+
+// Redraw the busiest processes every second until q is read from stdin.
+// Returns 0, or 1 if the process table cannot be read.
+int top_run(void);
+
+#endif
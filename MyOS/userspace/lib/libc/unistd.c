@@ -0,0 +1,84 @@
+// userspace/lib/libc/unistd.c
+// File descriptor system calls
+
+#include "unistd.h"
+#include "../../../kernel/include/kernel.h"
+
+// System call numbers
+#define SYS_WRITE 1
+#define SYS_READ 2
+#define SYS_OPEN 3
+#define SYS_CLOSE 4
+#define SYS_PIPE 22
+#define SYS_DUP 23
+#define SYS_DUP2 24
+#define SYS_VMSPLICE 25
+#define SYS_LSEEK 32
+#define SYS_PREAD 33
+#define SYS_PWRITE 34
+#define SYS_READV 35
+#define SYS_WRITEV 36
+#define SYS_GETDENTS 40
+#define SYS_READABLE 41
+
+int open(const char* path, int flags) {
+    return syscall(SYS_OPEN, (int)path, flags, 0);
+}
+
+int read(int fd, void* buffer, int size) {
+    return syscall(SYS_READ, fd, (int)buffer, size);
+}
+
+int write(int fd, const void* buffer, int size) {
+    return syscall(SYS_WRITE, fd, (int)buffer, size);
+}
+
+int close(int fd) {
+    return syscall(SYS_CLOSE, fd, 0, 0);
+}
+
+int lseek(int fd, int offset, int whence) {
+    return syscall(SYS_LSEEK, fd, offset, whence);
+}
+
+int pread(int fd, void* buffer, int size, int offset) {
+    struct iovec iov = {buffer, size};
+    return syscall(SYS_PREAD, fd, (int)&iov, offset);
+}
+
+int pwrite(int fd, const void* buffer, int size, int offset) {
+    struct iovec iov = {(void*)buffer, size};
+    return syscall(SYS_PWRITE, fd, (int)&iov, offset);
+}
+
+int readv(int fd, const struct iovec* iov, int iovcnt) {
+    return syscall(SYS_READV, fd, (int)iov, iovcnt);
+}
+
+int writev(int fd, const struct iovec* iov, int iovcnt) {
+    return syscall(SYS_WRITEV, fd, (int)iov, iovcnt);
+}
+
+int getdents(int fd, void* buffer, int size) {
+    return syscall(SYS_GETDENTS, fd, (int)buffer, size);
+}
+
+int readable(int fd) {
+    return syscall(SYS_READABLE, fd, 0, 0);
+}
+
+int pipe(int fds[2]) {
+    return syscall(SYS_PIPE, (int)fds, 0, 0);
+}
+
+int dup(int fd) {
+    return syscall(SYS_DUP, fd, 0, 0);
+}
+
+int dup2(int fd, int newfd) {
+    return syscall(SYS_DUP2, fd, newfd, 0);
+}
+
+int vmsplice(int fd, void* pages, int length) {
+    return syscall(SYS_VMSPLICE, fd, (int)pages, length);
+}
@@ -0,0 +1,39 @@
+// userspace/lib/libc/unistd.h
+// File descriptor system calls
+
+#ifndef UNISTD_H
+#define UNISTD_H
+
+#include "../../../kernel/include/abi.h"  // O_*, SEEK_*, struct iovec and struct dirent
+
+#define STDIN_FILENO 0
+#define STDOUT_FILENO 1
+#define STDERR_FILENO 2
+
+int open(const char* path, int flags);
+int read(int fd, void* buffer, int size);
+int write(int fd, const void* buffer, int size);
+int close(int fd);
+int lseek(int fd, int offset, int whence);
+
+// At offset, without moving the file position
+int pread(int fd, void* buffer, int size, int offset);
+int pwrite(int fd, const void* buffer, int size, int offset);
+
+// Gather or scatter up to IOV_MAX buffers in one call
+int readv(int fd, const struct iovec* iov, int iovcnt);
+int writev(int fd, const struct iovec* iov, int iovcnt);
+
+// Packed struct dirent records from an open directory; 0 at the end
+int getdents(int fd, void* buffer, int size);
+
+// 1 if read() would not block, for polling input; -1 for a bad fd
+int readable(int fd);
+int pipe(int fds[2]);
+int dup(int fd);
+int dup2(int fd, int newfd);
+
+// Move whole pages from ipc_alloc_buffer() into a pipe; they are gone afterwards
+int vmsplice(int fd, void* pages, int length);
+
+#endif
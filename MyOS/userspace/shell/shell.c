@@ -4,11 +4,22 @@
 #include "../lib/libc/stdio.h"
 #include "../lib/libc/stdlib.h"
 #include "../lib/libc/string.h"
+#include "../lib/libc/unistd.h"
+#include "../lib/libc/ps.h"
+#include "../lib/libc/top.h"
 #include "../../kernel/include/filesystem.h"
+#include "../../kernel/include/process.h"
 
 #define MAX_COMMAND_LENGTH 256
 #define MAX_ARGS 32
 #define PROMPT "myos$ "
+#define SYS_SLEEP 8
+#define SYS_GETPID 7
+#define SYS_TRACE 29
+#define SYS_TRACE_READ 30
+#define SYS_SYSSTAT 31
+#define TRACE_BATCH 64
+#define MAX_STAGES 8
 
 // Built-in commands
 typedef struct {
@@ -17,12 +28,20 @@ typedef struct {
     int (*function)(int argc, char** argv);
 } Command;
 
+// One command of a pipeline, run as its own process
+typedef struct {
+    Command* command;
+    int argc;
+    char** argv;
+} Stage;
+
 // Function prototypes
 int shell_main(void);
 void shell_loop(void);
 char* read_line(void);
 char** parse_line(char* line);
 int execute_command(char** args);
+int run_pipeline(char** args);
 int launch_program(char** args);
 
 // Built-in command functions
@@ -33,6 +52,7 @@ int cmd_ls(int argc, char** argv);
 int cmd_cd(int argc, char** argv);
 int cmd_pwd(int argc, char** argv);
 int cmd_cat(int argc, char** argv);
+int cmd_wc(int argc, char** argv);
 int cmd_echo(int argc, char** argv);
 int cmd_mkdir(int argc, char** argv);
 int cmd_rmdir(int argc, char** argv);
@@ -40,6 +60,9 @@ int cmd_rm(int argc, char** argv);
 int cmd_cp(int argc, char** argv);
 int cmd_mv(int argc, char** argv);
 int cmd_ps(int argc, char** argv);
+int cmd_top(int argc, char** argv);
+int cmd_strace(int argc, char** argv);
+int cmd_sysstat(int argc, char** argv);
 int cmd_kill(int argc, char** argv);
 int cmd_date(int argc, char** argv);
 int cmd_uptime(int argc, char** argv);
@@ -55,6 +78,7 @@ static Command builtin_commands[] = {
     {"cd", "Change directory", cmd_cd},
     {"pwd", "Print working directory", cmd_pwd},
     {"cat", "Display file contents", cmd_cat},
+    {"wc", "Count lines, words and bytes", cmd_wc},
     {"echo", "Display text", cmd_echo},
     {"mkdir", "Create directory", cmd_mkdir},
     {"rmdir", "Remove directory", cmd_rmdir},
@@ -62,6 +86,9 @@ static Command builtin_commands[] = {
     {"cp", "Copy file", cmd_cp},
     {"mv", "Move/rename file", cmd_mv},
     {"ps", "List running processes", cmd_ps},
+    {"top", "Show processes by CPU usage", cmd_top},
+    {"strace", "Follow a process's system calls", cmd_strace},
+    {"sysstat", "Show system call latency histograms", cmd_sysstat},
     {"kill", "Terminate process", cmd_kill},
     {"date", "Show current date and time", cmd_date},
     {"uptime", "Show system uptime", cmd_uptime},
@@ -114,7 +141,7 @@ char* read_line(void) {
     while(1) {
         c = getchar();
         
-        if(c == '\n') {
+        if(c == '\n' || c < 0) {
             line[position] = '\0';
             return line;
         } else if(c == '\b' || c == 127) { // Backspace
@@ -135,32 +162,69 @@ char* read_line(void) {
     }
 }
 
+static int is_operator(char c) {
+    return c == '|' || c == '<' || c == '>';
+}
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\a';
+}
+
+static int is_operator_token(const char* token) {
+    return token[1] == '\0' && is_operator(token[0]);
+}
+
+static char* operator_token(char c) {
+    return c == '|' ? "|" : (c == '<' ? "<" : ">");
+}
+
+static char** push_token(char** tokens, int* position, int* bufsize, char* token) {
+    tokens[(*position)++] = token;
+    
+    if(*position >= *bufsize) {
+        *bufsize += MAX_ARGS;
+        tokens = realloc(tokens, *bufsize * sizeof(char*));
+        if(!tokens) {
+            printf("Shell: allocation error\n");
+            exit(1);
+        }
+    }
+    return tokens;
+}
+
+// Split on whitespace; |, < and > are tokens of their own even without spaces
 char** parse_line(char* line) {
     int bufsize = MAX_ARGS;
     int position = 0;
     char** tokens = malloc(bufsize * sizeof(char*));
-    char* token;
+    char* p = line;
     
     if(!tokens) {
         printf("Shell: allocation error\n");
         exit(1);
     }
     
-    token = strtok(line, " \t\r\n\a");
-    while(token != NULL) {
-        tokens[position] = token;
-        position++;
-        
-        if(position >= bufsize) {
-            bufsize += MAX_ARGS;
-            tokens = realloc(tokens, bufsize * sizeof(char*));
-            if(!tokens) {
-                printf("Shell: allocation error\n");
-                exit(1);
+    while(*p) {
+        if(is_space(*p)) {
+            p++;
+        } else if(is_operator(*p)) {
+            tokens = push_token(tokens, &position, &bufsize, operator_token(*p));
+            p++;
+        } else {
+            tokens = push_token(tokens, &position, &bufsize, p);
+            while(*p && !is_space(*p) && !is_operator(*p)) {
+                p++;
+            }
+            
+            // Terminating the word overwrites an operator, so emit it here
+            if(is_operator(*p)) {
+                char* op = operator_token(*p);
+                *p++ = '\0';
+                tokens = push_token(tokens, &position, &bufsize, op);
+            } else if(*p) {
+                *p++ = '\0';
             }
         }
-        
-        token = strtok(NULL, " \t\r\n\a");
     }
     tokens[position] = NULL;
     return tokens;
@@ -171,6 +235,12 @@ int execute_command(char** args) {
         return 1; // Empty command
     }
     
+    for(int i = 0; args[i]; i++) {
+        if(is_operator_token(args[i])) {
+            return run_pipeline(args);
+        }
+    }
+    
     // Check built-in commands
     for(int i = 0; i < num_builtins; i++) {
         if(strcmp(args[0], builtin_commands[i].name) == 0) {
@@ -182,6 +252,178 @@ int execute_command(char** args) {
     return launch_program(args);
 }
 
+static Command* find_builtin(const char* name) {
+    for(int i = 0; i < num_builtins; i++) {
+        if(strcmp(name, builtin_commands[i].name) == 0) {
+            return &builtin_commands[i];
+        }
+    }
+    return NULL;
+}
+
+// Descriptors above stderr belong to the shell, not to its children
+static void close_inherited_fds(void) {
+    for(int fd = 3; fd < MAX_FDS; fd++) {
+        close(fd);
+    }
+}
+
+static void stage_main(void* arg) {
+    Stage* stage = (Stage*)arg;
+    
+    close_inherited_fds();
+    stage->command->function(stage->argc, stage->argv);
+    exit(0);
+}
+
+// Start entry(arg) as a child process with in and out as its stdin and
+// stdout. The child inherits our table, so swap them in around the spawn.
+static int spawn(const char* name, void (*entry)(void* arg), void* arg, int in, int out) {
+    int saved_in = dup(STDIN_FILENO);
+    int saved_out = dup(STDOUT_FILENO);
+    
+    dup2(in, STDIN_FILENO);
+    dup2(out, STDOUT_FILENO);
+    Process* proc = create_process(name, NULL);
+    Thread* thread = proc ? create_user_thread(proc, entry, arg, 0) : NULL;
+    dup2(saved_in, STDIN_FILENO);
+    dup2(saved_out, STDOUT_FILENO);
+    close(saved_in);
+    close(saved_out);
+    
+    if(!thread) {
+        if(proc) {
+            destroy_process(proc->pid);
+        }
+        return -1;
+    }
+    return proc->pid;
+}
+
+// Run "a | b | c" with optional "< file" on the first and "> file" on the
+// last command. Every command is a process; pipes connect neighbours.
+int run_pipeline(char** args) {
+    Stage stages[MAX_STAGES];
+    int pids[MAX_STAGES];
+    int nstages = 0;
+    int npids = 0;
+    char* in_path = NULL;
+    char* out_path = NULL;
+    int w = 0;
+    
+    // Split args in place into NULL-terminated argv arrays
+    stages[0].argv = args;
+    stages[0].argc = 0;
+    for(int i = 0; args[i]; i++) {
+        char* token = args[i];
+        
+        if(strcmp(token, "|") == 0) {
+            if(!stages[nstages].argc || out_path || nstages + 1 == MAX_STAGES) {
+                printf("Shell: syntax error near '|'\n");
+                return 1;
+            }
+            args[w++] = NULL;
+            nstages++;
+            stages[nstages].argv = &args[w];
+            stages[nstages].argc = 0;
+        } else if(strcmp(token, "<") == 0 || strcmp(token, ">") == 0) {
+            char* path = args[i + 1];
+            if(!path || is_operator_token(path) || (token[0] == '<' && nstages > 0)) {
+                printf("Shell: syntax error near '%s'\n", token);
+                return 1;
+            }
+            if(token[0] == '<') {
+                in_path = path;
+            } else {
+                out_path = path;
+            }
+            i++;
+        } else {
+            args[w++] = token;
+            stages[nstages].argc++;
+        }
+    }
+    args[w] = NULL;
+    if(!stages[nstages].argc) {
+        printf("Shell: missing command\n");
+        return 1;
+    }
+    nstages++;
+    
+    for(int s = 0; s < nstages; s++) {
+        stages[s].command = find_builtin(stages[s].argv[0]);
+        if(!stages[s].command) {
+            printf("Shell: command not found: %s\n", stages[s].argv[0]);
+            return 1;
+        }
+    }
+    
+    // Redirected files are handed to the end commands as descriptors
+    int in = STDIN_FILENO;
+    int last_out = STDOUT_FILENO;
+    int fds[2];
+    
+    if(in_path) {
+        in = open(in_path, O_RDONLY);
+        if(in < 0) {
+            printf("Shell: %s: No such file or directory\n", in_path);
+            return 1;
+        }
+    }
+    if(out_path) {
+        last_out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC);
+        if(last_out < 0) {
+            printf("Shell: cannot create '%s'\n", out_path);
+            if(in != STDIN_FILENO) {
+                close(in);
+            }
+            return 1;
+        }
+    }
+    
+    for(int s = 0; s < nstages; s++) {
+        int out = last_out;
+        
+        if(s < nstages - 1) {
+            if(pipe(fds) != 0) {
+                printf("Shell: cannot create pipe\n");
+                break;
+            }
+            out = fds[1];
+        }
+        
+        int pid = spawn(stages[s].argv[0], stage_main, &stages[s], in, out);
+        if(in != STDIN_FILENO) {
+            close(in);
+        }
+        in = STDIN_FILENO;
+        if(out != last_out) {
+            close(out);
+            in = fds[0];
+        }
+        
+        if(pid < 0) {
+            printf("Shell: cannot start process\n");
+            break;
+        }
+        pids[npids++] = pid;
+    }
+    
+    // The children hold their own references now
+    if(in != STDIN_FILENO) {
+        close(in);
+    }
+    if(last_out != STDOUT_FILENO) {
+        close(last_out);
+    }
+    
+    for(int i = 0; i < npids; i++) {
+        int status;
+        waitpid(pids[i], &status);
+    }
+    return 1;
+}
+
 int launch_program(char** args) {
     printf("Shell: command not found: %s\n", args[0]);
     return 1;
@@ -204,7 +446,8 @@ int cmd_help(int argc, char** argv) {
         printf("  %-10s - %s\n", builtin_commands[i].name, builtin_commands[i].description);
     }
     
-    printf("\nPress Tab for command completion.\n");
+    printf("\nJoin commands with | and redirect with < file and > file.\n");
+    printf("Press Tab for command completion.\n");
     printf("Use Ctrl+C to interrupt running programs.\n");
     return 1;
 }
@@ -221,20 +464,26 @@ int cmd_clear(int argc, char** argv) {
 }
 
 int cmd_ls(int argc, char** argv) {
+    static char entries[2048];
     char* path = (argc > 1) ? argv[1] : ".";
-    char** files = list_directory(path);
+    int fd = open(path, O_RDONLY);
+    int n = fd < 0 ? -1 : getdents(fd, entries, sizeof(entries));
     
-    if(!files) {
+    if(n < 0) {
         printf("ls: cannot access '%s': No such file or directory\n", path);
+        if(fd >= 0) close(fd);
         return 1;
     }
     
-    for(int i = 0; files[i] != NULL; i++) {
-        printf("%s  ", files[i]);
-        free(files[i]);
+    while(n > 0) {
+        for(int pos = 0; pos < n; pos += ((struct dirent*)(entries + pos))->d_reclen) {
+            struct dirent* entry = (struct dirent*)(entries + pos);
+            printf("%s  ", entry->d_name);
+        }
+        n = getdents(fd, entries, sizeof(entries));
     }
     printf("\n");
-    free(files);
+    close(fd);
     
     return 1;
 }
@@ -258,26 +507,70 @@ int cmd_pwd(int argc, char** argv) {
 
 int cmd_cat(int argc, char** argv) {
     if(argc < 2) {
-        printf("Usage: cat <filename>\n");
+        // Copy standard input, so cat works at the end of a pipeline
+        char buffer[512];
+        int n;
+        while((n = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
+            write(STDOUT_FILENO, buffer, n);
+        }
         return 1;
     }
     
-    struct vfs_node* file = find_file(argv[1]);
-    if(!file) {
+    int fd = open(argv[1], O_RDONLY);
+    if(fd < 0) {
         printf("cat: %s: No such file or directory\n", argv[1]);
         return 1;
     }
     
-    char* buffer = malloc(file->size + 1);
-    if(read_file(file, 0, file->size, buffer) > 0) {
-        buffer[file->size] = '\0';
-        printf("%s", buffer);
+    // Whole chunks per write, the console draws them in one go
+    char buffer[4096];
+    int n;
+    while((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        write(STDOUT_FILENO, buffer, n);
     }
-    free(buffer);
+    close(fd);
     
     return 1;
 }
 
+// Counts standard input, or the named file
+int cmd_wc(int argc, char** argv) {
+    int fd = STDIN_FILENO;
+    char buffer[512];
+    unsigned int lines = 0, words = 0, bytes = 0;
+    int in_word = 0;
+    int n;
+    
+    if(argc > 1) {
+        fd = open(argv[1], O_RDONLY);
+        if(fd < 0) {
+            printf("wc: %s: No such file or directory\n", argv[1]);
+            return 1;
+        }
+    }
+    
+    while((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        for(int i = 0; i < n; i++) {
+            if(buffer[i] == '\n') lines++;
+            if(is_space(buffer[i])) {
+                in_word = 0;
+            } else if(!in_word) {
+                in_word = 1;
+                words++;
+            }
+        }
+        bytes += n;
+    }
+    
+    printf("%7u %7u %7u", lines, words, bytes);
+    if(fd != STDIN_FILENO) {
+        printf(" %s", argv[1]);
+        close(fd);
+    }
+    printf("\n");
+    return 1;
+}
+
 int cmd_echo(int argc, char** argv) {
     for(int i = 1; i < argc; i++) {
         printf("%s", argv[i]);
@@ -330,9 +623,25 @@ int cmd_cp(int argc, char** argv) {
         return 1;
     }
     
-    if(copy_file(argv[1], argv[2]) != 0) {
+    int in = open(argv[1], O_RDONLY);
+    int out = in < 0 ? -1 : open(argv[2], O_WRONLY | O_CREAT | O_TRUNC);
+    if(out < 0) {
         printf("cp: cannot copy '%s' to '%s'\n", argv[1], argv[2]);
+        if(in >= 0) close(in);
+        return 1;
+    }
+    
+    // Fixed buffer, any file size
+    char buffer[4096];
+    int n;
+    while((n = read(in, buffer, sizeof(buffer))) > 0) {
+        if(write(out, buffer, n) != n) {
+            printf("cp: write error on '%s'\n", argv[2]);
+            break;
+        }
     }
+    close(in);
+    close(out);
     
     return 1;
 }
@@ -351,10 +660,140 @@ int cmd_mv(int argc, char** argv) {
 }
 
 int cmd_ps(int argc, char** argv) {
-    printf("  PID  PPID STATE     COMMAND\n");
-    printf("    1     0 RUNNING   kernel\n");
-    printf("    2     1 RUNNING   desktop\n");
-    printf("    3     1 RUNNING   shell\n");
+    ps_run();
+    return 1;
+}
+
+int cmd_top(int argc, char** argv) {
+    top_run();
+    return 1;
+}
+
+// Follow one process's system calls until it exits or q is pressed
+int cmd_strace(int argc, char** argv) {
+    static TraceRecord records[TRACE_BATCH];
+    uint32_t cursors[NR_CPUS] = {0};
+    uint32_t expected[NR_CPUS];
+    int n;
+    
+    if(argc < 2) {
+        printf("Usage: strace <pid>\n");
+        return 1;
+    }
+    
+    // Tracing ourselves would trace the printing of every record
+    int pid = atoi(argv[1]);
+    if(pid == syscall(SYS_GETPID, 0, 0, 0)) {
+        printf("strace: cannot trace the shell itself\n");
+        return 1;
+    }
+    
+    // Skip what an earlier session left in the rings
+    while(syscall(SYS_TRACE_READ, (int)records, TRACE_BATCH, (int)cursors) > 0);
+    for(int cpu = 0; cpu < NR_CPUS; cpu++) {
+        expected[cpu] = cursors[cpu];
+    }
+    
+    if(syscall(SYS_TRACE, pid, 0, 0) != 0) {
+        printf("strace: no process %d\n", pid);
+        return 1;
+    }
+    
+    uint32_t per_ms = tsc_cycles_per_ms();
+    printf("Tracing pid %d (q to stop)\n", pid);
+    
+    while(1) {
+        while((n = syscall(SYS_TRACE_READ, (int)records, TRACE_BATCH, (int)cursors)) > 0) {
+            for(int i = 0; i < n; i++) {
+                TraceRecord* rec = &records[i];
+                if(rec->seq != expected[0]) {
+                    printf("... %u records lost\n", rec->seq - expected[0]);
+                }
+                expected[0] = rec->seq + 1;
+                
+                uint32_t ns = per_ms ? (uint32_t)((uint64_t)rec->cycles * 1000000 / per_ms) : 0;
+                printf("%s(%d, %d, %d) = %d <%u.%03u us>\n", syscall_name(rec->num),
+                       rec->args[0], rec->args[1], rec->args[2], rec->ret, ns / 1000, ns % 1000);
+            }
+        }
+        
+        Process* proc = find_process(pid);
+        if(!proc || proc->state == PROC_ZOMBIE) {
+            printf("+++ process %d exited +++\n", pid);
+            break;
+        }
+        if(readable(STDIN_FILENO) > 0 && getchar() == 'q') {
+            break;
+        }
+        syscall(SYS_SLEEP, 50, 0, 0);
+    }
+    
+    syscall(SYS_TRACE, 0, 0, 0);
+    return 1;
+}
+
+// Upper bound, in cycles, under which a fraction per_mille of the calls fall
+static uint32_t hist_percentile(SyscallStat* stat, uint32_t per_mille) {
+    uint32_t target = (uint32_t)(((uint64_t)stat->count * per_mille + 999) / 1000);
+    uint32_t seen = 0;
+    for(int b = 0; b < SYSCALL_HIST_BUCKETS; b++) {
+        seen += stat->hist[b];
+        if(seen >= target) {
+            return b + 1 < 32 ? 1u << (b + 1) : 0xFFFFFFFF;
+        }
+    }
+    return 0xFFFFFFFF;
+}
+
+static void print_histogram(SyscallStat* stat) {
+    uint32_t most = 0;
+    int first = -1, last = 0;
+    for(int b = 0; b < SYSCALL_HIST_BUCKETS; b++) {
+        if(!stat->hist[b]) continue;
+        if(first < 0) first = b;
+        last = b;
+        if(stat->hist[b] > most) most = stat->hist[b];
+    }
+    
+    printf("%s: %u calls, latency in cycles\n", stat->name, stat->count);
+    for(int b = first; b >= 0 && b <= last; b++) {
+        char bar[41];
+        int len = (int)((uint64_t)stat->hist[b] * 40 / most);
+        memset(bar, '#', len);
+        bar[len] = '\0';
+        printf("%10u .. %-10u %8u %s\n", 1u << b, b + 1 < 32 ? (1u << (b + 1)) - 1 : 0xFFFFFFFF,
+               stat->hist[b], bar);
+    }
+}
+
+// Per system call counts and latency, or one call's whole histogram
+int cmd_sysstat(int argc, char** argv) {
+    static SyscallStat stats[SYSCALL_SLOTS];
+    int count = syscall(SYS_SYSSTAT, (int)stats, SYSCALL_SLOTS, 0);
+    if(count < 0) {
+        printf("sysstat: cannot read statistics\n");
+        return 1;
+    }
+    
+    if(argc > 1) {
+        for(int i = 0; i < count; i++) {
+            if(strcmp(stats[i].name, argv[1]) == 0) {
+                print_histogram(&stats[i]);
+                return 1;
+            }
+        }
+        printf("sysstat: no calls to %s yet\n", argv[1]);
+        return 1;
+    }
+    
+    printf("SYSCALL              CALLS   AVG(cyc)   P50(cyc)   P99(cyc)\n");
+    for(int i = 0; i < count; i++) {
+        SyscallStat* stat = &stats[i];
+        printf("%-16s %9u %10u %10u %10u\n", stat->name, stat->count,
+               (uint32_t)(stat->cycles / stat->count),
+               hist_percentile(stat, 500), hist_percentile(stat, 990));
+    }
+    printf("\nsysstat <name> shows a call's histogram\n");
     return 1;
 }
 
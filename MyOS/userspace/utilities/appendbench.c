@@ -0,0 +1,49 @@
+// userspace/utilities/appendbench.c
+// Throughput of growing an in-memory file by small and large appends
+
+#include "../lib/libc/stdio.h"
+#include "../../kernel/include/kernel.h"
+#include "../../kernel/include/filesystem.h"
+
+#define TEST_FILE "/tmp/appendbench.dat"
+#define TOTAL_BYTES (4 * 1024 * 1024)
+
+static void run(uint32_t chunk) {
+    static char buffer[16384];
+    for(uint32_t i = 0; i < chunk; i++) {
+        buffer[i] = (char)i;
+    }
+    
+    struct vfs_node* file = create_file_path(TEST_FILE);
+    if(!file) {
+        printf("appendbench: cannot create %s\n", TEST_FILE);
+        return;
+    }
+    
+    uint32_t offset = 0;
+    uint64_t start = rdtsc();
+    while(offset < TOTAL_BYTES) {
+        if(write_file(file, offset, chunk, buffer) != (int)chunk) {
+            printf("appendbench: write failed at %u\n", offset);
+            break;
+        }
+        offset += chunk;
+    }
+    uint64_t cycles = rdtsc() - start;
+    delete_file(TEST_FILE);
+    
+    uint64_t per_ms = tsc_cycles_per_ms();
+    uint32_t mb_per_sec = cycles ? (uint32_t)((uint64_t)offset * per_ms * 1000 / cycles / (1024 * 1024)) : 0;
+    uint32_t per_append = offset ? (uint32_t)(cycles / (offset / chunk)) : 0;
+    printf("%6u byte appends %8u cycles each %6u MB/s\n", chunk, per_append, mb_per_sec);
+}
+
+int main(void) {
+    static const uint32_t chunks[] = {16, 128, 1024, 4096, 16384};
+    
+    printf("Append throughput, %u MB per run\n", TOTAL_BYTES / (1024 * 1024));
+    for(int i = 0; i < 5; i++) {
+        run(chunks[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+// userspace/utilities/bcachestat.c
+// Buffer cache counters and hit ratio
+
+#include "../lib/libc/stdio.h"
+#include "../../kernel/include/kernel.h"
+#include "../../kernel/include/filesystem.h"
+
+int main(void) {
+    BcacheStats stats;
+    bcache_get_stats(&stats);
+    
+    uint32_t lookups = stats.hits + stats.misses;
+    printf("Buffer cache, %u KB in %u byte blocks\n", BUFFER_CACHE_SIZE / 1024, BLOCK_SIZE);
+    printf("resident %8u blocks, %u dirty\n", stats.resident, stats.dirty);
+    printf("hits     %8u (%u%% of %u lookups)\n", stats.hits,
+           lookups ? (uint32_t)((uint64_t)stats.hits * 100 / lookups) : 0, lookups);
+    printf("misses   %8u, %u of them on recently evicted blocks\n", stats.misses, stats.ghost_hits);
+    printf("reads    %8u blocks\n", stats.reads);
+    printf("writes   %8u blocks\n", stats.writes);
+    printf("evicted  %8u blocks\n", stats.evictions);
+    return 0;
+}
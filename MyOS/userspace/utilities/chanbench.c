@@ -0,0 +1,81 @@
+// userspace/utilities/chanbench.c
+// Throughput of shared-memory ring channels, one or more producer processes
+
+#include "../lib/libc/stdio.h"
+#include "../lib/libc/channel.h"
+#include "../../kernel/include/kernel.h"
+#include "../../kernel/include/process.h"
+
+#define MESSAGES 200000
+#define NR_SLOTS 256
+#define MAX_MSG 1024
+#define MAX_PRODUCERS 4
+
+static int bench_channel;   // Id the producers open
+static uint32_t bench_size;
+static uint32_t bench_count; // Messages per producer
+
+static void producer(void) {
+    char payload[MAX_MSG];
+    ipc_channel_t* channel = ipc_channel_open(bench_channel);
+    if(!channel) return;
+    
+    for(uint32_t i = 0; i < bench_size; i++) {
+        payload[i] = (char)i;
+    }
+    for(uint32_t i = 0; i < bench_count; i++) {
+        ipc_channel_send(channel, payload, bench_size);
+    }
+    ipc_channel_close(channel);
+}
+
+static void run(uint32_t size, int nr_producers) {
+    char buffer[MAX_MSG];
+    ipc_channel_t* channel = ipc_channel_create(MAX_MSG, NR_SLOTS);
+    if(!channel) {
+        printf("chanbench: cannot create channel\n");
+        return;
+    }
+    
+    bench_channel = ipc_channel_id(channel);
+    bench_size = size;
+    bench_count = MESSAGES / nr_producers;
+    uint32_t total = bench_count * nr_producers;
+    
+    uint64_t start = rdtsc();
+    for(int i = 0; i < nr_producers; i++) {
+        Process* proc = create_process("chan-producer", NULL);
+        if(!proc || !create_thread(proc, (void*)producer)) {
+            printf("chanbench: cannot start producer\n");
+            return;
+        }
+    }
+    
+    for(uint32_t i = 0; i < total; i++) {
+        ipc_channel_recv(channel, buffer, sizeof(buffer));
+    }
+    uint64_t cycles = rdtsc() - start;
+    ipc_channel_close(channel);
+    
+    uint64_t per_ms = tsc_cycles_per_ms();
+    if(!cycles || !per_ms) return;
+    
+    uint32_t msgs_per_sec = (uint32_t)((uint64_t)total * per_ms * 1000 / cycles);
+    uint32_t mb_per_sec = (uint32_t)((uint64_t)total * size * per_ms / 1000 / cycles);
+    
+    printf("%4u bytes %d producer(s) %10u msgs/s %3u.%03u GB/s\n",
+           size, nr_producers, msgs_per_sec, mb_per_sec / 1000, mb_per_sec % 1000);
+}
+
+int main(void) {
+    static const uint32_t sizes[] = {16, 64, 256, 1024};
+    
+    printf("Channel throughput, %u messages, %u slots\n", MESSAGES, NR_SLOTS);
+    for(int i = 0; i < 4; i++) {
+        run(sizes[i], 1);
+    }
+    for(int i = 0; i < 4; i++) {
+        run(sizes[i], MAX_PRODUCERS);
+    }
+    return 0;
+}
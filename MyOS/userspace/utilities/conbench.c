@@ -0,0 +1,65 @@
+// userspace/utilities/conbench.c
+// Console throughput, cat of a large file a byte at a time and in whole chunks
+
+#include "../lib/libc/stdio.h"
+#include "../lib/libc/unistd.h"
+#include "../../kernel/include/kernel.h"
+#include "../../kernel/include/filesystem.h"
+
+#define TEST_FILE "/tmp/conbench.txt"
+#define LINES 4000
+#define CHUNK 4096
+
+static struct vfs_node* make_file(uint32_t* size) {
+    struct vfs_node* file = create_file_path(TEST_FILE);
+    if(!file) return NULL;
+    
+    char line[80];
+    uint32_t offset = 0;
+    for(int i = 0; i < LINES; i++) {
+        int len = sprintf(line, "%5d the quick brown fox jumps over the lazy dog\n", i);
+        if(write_file(file, offset, len, line) != len) return NULL;
+        offset += len;
+    }
+    *size = offset;
+    return file;
+}
+
+// Returns the cycles taken to copy the file to the console
+static uint64_t cat(struct vfs_node* file, uint32_t write_size) {
+    static char buffer[CHUNK];
+    uint32_t offset = 0;
+    int n;
+    
+    uint64_t start = rdtsc();
+    while((n = read_file(file, offset, sizeof(buffer), buffer)) > 0) {
+        for(int done = 0; done < n; done += write_size) {
+            uint32_t len = n - done < (int)write_size ? n - done : write_size;
+            write(STDOUT_FILENO, buffer + done, len);
+        }
+        offset += n;
+    }
+    return rdtsc() - start;
+}
+
+int main(void) {
+    uint32_t size;
+    struct vfs_node* file = make_file(&size);
+    if(!file) {
+        printf("conbench: cannot create %s\n", TEST_FILE);
+        return 1;
+    }
+    
+    uint64_t per_byte = cat(file, 1);
+    uint64_t chunked = cat(file, CHUNK);
+    delete_file(TEST_FILE);
+    
+    uint32_t per_ms = tsc_cycles_per_ms();
+    uint32_t slow = per_byte ? (uint32_t)((uint64_t)size * per_ms / per_byte) : 0;
+    uint32_t fast = chunked ? (uint32_t)((uint64_t)size * per_ms / chunked) : 0;
+    
+    printf("\nConsole throughput, cat of a %u KB file\n", size / 1024);
+    printf("%-16s %8u KB/s\n", "1-byte writes", slow);
+    printf("%-16s %8u KB/s\n", "4 KB writes", fast);
+    return 0;
+}
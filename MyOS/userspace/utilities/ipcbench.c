@@ -0,0 +1,97 @@
+// userspace/utilities/ipcbench.c
+// Round-trip latency of ipc_call() against send_message()/receive_message()
+
+#include "../lib/libc/stdio.h"
+#include "../lib/libc/stdlib.h"
+#include "../../kernel/include/kernel.h"
+#include "../../kernel/include/process.h"
+
+#define SYS_IPC_CALL 17
+#define SYS_IPC_REPLY_WAIT 18
+#define ROUNDS 10000
+
+// Echo servers, each adds one to the first word and sends it back
+static void call_server(void) {
+    IpcMsg msg;
+    while(syscall(SYS_IPC_REPLY_WAIT, (int)&msg, 0, 0) >= 0) {
+        msg.words[0]++;
+    }
+}
+
+static void mailbox_server(void) {
+    uint32_t sender, type, value;
+    while(receive_message(&sender, &type, &value, sizeof(value)) >= 0) {
+        value++;
+        send_message(sender, type, &value, sizeof(value));
+    }
+}
+
+static int start_server(const char* name, void (*entry)(void)) {
+    Process* proc = create_process(name, NULL);
+    if(!proc) return -1;
+    
+    if(!create_thread(proc, (void*)entry)) {
+        destroy_process(proc->pid);
+        return -1;
+    }
+    return proc->pid;
+}
+
+static void report(const char* name, uint64_t cycles) {
+    uint32_t per_round = (uint32_t)(cycles / ROUNDS);
+    uint32_t per_ms = tsc_cycles_per_ms();
+    uint32_t ns = per_ms ? (uint32_t)((uint64_t)per_round * 1000000 / per_ms) : 0;
+    
+    printf("%-28s %8u cycles %8u ns\n", name, per_round, ns);
+}
+
+static uint64_t bench_call_syscall(int pid) {
+    IpcMsg msg = {{0}};
+    uint64_t start = rdtsc();
+    
+    for(int i = 0; i < ROUNDS; i++) {
+        if(syscall(SYS_IPC_CALL, pid, (int)&msg, 0) < 0) return 0;
+    }
+    return rdtsc() - start;
+}
+
+static uint64_t bench_call_direct(int pid) {
+    IpcMsg msg = {{0}};
+    uint64_t start = rdtsc();
+    
+    for(int i = 0; i < ROUNDS; i++) {
+        if(ipc_call(pid, &msg) < 0) return 0;
+    }
+    return rdtsc() - start;
+}
+
+static uint64_t bench_mailbox(int pid) {
+    uint32_t value = 0;
+    uint32_t sender, type;
+    uint64_t start = rdtsc();
+    
+    for(int i = 0; i < ROUNDS; i++) {
+        if(send_message(pid, 1, &value, sizeof(value)) < 0) return 0;
+        if(receive_message(&sender, &type, &value, sizeof(value)) < 0) return 0;
+    }
+    return rdtsc() - start;
+}
+
+int main(void) {
+    int call_pid = start_server("ipc-call-server", call_server);
+    int mailbox_pid = start_server("ipc-mailbox-server", mailbox_server);
+    
+    if(call_pid < 0 || mailbox_pid < 0) {
+        printf("ipcbench: cannot start servers\n");
+        return 1;
+    }
+    
+    printf("IPC round trip, %u rounds of one word\n", ROUNDS);
+    report("ipc_call (int 0x80)", bench_call_syscall(call_pid));
+    report("ipc_call (direct)", bench_call_direct(call_pid));
+    report("send/receive_message", bench_mailbox(mailbox_pid));
+    
+    destroy_process(call_pid);
+    destroy_process(mailbox_pid);
+    return 0;
+}
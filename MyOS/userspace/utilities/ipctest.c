@@ -0,0 +1,67 @@
+// userspace/utilities/ipctest.c
+// A server that blocks on a mutex while serving ipc_call() must still reply
+
+#include "../lib/libc/stdio.h"
+#include "../lib/libc/sync.h"
+#include "../lib/libc/thread.h"
+#include "../../kernel/include/kernel.h"
+#include "../../kernel/include/process.h"
+
+#define ROUNDS 20
+#define HOLD_MS 20
+
+static mutex_t lock = MUTEX_INITIALIZER;
+
+// Takes the mutex for every call, so it sleeps in futex_wait() until the
+// client's helper lets go
+static void server(void) {
+    IpcMsg msg;
+    while(ipc_reply_wait(&msg) >= 0) {
+        mutex_lock(&lock);
+        msg.words[0]++;
+        mutex_unlock(&lock);
+    }
+}
+
+static void* release_later(void* arg) {
+    (void)arg;
+    sleep(HOLD_MS);
+    mutex_unlock(&lock);
+    return NULL;
+}
+
+int main(void) {
+    Process* proc = create_process("ipctest-server", NULL);
+    if(!proc || !create_thread(proc, (void*)server)) {
+        printf("ipctest: cannot start server\n");
+        return 1;
+    }
+    
+    int failures = 0;
+    for(int i = 0; i < ROUNDS; i++) {
+        // Held across the call, the server's futex wake comes mid-call
+        mutex_lock(&lock);
+        uthread_t helper;
+        if(uthread_create(&helper, release_later, NULL) != 0) {
+            mutex_unlock(&lock);
+            printf("ipctest: cannot start helper thread\n");
+            failures++;
+            break;
+        }
+        
+        IpcMsg msg = {{0}};
+        msg.words[0] = i;
+        int status = ipc_call(proc->pid, &msg);
+        uthread_join(helper, NULL);
+        
+        if(status != 0 || msg.words[0] != (uint32_t)i + 1) {
+            printf("ipctest: call %d returned %d with %u, expected 0 with %d\n",
+                   i, status, msg.words[0], i + 1);
+            failures++;
+        }
+    }
+    
+    destroy_process(proc->pid);
+    printf("ipctest: %s, %d of %d calls failed\n", failures ? "FAIL" : "PASS", failures, ROUNDS);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+// userspace/utilities/lookupbench.c
+// Path lookup cost in a deep tree, a large directory and for missing names
+
+#include "../lib/libc/stdio.h"
+#include "../../kernel/include/kernel.h"
+#include "../../kernel/include/filesystem.h"
+
+#define BENCH_DIR "/tmp/lookupbench"
+#define DEPTH 16
+#define WIDE_FILES 256
+#define ROUNDS 20000
+
+// The tree is left in place and reused by the next run
+static int make_tree(char* deep_path) {
+    char path[128];
+    
+    if(!create_directory_path(BENCH_DIR)) return -1;
+    
+    strcpy(deep_path, BENCH_DIR);
+    for(int i = 0; i < DEPTH; i++) {
+        sprintf(deep_path + strlen(deep_path), "/d%d", i);
+        if(!create_directory_path(deep_path)) return -1;
+    }
+    
+    if(!create_directory_path(BENCH_DIR "/wide")) return -1;
+    for(int i = 0; i < WIDE_FILES; i++) {
+        sprintf(path, BENCH_DIR "/wide/file%d", i);
+        if(!find_file(path) && !create_file_path(path)) return -1;
+    }
+    return 0;
+}
+
+static void report(const char* name, uint64_t cycles, uint32_t lookups) {
+    uint32_t per_lookup = (uint32_t)(cycles / lookups);
+    uint32_t per_ms = tsc_cycles_per_ms();
+    uint32_t ns = per_ms ? (uint32_t)((uint64_t)per_lookup * 1000000 / per_ms) : 0;
+    
+    printf("%-24s %8u cycles %8u ns\n", name, per_lookup, ns);
+}
+
+static void bench_deep(const char* deep_path) {
+    uint64_t start = rdtsc();
+    for(int i = 0; i < ROUNDS; i++) {
+        if(!find_file(deep_path)) {
+            printf("lookupbench: %s not found\n", deep_path);
+            return;
+        }
+    }
+    report("deep path", rdtsc() - start, ROUNDS);
+}
+
+static void bench_wide(void) {
+    static char paths[WIDE_FILES][48];
+    for(int i = 0; i < WIDE_FILES; i++) {
+        sprintf(paths[i], BENCH_DIR "/wide/file%d", i);
+    }
+    
+    uint64_t start = rdtsc();
+    for(int i = 0; i < ROUNDS; i++) {
+        if(!find_file(paths[i % WIDE_FILES])) {
+            printf("lookupbench: %s not found\n", paths[i % WIDE_FILES]);
+            return;
+        }
+    }
+    report("large directory", rdtsc() - start, ROUNDS);
+}
+
+static void bench_missing(void) {
+    uint64_t start = rdtsc();
+    for(int i = 0; i < ROUNDS; i++) {
+        if(find_file(BENCH_DIR "/wide/no-such-file")) {
+            printf("lookupbench: missing file was found\n");
+            return;
+        }
+    }
+    report("missing name", rdtsc() - start, ROUNDS);
+}
+
+int main(void) {
+    char deep_path[128];
+    
+    if(make_tree(deep_path) != 0) {
+        printf("lookupbench: cannot create %s\n", BENCH_DIR);
+        return 1;
+    }
+    
+    DcacheStats before, after;
+    dcache_get_stats(&before);
+    
+    printf("Path lookup, %u rounds, depth %d, %d entries per directory\n",
+           ROUNDS, DEPTH + 2, WIDE_FILES);
+    bench_deep(deep_path);
+    bench_wide();
+    bench_missing();
+    
+    dcache_get_stats(&after);
+    uint32_t hits = after.hits - before.hits;
+    uint32_t negative = after.negative_hits - before.negative_hits;
+    uint32_t misses = after.misses - before.misses;
+    uint32_t total = hits + negative + misses;
+    
+    printf("dcache: %u hits, %u negative hits, %u misses (%u%% hit), %u evictions\n",
+           hits, negative, misses, total ? (hits + negative) * 100 / total : 0,
+           after.evictions - before.evictions);
+    return 0;
+}
@@ -0,0 +1,78 @@
+// userspace/utilities/pipebench.c
+// Pipe bandwidth, copying writes against page gifts with vmsplice()
+
+#include "../lib/libc/stdio.h"
+#include "../lib/libc/stdlib.h"
+#include "../lib/libc/unistd.h"
+#include "../../kernel/include/kernel.h"
+#include "../../kernel/include/process.h"
+
+#define TOTAL_BYTES (32 * 1024 * 1024)
+#define READ_SIZE 65536
+
+static int bench_fds[2];
+static uint32_t bench_chunk;
+static int bench_gift;
+
+static void writer(void* arg) {
+    static char buffer[65536];
+    close(bench_fds[0]);
+    
+    for(uint32_t sent = 0; sent < TOTAL_BYTES; sent += bench_chunk) {
+        if(bench_gift) {
+            // The pages leave with the data, so every chunk needs fresh ones
+            char* pages = (char*)ipc_alloc_buffer(bench_chunk);
+            if(!pages) break;
+            pages[0] = (char)sent;
+            if(vmsplice(bench_fds[1], pages, bench_chunk) != (int)bench_chunk) break;
+        } else {
+            if(write(bench_fds[1], buffer, bench_chunk) < 0) break;
+        }
+    }
+    exit(0);
+}
+
+static void run(const char* name, uint32_t chunk, int gift) {
+    static char buffer[READ_SIZE];
+    
+    if(pipe(bench_fds) != 0) {
+        printf("pipebench: cannot create pipe\n");
+        return;
+    }
+    bench_chunk = chunk;
+    bench_gift = gift;
+    
+    uint64_t start = rdtsc();
+    
+    // The writer inherits both ends and closes the one it does not use
+    Process* proc = create_process("pipe-writer", NULL);
+    if(!proc || !create_user_thread(proc, writer, NULL, 0)) {
+        printf("pipebench: cannot start writer\n");
+        close(bench_fds[0]);
+        close(bench_fds[1]);
+        return;
+    }
+    close(bench_fds[1]);
+    
+    uint32_t received = 0;
+    int n;
+    while((n = read(bench_fds[0], buffer, sizeof(buffer))) > 0) {
+        received += n;
+    }
+    uint64_t cycles = rdtsc() - start;
+    close(bench_fds[0]);
+    waitpid(proc->pid, NULL);
+    
+    uint64_t per_ms = tsc_cycles_per_ms();
+    uint32_t mb_per_sec = cycles ? (uint32_t)((uint64_t)received * per_ms * 1000 / cycles / (1024 * 1024)) : 0;
+    printf("%-10s %6u KB chunks %8u MB/s\n", name, chunk / 1024, mb_per_sec);
+}
+
+int main(void) {
+    printf("Pipe bandwidth, %u MB per run\n", TOTAL_BYTES / (1024 * 1024));
+    run("write", 4096, 0);
+    run("write", 65536, 0);
+    run("vmsplice", 4096, 1);
+    run("vmsplice", 65536, 1);
+    return 0;
+}
@@ -0,0 +1,87 @@
+// userspace/utilities/ringbench.c
+// Small pipe writes, one system call each against batches through an I/O ring
+
+#include "../lib/libc/stdio.h"
+#include "../lib/libc/unistd.h"
+#include "../lib/libc/ioring.h"
+#include "../../kernel/include/kernel.h"
+#include "../../kernel/include/process.h"
+
+#define RECORDS 20000
+#define RECORD_SIZE 64
+#define BATCH 32
+
+static int bench_fds[2];
+
+static void drain(void* arg) {
+    static char buffer[4096];
+    close(bench_fds[1]);
+    while(read(bench_fds[0], buffer, sizeof(buffer)) > 0);
+    exit(0);
+}
+
+static uint64_t write_each(const char* record) {
+    uint64_t start = rdtsc();
+    for(int i = 0; i < RECORDS; i++) {
+        if(write(bench_fds[1], record, RECORD_SIZE) != RECORD_SIZE) return 0;
+    }
+    return rdtsc() - start;
+}
+
+static uint64_t write_ring(const char* record) {
+    ioring_t* ring = ioring_create(BATCH);
+    if(!ring) return 0;
+    
+    uint64_t start = rdtsc();
+    for(int done = 0; done < RECORDS; done += BATCH) {
+        for(int i = 0; i < BATCH; i++) {
+            ioring_prep_write(ring, bench_fds[1], record, RECORD_SIZE, done + i);
+        }
+        ioring_submit_and_wait(ring, BATCH);
+        
+        unsigned int user_data;
+        int result;
+        while(ioring_peek(ring, &user_data, &result) == 0) {
+            if(result != RECORD_SIZE) {
+                ioring_destroy(ring);
+                return 0;
+            }
+        }
+    }
+    uint64_t cycles = rdtsc() - start;
+    ioring_destroy(ring);
+    return cycles;
+}
+
+static void run(const char* name, uint64_t (*bench)(const char* record)) {
+    static char record[RECORD_SIZE];
+    
+    if(pipe(bench_fds) != 0) {
+        printf("ringbench: cannot create pipe\n");
+        return;
+    }
+    
+    Process* proc = create_process("ring-drain", NULL);
+    if(!proc || !create_user_thread(proc, drain, NULL, 0)) {
+        printf("ringbench: cannot start reader\n");
+        close(bench_fds[0]);
+        close(bench_fds[1]);
+        return;
+    }
+    close(bench_fds[0]);
+    
+    uint64_t cycles = bench(record);
+    close(bench_fds[1]);
+    waitpid(proc->pid, NULL);
+    
+    uint32_t per_ms = tsc_cycles_per_ms();
+    uint32_t ns = per_ms ? (uint32_t)(cycles * 1000000 / per_ms / RECORDS) : 0;
+    printf("%-16s %8u ns per record\n", name, ns);
+}
+
+int main(void) {
+    printf("%u writes of %u bytes into a pipe\n", RECORDS, RECORD_SIZE);
+    run("write()", write_each);
+    run("ioring x32", write_ring);
+    return 0;
+}
@@ -0,0 +1,49 @@
+// userspace/utilities/sysbench.c
+// Null system call latency through each entry path
+
+#include "../lib/libc/stdio.h"
+#include "../../kernel/include/kernel.h"
+
+#define SYS_GETPID 7
+#define ROUNDS 100000
+
+static void report(const char* name, uint64_t cycles) {
+    uint32_t per_call = (uint32_t)(cycles / ROUNDS);
+    uint32_t per_ms = tsc_cycles_per_ms();
+    uint32_t ns = per_ms ? (uint32_t)((uint64_t)per_call * 1000000 / per_ms) : 0;
+    
+    printf("%-20s %8u cycles %8u ns\n", name, per_call, ns);
+}
+
+static uint64_t bench(int (*entry)(int num, int arg1, int arg2, int arg3)) {
+    uint64_t start = rdtsc();
+    for(int i = 0; i < ROUNDS; i++) {
+        entry(SYS_GETPID, 0, 0, 0);
+    }
+    return rdtsc() - start;
+}
+
+static int in_ring3(void) {
+    uint16_t cs;
+    asm volatile("mov %%cs, %0" : "=r"(cs));
+    return (cs & 3) == 3;
+}
+
+int main(void) {
+    printf("Null system call (getpid), %u rounds\n", ROUNDS);
+    report("int 0x80", bench(syscall_int80));
+    
+    // SYSEXIT returns to ring 3 only, so SYSENTER can only be timed from there
+    if(sysenter_supported() && in_ring3()) {
+        report("sysenter", bench(syscall_sysenter));
+    } else {
+        printf("%-20s skipped, %s\n", "sysenter",
+               sysenter_supported() ? "running in ring 0" : "not supported by this CPU");
+    }
+    
+    // Whatever syscall() settled on
+    char name[32];
+    sprintf(name, "syscall() [%s]", syscall_path_name());
+    report(name, bench(syscall));
+    return 0;
+}
@@ -0,0 +1,8 @@
+// userspace/utilities/top.c
+// Interactive process monitor
+
+#include "../lib/libc/top.h"
+
+int main(void) {
+    return top_run();
+}